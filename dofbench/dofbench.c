@@ -0,0 +1,541 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Measure the speed of the DOF parser in libdof, and generate the synthetic
+ * part of the seed corpus for the fuzz target.
+ *
+ * Each input is parsed repeatedly with dof_parse() for a fixed time, and one
+ * tab-separated line is printed per input:
+ *
+ *	MB/s	probes	bytes	name
+ *
+ * Inputs are raw DOF, e.g., a .SUNW_dof section extracted with objcopy(1).
+ * Without inputs, synthetic objects are built in memory: one of every section
+ * type, with version 1 and version 2 providers and a range of probe counts.
+ * With -w, those objects are written to a directory instead.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dof.h"
+
+#define	nitems(x)	(sizeof(x) / sizeof((x)[0]))
+#define	roundup(x, y)	((((x) + ((y) - 1)) / (y)) * (y))
+
+#define	DOF_MODEL_LP64	2
+#define	DOF_VERSION	2
+#define	DIF_VERSION	2
+#define	MAXSECTS	32
+
+struct buf {
+	uint8_t		*b_data;
+	size_t		b_len;
+	size_t		b_cap;
+};
+
+struct dofbuild {
+	struct dof_sec	db_hdrs[MAXSECTS];
+	struct buf	db_data[MAXSECTS];
+	uint32_t	db_nsecs;
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-p probes] [-t seconds] [file ...]\n",
+	    getprogname());
+	fprintf(stderr, "       %s [-p probes] -w dir\n", getprogname());
+	exit(1);
+}
+
+static void
+buf_add(struct buf *b, const void *p, size_t len)
+{
+
+	if (b->b_len + len > b->b_cap) {
+		while (b->b_len + len > b->b_cap)
+			b->b_cap = b->b_cap == 0 ? 256 : b->b_cap * 2;
+		if ((b->b_data = realloc(b->b_data, b->b_cap)) == NULL)
+			err(1, "realloc");
+	}
+	memcpy(b->b_data + b->b_len, p, len);
+	b->b_len += len;
+}
+
+static void
+buf_align(struct buf *b, size_t align)
+{
+	static const uint8_t zero[8];
+
+	if (align > 1)
+		buf_add(b, zero, (align - b->b_len % align) % align);
+}
+
+static uint32_t
+db_sect(struct dofbuild *db, uint32_t type, uint32_t align, uint32_t entsize,
+    bool load)
+{
+	struct dof_sec *sec;
+
+	if (db->db_nsecs == MAXSECTS)
+		errx(1, "too many sections");
+	sec = &db->db_hdrs[db->db_nsecs];
+	memset(sec, 0, sizeof(*sec));
+	sec->dofs_type = type;
+	sec->dofs_align = align;
+	sec->dofs_flags = load ? DOF_SECF_LOAD : 0;
+	sec->dofs_entsize = entsize;
+	return (db->db_nsecs++);
+}
+
+static void
+db_add(struct dofbuild *db, uint32_t sec, const void *p, size_t len)
+{
+
+	buf_add(&db->db_data[sec], p, len);
+}
+
+/* Append a string to the string table, which is always section 0. */
+static uint32_t
+db_str(struct dofbuild *db, const char *s)
+{
+	uint32_t off;
+
+	off = db->db_data[0].b_len;
+	db_add(db, 0, s, strlen(s) + 1);
+	return (off);
+}
+
+/*
+ * Lay the object out: the header, the section headers, then the loadable
+ * sections and finally the others, each at its alignment.
+ */
+static void *
+db_finish(struct dofbuild *db, size_t *sizep)
+{
+	struct dof_hdr hdr;
+	struct buf out;
+	uint32_t i;
+	int pass;
+	bool load;
+
+	memset(&out, 0, sizeof(out));
+	memset(&hdr, 0, sizeof(hdr));
+	buf_add(&out, &hdr, sizeof(hdr));
+	buf_add(&out, db->db_hdrs, db->db_nsecs * sizeof(struct dof_sec));
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < db->db_nsecs; i++) {
+			load = (db->db_hdrs[i].dofs_flags & DOF_SECF_LOAD) != 0;
+			if (load != (pass == 0))
+				continue;
+			buf_align(&out, db->db_hdrs[i].dofs_align);
+			db->db_hdrs[i].dofs_offset = out.b_len;
+			db->db_hdrs[i].dofs_size = db->db_data[i].b_len;
+			if (db->db_data[i].b_len > 0)
+				buf_add(&out, db->db_data[i].b_data,
+				    db->db_data[i].b_len);
+			free(db->db_data[i].b_data);
+		}
+		if (pass == 0)
+			hdr.dofh_loadsz = out.b_len;
+	}
+
+	memcpy(hdr.dofh_ident, "\177DOF", 4);
+	hdr.dofh_ident[4] = DOF_MODEL_LP64;
+	hdr.dofh_ident[5] = DOF_ENCODE_NATIVE;
+	hdr.dofh_ident[6] = DOF_VERSION;
+	hdr.dofh_ident[7] = DIF_VERSION;
+	hdr.dofh_ident[8] = 8;
+	hdr.dofh_ident[9] = 8;
+	hdr.dofh_hdrsize = sizeof(hdr);
+	hdr.dofh_secsize = sizeof(struct dof_sec);
+	hdr.dofh_secnum = db->db_nsecs;
+	hdr.dofh_secoff = sizeof(hdr);
+	hdr.dofh_filesz = out.b_len;
+	memcpy(out.b_data, &hdr, sizeof(hdr));
+	memcpy(out.b_data + sizeof(hdr), db->db_hdrs,
+	    db->db_nsecs * sizeof(struct dof_sec));
+	*sizep = out.b_len;
+	return (out.b_data);
+}
+
+/*
+ * Add a USDT provider with "nprobes" probes, as dtrace -G would, with its
+ * relocations.  Version 1 objects lack is-enabled probe offsets.
+ */
+static void
+make_provider(struct dofbuild *db, unsigned nprobes, bool v1)
+{
+	static const char *types[] = {
+		"int", "char *", "uint64_t", "struct conn *",
+	};
+	struct dof_provider pv;
+	struct dof_probe pr;
+	struct dof_relohdr rh;
+	struct dof_relodesc rd;
+	uint32_t probes, prargs, proffs, prenoffs, reltab, off;
+	char name[32];
+	size_t entsize;
+	unsigned i, j;
+	uint8_t arg;
+
+	/* Version 1 probes end before dofpr_enoffidx, padded to 8 bytes. */
+	entsize = v1 ? roundup(offsetof(struct dof_probe, dofpr_enoffidx),
+	    _Alignof(struct dof_probe)) : sizeof(struct dof_probe);
+	probes = db_sect(db, DOF_SECT_PROBES, 8, entsize, true);
+	prargs = db_sect(db, DOF_SECT_PRARGS, 1, 1, true);
+	proffs = db_sect(db, DOF_SECT_PROFFS, 4, 4, true);
+	prenoffs = v1 ? DOF_SECIDX_NONE :
+	    db_sect(db, DOF_SECT_PRENOFFS, 4, 4, true);
+	reltab = db_sect(db, DOF_SECT_RELTAB, 8, sizeof(rd), true);
+
+	for (i = 0; i < nprobes; i++) {
+		memset(&pr, 0, sizeof(pr));
+		snprintf(name, sizeof(name), "conn_func%u", i / 2);
+		pr.dofpr_func = db_str(db, name);
+		snprintf(name, sizeof(name), "probe-%u", i);
+		pr.dofpr_name = db_str(db, name);
+
+		/* Argument lists are runs of consecutive strings. */
+		pr.dofpr_nargc = pr.dofpr_xargc = i % 5;
+		pr.dofpr_nargv = db->db_data[0].b_len;
+		for (j = 0; j < pr.dofpr_nargc; j++)
+			(void)db_str(db, types[(i + j) % 4]);
+		pr.dofpr_xargv = db->db_data[0].b_len;
+		for (j = 0; j < pr.dofpr_xargc; j++)
+			(void)db_str(db, types[(i + j) % 4]);
+		pr.dofpr_argidx = db->db_data[prargs].b_len;
+		for (j = 0; j < pr.dofpr_xargc; j++) {
+			arg = pr.dofpr_xargc - j - 1;
+			db_add(db, prargs, &arg, 1);
+		}
+
+		pr.dofpr_offidx = db->db_data[proffs].b_len / 4;
+		pr.dofpr_noffs = 1 + i % 3;
+		for (j = 0; j < pr.dofpr_noffs; j++) {
+			off = 0x10 * (j + 1) + i % 16;
+			db_add(db, proffs, &off, sizeof(off));
+		}
+		if (!v1) {
+			pr.dofpr_enoffidx = db->db_data[prenoffs].b_len / 4;
+			pr.dofpr_nenoffs = i % 2;
+			for (j = 0; j < pr.dofpr_nenoffs; j++) {
+				off = 0x8 + i % 16;
+				db_add(db, prenoffs, &off, sizeof(off));
+			}
+		}
+		db_add(db, probes, &pr, entsize);
+
+		memset(&rd, 0, sizeof(rd));
+		rd.dofr_name = pr.dofpr_func;
+		rd.dofr_type = DOF_RELO_SETX;
+		rd.dofr_offset = i * entsize + offsetof(struct dof_probe,
+		    dofpr_addr);
+		db_add(db, reltab, &rd, sizeof(rd));
+	}
+
+	memset(&pv, 0, sizeof(pv));
+	pv.dofpv_strtab = 0;
+	pv.dofpv_probes = probes;
+	pv.dofpv_prargs = prargs;
+	pv.dofpv_proffs = proffs;
+	pv.dofpv_name = db_str(db, "synthetic");
+	/* Evolving/Evolving/ISA, as is usual for USDT providers. */
+	pv.dofpv_provattr = pv.dofpv_modattr = pv.dofpv_funcattr =
+	    pv.dofpv_nameattr = pv.dofpv_argsattr = 5 << 24 | 5 << 16 | 4 << 8;
+	pv.dofpv_prenoffs = prenoffs;
+	db_add(db, db_sect(db, DOF_SECT_PROVIDER, 4, 0, true), &pv, v1 ?
+	    offsetof(struct dof_provider, dofpv_prenoffs) : sizeof(pv));
+
+	memset(&rh, 0, sizeof(rh));
+	rh.dofr_strtab = 0;
+	rh.dofr_relsec = reltab;
+	rh.dofr_tgtsec = probes;
+	db_add(db, db_sect(db, DOF_SECT_URELHDR, 4, 0, true), &rh,
+	    sizeof(rh));
+}
+
+/* Add an enabling, with its DIF, and the other section types. */
+static void
+make_enabling(struct dofbuild *db)
+{
+	/* setx DT_INTEGER[0], %r1; ret %r1 */
+	static const uint32_t dif[] = { 0x25000001, 0x23000001 };
+	static const uint64_t ints[] = { 0xdeadbeef };
+	struct dof_probedesc pd;
+	struct dof_actdesc ad;
+	struct dof_ecbdesc ecb;
+	struct dof_difohdr dh;
+	struct dtrace_difv var;
+	struct dof_optdesc od;
+	struct dof_xlmember xm;
+	struct dof_xlator xl;
+	struct dof_xlref xr;
+	uint32_t difo, sec, links[2];
+	char uts[5 * 32];
+
+	links[0] = db_sect(db, DOF_SECT_DIF, 4, 4, true);
+	db_add(db, links[0], dif, sizeof(dif));
+	links[1] = db_sect(db, DOF_SECT_INTTAB, 8, 8, true);
+	db_add(db, links[1], ints, sizeof(ints));
+	memset(&dh, 0, sizeof(dh));
+	dh.dofd_rtype.dtdt_size = 8;
+	difo = db_sect(db, DOF_SECT_DIFOHDR, 4, 0, true);
+	db_add(db, difo, &dh, offsetof(struct dof_difohdr, dofd_links));
+	db_add(db, difo, links, sizeof(links));
+
+	memset(&pd, 0, sizeof(pd));
+	pd.dofp_provider = db_str(db, "synthetic*");
+	pd.dofp_mod = db_str(db, "");
+	pd.dofp_func = db_str(db, "conn_func0");
+	pd.dofp_name = db_str(db, "probe-0");
+	pd.dofp_id = 1;
+	memset(&ad, 0, sizeof(ad));
+	ad.dofa_difo = difo;
+	ad.dofa_strtab = DOF_SECIDX_NONE;
+	ad.dofa_kind = 0x0100;
+	memset(&ecb, 0, sizeof(ecb));
+	ecb.dofe_probes = db_sect(db, DOF_SECT_PROBEDESC, 4, 0, true);
+	db_add(db, ecb.dofe_probes, &pd, sizeof(pd));
+	ecb.dofe_pred = DOF_SECIDX_NONE;
+	ecb.dofe_actions = db_sect(db, DOF_SECT_ACTDESC, 8, sizeof(ad), true);
+	db_add(db, ecb.dofe_actions, &ad, sizeof(ad));
+	db_add(db, db_sect(db, DOF_SECT_ECBDESC, 8, 0, true), &ecb,
+	    sizeof(ecb));
+
+	memset(&var, 0, sizeof(var));
+	var.dtdv_name = db_str(db, "count");
+	var.dtdv_id = 0x500;
+	var.dtdv_type.dtdt_size = 8;
+	db_add(db, db_sect(db, DOF_SECT_VARTAB, 4, sizeof(var), true), &var,
+	    sizeof(var));
+	db_add(db, db_sect(db, DOF_SECT_TYPTAB, 4, sizeof(var.dtdv_type),
+	    true), &var.dtdv_type, sizeof(var.dtdv_type));
+	memset(&od, 0, sizeof(od));
+	od.dofo_strtab = DOF_SECIDX_NONE;
+	od.dofo_value = 4096;
+	db_add(db, db_sect(db, DOF_SECT_OPTDESC, 8, sizeof(od), true), &od,
+	    sizeof(od));
+
+	memset(&xm, 0, sizeof(xm));
+	xm.dofxm_difo = difo;
+	xm.dofxm_name = db_str(db, "conn_id");
+	sec = db_sect(db, DOF_SECT_XLMEMBERS, 4, sizeof(xm), true);
+	db_add(db, sec, &xm, sizeof(xm));
+	memset(&xl, 0, sizeof(xl));
+	xl.dofxl_members = sec;
+	xl.dofxl_strtab = 0;
+	xl.dofxl_argv = db_str(db, "struct conn *");
+	xl.dofxl_argc = 1;
+	xl.dofxl_type = db_str(db, "conninfo_t");
+	sec = db_sect(db, DOF_SECT_XLIMPORT, 4, 0, true);
+	db_add(db, sec, &xl, sizeof(xl));
+	memset(&xr, 0, sizeof(xr));
+	xr.dofxr_xlator = sec;
+	db_add(db, db_sect(db, DOF_SECT_XLTAB, 4, sizeof(xr), true), &xr,
+	    sizeof(xr));
+
+	db_add(db, db_sect(db, DOF_SECT_COMMENTS, 1, 0, false),
+	    "synthetic DOF", sizeof("synthetic DOF"));
+	db_add(db, db_sect(db, DOF_SECT_SOURCE, 1, 0, false),
+	    "conn*:::probe-0 { @ = count(); }",
+	    sizeof("conn*:::probe-0 { @ = count(); }"));
+	memset(uts, 0, sizeof(uts));
+	strcpy(uts, "FreeBSD");
+	db_add(db, db_sect(db, DOF_SECT_UTSNAME, 1, 0, false), uts,
+	    sizeof(uts));
+}
+
+static void *
+make_dof(unsigned nprobes, bool v1, size_t *sizep)
+{
+	struct dofbuild db;
+
+	memset(&db, 0, sizeof(db));
+	(void)db_sect(&db, DOF_SECT_STRTAB, 1, 0, true);
+	(void)db_str(&db, "");
+	make_provider(&db, nprobes, v1);
+	make_enabling(&db);
+	return (db_finish(&db, sizep));
+}
+
+static void *
+read_file(const char *path, size_t *sizep)
+{
+	struct stat sb;
+	void *buf;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		err(1, "%s", path);
+	if (fstat(fd, &sb) != 0)
+		err(1, "%s", path);
+	/* malloc() provides the alignment that DOF has within its section. */
+	if ((buf = malloc(sb.st_size > 0 ? sb.st_size : 1)) == NULL)
+		err(1, "malloc");
+	if ((n = read(fd, buf, sb.st_size)) != sb.st_size)
+		err(1, "%s: short read", path);
+	(void)close(fd);
+	*sizep = sb.st_size;
+	return (buf);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Parse one object repeatedly for "secs" seconds.  The clock is read after
+ * batches whose size doubles up to 64k parses, so that reading it costs
+ * little even for small objects.
+ */
+static void
+bench(const char *name, const void *buf, size_t size, double secs)
+{
+	struct dof_stats st;
+	const char *errstr;
+	double start, elapsed;
+	uint64_t batch, n, i;
+
+	if ((errstr = dof_parse(buf, size, &st)) != NULL) {
+		warnx("%s: %s", name, errstr);
+		return;
+	}
+	if (st.dst_invalid > 0)
+		warnx("%s: %ju invalid sections or references", name,
+		    (uintmax_t)st.dst_invalid);
+
+	n = 0;
+	batch = 1;
+	start = now();
+	do {
+		for (i = 0; i < batch; i++)
+			(void)dof_parse(buf, size, &st);
+		n += batch;
+		if (batch < 65536)
+			batch *= 2;
+	} while ((elapsed = now() - start) < secs);
+
+	printf("%.1f\t%ju\t%zu\t%s\n", n * size / elapsed / 1e6,
+	    (uintmax_t)st.dst_probes, size, name);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned sizes[] = { 1, 16, 0 };
+	unsigned long nprobes;
+	const char *dir;
+	char *endptr, name[64], *path;
+	double secs;
+	void *buf;
+	size_t size;
+	FILE *fp;
+	unsigned i;
+	int ch, v1;
+
+	dir = NULL;
+	nprobes = 4096;
+	secs = 1;
+	while ((ch = getopt(argc, argv, "p:t:w:")) != -1) {
+		switch (ch) {
+		case 'p':
+			errno = 0;
+			nprobes = strtoul(optarg, &endptr, 10);
+			if (optarg[0] == '\0' || *endptr != '\0' ||
+			    errno != 0 || nprobes == 0 || nprobes > 1000000)
+				usage();
+			break;
+		case 't':
+			secs = strtod(optarg, &endptr);
+			if (optarg[0] == '\0' || *endptr != '\0' || secs <= 0)
+				usage();
+			break;
+		case 'w':
+			dir = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (dir != NULL && argc > 0)
+		usage();
+
+	if (argc > 0) {
+		for (; argc > 0; argc--, argv++) {
+			buf = read_file(argv[0], &size);
+			bench(argv[0], buf, size, secs);
+			free(buf);
+		}
+		return (0);
+	}
+
+	/* The last size is the one given with -p. */
+	for (v1 = 0; v1 < 2; v1++) {
+		for (i = 0; i < nitems(sizes); i++) {
+			buf = make_dof(sizes[i] != 0 ? sizes[i] : nprobes, v1,
+			    &size);
+			snprintf(name, sizeof(name), "synthetic-v%d-%lu.dof",
+			    v1 ? 1 : 2, sizes[i] != 0 ? sizes[i] : nprobes);
+			if (dir == NULL) {
+				bench(name, buf, size, secs);
+			} else {
+				if (asprintf(&path, "%s/%s", dir, name) < 0)
+					err(1, "asprintf");
+				if ((fp = fopen(path, "w")) == NULL ||
+				    fwrite(buf, size, 1, fp) != 1 ||
+				    fclose(fp) != 0)
+					err(1, "%s", path);
+				free(path);
+			}
+			free(buf);
+		}
+	}
+	return (0);
+}
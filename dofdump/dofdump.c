@@ -24,42 +24,67 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+#include <sys/endian.h>
+#include <sys/stat.h>
+
+#include <ar.h>
 #include <err.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <fts.h>
 #include <gelf.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#define	DOF_ID_SIZE	16
+#include "dof.h"
+
+static const char *secnames[] = {
+	"NONE", "COMMENTS", "SOURCE", "ECBDESC", "PROBEDESC", "ACTDESC",
+	"DIFOHDR", "DIF", "STRTAB", "VARTAB", "RELTAB", "TYPTAB", "URELHDR",
+	"KRELHDR", "OPTDESC", "PROVIDER", "PROBES", "PRARGS", "PROFFS",
+	"INTTAB", "UTSNAME", "XLTAB", "XLMEMBERS", "XLIMPORT", "XLEXPORT",
+	"PREXPORT", "PRENOFFS",
+};
 
-struct dof_hdr {
-	uint8_t dofh_ident[DOF_ID_SIZE];
-	uint32_t dofh_flags;
-	uint32_t dofh_hdrsize;
-	uint32_t dofh_secsize;
-	uint32_t dofh_secnum;
-	uint64_t dofh_secoff;
-	uint64_t dofh_loadsz;
-	uint64_t dofh_filesz;
-	uint64_t dofh_pad;
+static const char *stabnames[] = {
+	"Internal", "Private", "Obsolete", "External", "Unstable", "Evolving",
+	"Stable", "Standard",
 };
 
-struct dof_sec {
-	uint32_t dofs_type;
-	uint32_t dofs_align;
-	uint32_t dofs_flags;
-	uint32_t dofs_entsize;
-	uint64_t dofs_offset;
-	uint64_t dofs_size;
+static const char *classnames[] = {
+	"Unknown", "CPU", "Platform", "Group", "ISA", "Common",
 };
 
+static const char *difops[] = {
+	"??", "or", "xor", "and", "sll", "srl", "sub", "add", "mul", "sdiv",
+	"udiv", "srem", "urem", "not", "mov", "cmp", "tst", "ba", "be", "bne",
+	"bg", "bgu", "bge", "bgeu", "bl", "blu", "ble", "bleu", "ldsb", "ldsh",
+	"ldsw", "ldub", "lduh", "lduw", "ldx", "ret", "nop", "setx", "sets",
+	"scmp", "ldga", "ldgs", "stgs", "ldta", "ldts", "stts", "sra", "call",
+	"pushtr", "pushtv", "popts", "flushts", "ldgaa", "ldtaa", "stgaa",
+	"sttaa", "ldls", "stls", "allocs", "copys", "stb", "sth", "stw", "stx",
+	"uldsb", "uldsh", "uldsw", "uldub", "ulduh", "ulduw", "uldx", "rldsb",
+	"rldsh", "rldsw", "rldub", "rlduh", "rlduw", "rldx", "xlate", "xlarg",
+};
+
+#define	nitems(x)	(sizeof(x) / sizeof((x)[0]))
+
 static void
 usage(void)
 {
 
 	fprintf(stderr, "usage: %s <file>\n", getprogname());
+	fprintf(stderr, "       %s -d <old> <new>\n", getprogname());
+	fprintf(stderr, "       %s -r [-j jobs] <dir> [<dir> ...]\n",
+	    getprogname());
 	exit(1);
 }
 
@@ -77,62 +102,1014 @@ encstr(uint32_t b)
 	return (b == 0 ? "NONE" : b == 1 ? "LSB" : b == 2 ? "MSB" : "??");
 }
 
-int
-main(int argc, char **argv)
+static const char *
+secstr(uint32_t type)
 {
-	Elf *e;
-	int fd, i;
-	Elf_Scn *scn;
-	Elf_Data *data;
-	char *name;
-	size_t shstrndx;
-	GElf_Shdr shdr;
-	struct dof_hdr *hdr;
-	struct dof_sec *dsec;
-
-	if (argc != 2)
-		usage();
 
-	if (elf_version(EV_CURRENT) == EV_NONE)
-		errx(1, "ELF library initialization failed: %s",
-		    elf_errmsg(-1));
+	return (type < nitems(secnames) ? secnames[type] : "??");
+}
 
-	if ((fd = open(argv[1], O_RDONLY)) < 0)
-		err(1, "opening %s", argv[1]);
+static const char *
+stabstr(uint32_t s)
+{
 
-	if ((e = elf_begin(fd, ELF_C_READ, NULL)) == NULL)
-		errx(1, "elf_begin() failed: %s", elf_errmsg(-1));
+	return (s < nitems(stabnames) ? stabnames[s] : "??");
+}
+
+static const char *
+classstr(uint32_t c)
+{
+
+	return (c < nitems(classnames) ? classnames[c] : "??");
+}
 
-	if (elf_kind(e) != ELF_K_ELF)
-		errx(1, "%s is not an ELF object", argv[1]);
+static const char *
+pstr(const char *s)
+{
 
-	if (elf_getshdrstrndx(e, &shstrndx) != 0)
-		errx(1, "elf_getshdrstrndx failed: %s", elf_errmsg(-1));
+	return (s != NULL ? s : "<invalid>");
+}
 
-	scn = NULL;
-	while ((scn = elf_nextscn(e, scn)) != NULL) {
-		if (gelf_getshdr(scn, &shdr) != &shdr)
-			errx(1, "gelf_getshdr failed: %s", elf_errmsg(-1));
-		if ((name = elf_strptr(e, shstrndx, shdr.sh_name)) == NULL)
-			errx(1, "elf_strptr() failed: %s", elf_errmsg(-1));
+static void
+print_attr(const char *what, dof_attr_t attr)
+{
 
-		if (shdr.sh_type == SHT_SUNW_dof &&
-		    strcmp(name, ".SUNW_dof") == 0)
+	printf("        %s attributes: %s/%s/%s\n", what,
+	    stabstr(DOF_ATTR_NAME(attr)), stabstr(DOF_ATTR_DATA(attr)),
+	    classstr(DOF_ATTR_CLASS(attr)));
+}
+
+/*
+ * Print a list of "n" consecutive strings starting at offset "off", as used
+ * for probe argument types.
+ */
+static void
+print_strlist(const char *what, const struct dof_secview *strtab,
+    uint64_t off, unsigned n)
+{
+	const char *s;
+	unsigned i;
+
+	printf("            %s: (", what);
+	for (i = 0; i < n; i++) {
+		if ((s = dof_string(strtab, off)) == NULL) {
+			printf("%s<invalid>", i > 0 ? ", " : "");
 			break;
+		}
+		printf("%s%s", i > 0 ? ", " : "", s);
+		off += strlen(s) + 1;
 	}
+	printf(")\n");
+}
 
-	if (scn == NULL)
-		errx(1, "no DOF section found in %s", argv[1]);
+static void
+print_offsets(const char *what, const struct dof_secview *ds, uint64_t addr,
+    uint32_t idx, uint32_t n)
+{
+	const uint32_t *offs;
+	uint32_t i;
 
-	if ((data = elf_getdata(scn, NULL)) == NULL)
-		errx(1, "couldn't obtain data descriptor for .SUNW_dof: %s",
-		    elf_errmsg(-1));
+	if (n == 0)
+		return;
+	printf("            %s:", what);
+	if (ds == NULL || (offs = dof_array(ds, idx, n, sizeof(*offs))) == NULL) {
+		printf(" <invalid>\n");
+		return;
+	}
+	for (i = 0; i < n; i++)
+		printf(" 0x%jx", (uintmax_t)(addr + offs[i]));
+	printf("\n");
+}
+
+static void
+dump_probe(const struct dof_probe *pr, bool enoffs, const char *provname,
+    const struct dof_secview *strtab, const struct dof_secview *prargs,
+    const struct dof_secview *proffs, const struct dof_secview *prenoffs)
+{
+	const uint8_t *map;
+	unsigned i;
+
+	printf("        Probe: %s:%s:%s\n", provname,
+	    pstr(dof_string(strtab, pr->dofpr_func)),
+	    pstr(dof_string(strtab, pr->dofpr_name)));
+	printf("            Function address: 0x%jx\n",
+	    (uintmax_t)pr->dofpr_addr);
+	print_strlist("Native arguments", strtab, pr->dofpr_nargv,
+	    pr->dofpr_nargc);
+	print_strlist("Translated arguments", strtab, pr->dofpr_xargv,
+	    pr->dofpr_xargc);
+	if (pr->dofpr_xargc > 0) {
+		printf("            Argument mapping:");
+		map = prargs == NULL ? NULL : dof_array(prargs,
+		    pr->dofpr_argidx, pr->dofpr_xargc, sizeof(*map));
+		if (map == NULL)
+			printf(" <invalid>");
+		else
+			for (i = 0; i < pr->dofpr_xargc; i++)
+				printf(" %u", map[i]);
+		printf("\n");
+	}
+	print_offsets("Offsets", proffs, pr->dofpr_addr, pr->dofpr_offidx,
+	    pr->dofpr_noffs);
+	if (enoffs)
+		print_offsets("Is-enabled offsets", prenoffs, pr->dofpr_addr,
+		    pr->dofpr_enoffidx, pr->dofpr_nenoffs);
+}
+
+static void
+dump_provider(const struct dof_view *dv, const struct dof_provider *pv,
+    bool hasenoffs)
+{
+	struct dof_secview strtab, probes, prargs, proffs, prenoffs;
+	const struct dof_probe *pr;
+	const char *name;
+	bool haveargs, haveoffs, haveenoffs, enoffs;
+	uint64_t i;
+
+	if (dof_section(dv, pv->dofpv_strtab, DOF_SECT_STRTAB, &strtab) != 0) {
+		printf("        Provider string table: <invalid>\n");
+		return;
+	}
+	name = pstr(dof_string(&strtab, pv->dofpv_name));
+	printf("        Provider: %s\n", name);
+	print_attr("Provider", pv->dofpv_provattr);
+	print_attr("Module", pv->dofpv_modattr);
+	print_attr("Function", pv->dofpv_funcattr);
+	print_attr("Name", pv->dofpv_nameattr);
+	print_attr("Argument", pv->dofpv_argsattr);
+
+	if (dof_section(dv, pv->dofpv_probes, DOF_SECT_PROBES, &probes) != 0) {
+		printf("        Probes: <invalid>\n");
+		return;
+	}
+	haveargs = dof_section(dv, pv->dofpv_prargs, DOF_SECT_PRARGS,
+	    &prargs) == 0;
+	haveoffs = dof_section(dv, pv->dofpv_proffs, DOF_SECT_PROFFS,
+	    &proffs) == 0;
+	haveenoffs = hasenoffs && pv->dofpv_prenoffs != DOF_SECIDX_NONE &&
+	    dof_section(dv, pv->dofpv_prenoffs, DOF_SECT_PRENOFFS,
+	    &prenoffs) == 0;
+
+	/* Version 1 probes lack the is-enabled offset fields. */
+	enoffs = probes.ds_sec->dofs_entsize >= sizeof(struct dof_probe);
+	printf("        Probes: %ju\n", (uintmax_t)probes.ds_nent);
+	for (i = 0; i < probes.ds_nent; i++) {
+		pr = dof_entry(&probes, i,
+		    offsetof(struct dof_probe, dofpr_enoffidx));
+		if (pr == NULL) {
+			printf("        Probe %ju: <invalid>\n", (uintmax_t)i);
+			break;
+		}
+		dump_probe(pr, enoffs, name, &strtab,
+		    haveargs ? &prargs : NULL, haveoffs ? &proffs : NULL,
+		    haveenoffs ? &prenoffs : NULL);
+	}
+}
+
+static void
+dump_relocs(const struct dof_view *dv, const struct dof_relohdr *rh)
+{
+	struct dof_secview strtab, relsec;
+	const struct dof_relodesc *r;
+	uint64_t i;
+
+	printf("        Target section: %u\n", rh->dofr_tgtsec);
+	if (dof_section(dv, rh->dofr_strtab, DOF_SECT_STRTAB, &strtab) != 0 ||
+	    dof_section(dv, rh->dofr_relsec, DOF_SECT_RELTAB, &relsec) != 0) {
+		printf("        Relocations: <invalid>\n");
+		return;
+	}
+	printf("        Relocations: %ju\n", (uintmax_t)relsec.ds_nent);
+	for (i = 0; i < relsec.ds_nent; i++) {
+		if ((r = dof_entry(&relsec, i, sizeof(*r))) == NULL) {
+			printf("            <invalid>\n");
+			break;
+		}
+		printf("            %s 0x%jx %s 0x%jx\n",
+		    r->dofr_type == DOF_RELO_SETX ? "SETX" :
+		    r->dofr_type == DOF_RELO_DOFREL ? "DOFREL" :
+		    r->dofr_type == DOF_RELO_NONE ? "NONE" : "??",
+		    (uintmax_t)r->dofr_offset,
+		    pstr(dof_string(&strtab, r->dofr_name)),
+		    (uintmax_t)r->dofr_data);
+	}
+}
+
+static void
+dump_probedesc(const struct dof_view *dv, const struct dof_probedesc *pd)
+{
+	struct dof_secview strtab;
+
+	if (dof_section(dv, pd->dofp_strtab, DOF_SECT_STRTAB, &strtab) != 0) {
+		printf("        Probe description: <invalid>\n");
+		return;
+	}
+	printf("        Probe description: %s:%s:%s:%s (id %u)\n",
+	    pstr(dof_string(&strtab, pd->dofp_provider)),
+	    pstr(dof_string(&strtab, pd->dofp_mod)),
+	    pstr(dof_string(&strtab, pd->dofp_func)),
+	    pstr(dof_string(&strtab, pd->dofp_name)), pd->dofp_id);
+}
+
+static void
+print_secref(const char *what, const struct dof_view *dv, dof_secidx_t idx)
+{
+	struct dof_secview ds;
+
+	if (idx == DOF_SECIDX_NONE)
+		printf("        %s: none\n", what);
+	else if (dof_section(dv, idx, DOF_SECT_NONE, &ds) != 0)
+		printf("        %s: %u <invalid>\n", what, idx);
+	else
+		printf("        %s: %u (%s)\n", what, idx,
+		    secstr(ds.ds_sec->dofs_type));
+}
+
+static void
+print_type(const char *what, const struct dtrace_diftype *t)
+{
+
+	printf("        %s: kind %u ckind %u flags 0x%x size %u\n", what,
+	    t->dtdt_kind, t->dtdt_ckind, t->dtdt_flags, t->dtdt_size);
+}
+
+/* Print one line per table entry, or one line for the whole section. */
+static void
+dump_section_data(const struct dof_view *dv, const struct dof_secview *ds)
+{
+	const struct dof_ecbdesc *ecb;
+	const struct dof_probedesc *pd;
+	const struct dof_actdesc *ad;
+	const struct dof_difohdr *dh;
+	const struct dof_relohdr *rh;
+	const struct dof_optdesc *od;
+	const struct dof_provider *pv;
+	const struct dof_xlator *xl;
+	const struct dof_xlmember *xm;
+	const struct dof_xlref *xr;
+	const struct dtrace_difv *dv_var;
+	const struct dtrace_diftype *ty;
+	const uint32_t *instr;
+	const uint64_t *ints;
+	const char *p, *end;
+	uint64_t i, n;
+
+	switch (ds->ds_sec->dofs_type) {
+	case DOF_SECT_COMMENTS:
+	case DOF_SECT_SOURCE:
+		p = (const char *)ds->ds_data;
+		printf("        %.*s\n", (int)strnlen(p, ds->ds_size), p);
+		break;
+	case DOF_SECT_UTSNAME:
+		/* struct utsname: five fixed-size, NUL-padded fields. */
+		n = ds->ds_size / 5;
+		for (i = 0; n > 0 && i < 5; i++) {
+			p = (const char *)ds->ds_data + i * n;
+			printf("        %.*s\n", (int)strnlen(p, n), p);
+		}
+		break;
+	case DOF_SECT_STRTAB:
+		p = (const char *)ds->ds_data;
+		end = p + ds->ds_size;
+		for (n = 0; p < end; n++) {
+			p = memchr(p, '\0', end - p);
+			if (p == NULL)
+				break;
+			p++;
+		}
+		printf("        Strings: %ju\n", (uintmax_t)n);
+		break;
+	case DOF_SECT_ECBDESC:
+		if ((ecb = dof_struct(ds, sizeof(*ecb))) == NULL)
+			goto invalid;
+		print_secref("Probes", dv, ecb->dofe_probes);
+		print_secref("Predicate", dv, ecb->dofe_pred);
+		print_secref("Actions", dv, ecb->dofe_actions);
+		printf("        User argument: 0x%jx\n",
+		    (uintmax_t)ecb->dofe_uarg);
+		break;
+	case DOF_SECT_PROBEDESC:
+		if ((pd = dof_struct(ds, sizeof(*pd))) == NULL)
+			goto invalid;
+		dump_probedesc(dv, pd);
+		break;
+	case DOF_SECT_ACTDESC:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((ad = dof_entry(ds, i, sizeof(*ad))) == NULL)
+				goto invalid;
+			printf("        Action %ju: kind 0x%x ntuple %u "
+			    "arg 0x%jx uarg 0x%jx\n", (uintmax_t)i,
+			    ad->dofa_kind, ad->dofa_ntuple,
+			    (uintmax_t)ad->dofa_arg, (uintmax_t)ad->dofa_uarg);
+			print_secref("DIF object", dv, ad->dofa_difo);
+		}
+		break;
+	case DOF_SECT_DIFOHDR:
+		if ((dh = dof_struct(ds,
+		    offsetof(struct dof_difohdr, dofd_links))) == NULL)
+			goto invalid;
+		print_type("Return type", &dh->dofd_rtype);
+		n = (ds->ds_size - offsetof(struct dof_difohdr, dofd_links)) /
+		    sizeof(dof_secidx_t);
+		for (i = 0; i < n; i++)
+			print_secref("Link", dv, dh->dofd_links[i]);
+		break;
+	case DOF_SECT_DIF:
+		n = ds->ds_size / sizeof(*instr);
+		instr = (const uint32_t *)ds->ds_data;
+		for (i = 0; i < n; i++)
+			printf("        %04jx: %08x  %-8s %u, %u, %u\n",
+			    (uintmax_t)i, instr[i],
+			    instr[i] >> 24 < nitems(difops) ?
+			    difops[instr[i] >> 24] : "??",
+			    (instr[i] >> 16) & 0xff, (instr[i] >> 8) & 0xff,
+			    instr[i] & 0xff);
+		break;
+	case DOF_SECT_INTTAB:
+		n = ds->ds_size / sizeof(*ints);
+		ints = (const uint64_t *)ds->ds_data;
+		for (i = 0; i < n; i++)
+			printf("        %ju: 0x%jx\n", (uintmax_t)i,
+			    (uintmax_t)ints[i]);
+		break;
+	case DOF_SECT_VARTAB:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((dv_var = dof_entry(ds, i, sizeof(*dv_var))) == NULL)
+				goto invalid;
+			printf("        Variable %u: name %u kind %u scope %u "
+			    "flags 0x%x\n", dv_var->dtdv_id, dv_var->dtdv_name,
+			    dv_var->dtdv_kind, dv_var->dtdv_scope,
+			    dv_var->dtdv_flags);
+		}
+		break;
+	case DOF_SECT_TYPTAB:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((ty = dof_entry(ds, i, sizeof(*ty))) == NULL)
+				goto invalid;
+			print_type("Type", ty);
+		}
+		break;
+	case DOF_SECT_URELHDR:
+	case DOF_SECT_KRELHDR:
+		if ((rh = dof_struct(ds, sizeof(*rh))) == NULL)
+			goto invalid;
+		dump_relocs(dv, rh);
+		break;
+	case DOF_SECT_OPTDESC:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((od = dof_entry(ds, i, sizeof(*od))) == NULL)
+				goto invalid;
+			printf("        Option %u: 0x%jx\n", od->dofo_option,
+			    (uintmax_t)od->dofo_value);
+		}
+		break;
+	case DOF_SECT_PROVIDER:
+		if ((pv = dof_struct(ds,
+		    offsetof(struct dof_provider, dofpv_prenoffs))) == NULL)
+			goto invalid;
+		dump_provider(dv, pv, ds->ds_size >= sizeof(*pv));
+		break;
+	case DOF_SECT_XLTAB:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((xr = dof_entry(ds, i, sizeof(*xr))) == NULL)
+				goto invalid;
+			printf("        Translator reference: section %u "
+			    "member %u argument %u\n", xr->dofxr_xlator,
+			    xr->dofxr_member, xr->dofxr_argn);
+		}
+		break;
+	case DOF_SECT_XLMEMBERS:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((xm = dof_entry(ds, i, sizeof(*xm))) == NULL)
+				goto invalid;
+			printf("        Member %ju: name %u\n", (uintmax_t)i,
+			    xm->dofxm_name);
+			print_secref("DIF object", dv, xm->dofxm_difo);
+		}
+		break;
+	case DOF_SECT_XLIMPORT:
+	case DOF_SECT_XLEXPORT:
+		if ((xl = dof_struct(ds, sizeof(*xl))) == NULL)
+			goto invalid;
+		print_secref("Members", dv, xl->dofxl_members);
+		printf("        Arguments: %u\n", xl->dofxl_argc);
+		break;
+	case DOF_SECT_PROBES:
+	case DOF_SECT_PRARGS:
+	case DOF_SECT_PROFFS:
+	case DOF_SECT_PRENOFFS:
+	case DOF_SECT_RELTAB:
+		/* Decoded along with the provider or relocation header. */
+		if (ds->ds_nent > 0)
+			printf("        Entries: %ju\n", (uintmax_t)ds->ds_nent);
+		break;
+	}
+	return;
+
+invalid:
+	printf("        <invalid section contents>\n");
+}
+
+/*
+ * Section lookup.  Objects built with -ffunction-sections can have hundreds
+ * of thousands of sections, and libelf allocates a descriptor for each one
+ * the first time any section is asked for.  The section header table is
+ * instead used in place: DOF sections are picked out by sh_type, which costs
+ * one load per header and no string comparisons, and only the candidates that
+ * survive have their names checked in the section name table.
+ */
+struct elfinfo {
+	bool		ei_is64;
+	uint64_t	ei_shoff;
+	uint64_t	ei_shnum;
+	uint64_t	ei_shentsize;
+	uint64_t	ei_shstrndx;
+};
+
+/*
+ * Section headers, normalised from either ELF class.  Only the fields needed
+ * to locate and identify DOF sections are kept.
+ */
+struct secthdr {
+	uint32_t	name;
+	uint32_t	type;
+	uint64_t	offset;
+	uint64_t	size;
+	uint32_t	link;
+};
+
+/*
+ * Decode the parts of an ELF header needed to find the section header table.
+ * The header is copied out, so buf need not be aligned.
+ */
+static bool
+ehdr_decode(const void *buf, size_t len, struct elfinfo *ei)
+{
+	union {
+		unsigned char	ident[EI_NIDENT];
+		Elf32_Ehdr	e32;
+		Elf64_Ehdr	e64;
+	} eh;
+
+	if (len < sizeof(Elf32_Ehdr))
+		return (false);
+	memcpy(&eh, buf, len < sizeof(eh) ? len : sizeof(eh));
+	if (memcmp(eh.ident, ELFMAG, SELFMAG) != 0 ||
+	    eh.ident[EI_DATA] != (BYTE_ORDER == LITTLE_ENDIAN ?
+	    ELFDATA2LSB : ELFDATA2MSB))
+		return (false);
+
+	if (eh.ident[EI_CLASS] == ELFCLASS64 && len >= sizeof(eh.e64)) {
+		ei->ei_is64 = true;
+		ei->ei_shoff = eh.e64.e_shoff;
+		ei->ei_shnum = eh.e64.e_shnum;
+		ei->ei_shentsize = eh.e64.e_shentsize;
+		ei->ei_shstrndx = eh.e64.e_shstrndx;
+		return (ei->ei_shoff != 0 &&
+		    ei->ei_shentsize == sizeof(Elf64_Shdr));
+	} else if (eh.ident[EI_CLASS] == ELFCLASS32) {
+		ei->ei_is64 = false;
+		ei->ei_shoff = eh.e32.e_shoff;
+		ei->ei_shnum = eh.e32.e_shnum;
+		ei->ei_shentsize = eh.e32.e_shentsize;
+		ei->ei_shstrndx = eh.e32.e_shstrndx;
+		return (ei->ei_shoff != 0 &&
+		    ei->ei_shentsize == sizeof(Elf32_Shdr));
+	}
+	return (false);
+}
+
+static void
+shdr_decode(const struct elfinfo *ei, const void *shtab, uint64_t i,
+    struct secthdr *sh)
+{
+	const Elf64_Shdr *s64;
+	const Elf32_Shdr *s32;
+
+	if (ei->ei_is64) {
+		s64 = (const Elf64_Shdr *)shtab + i;
+		sh->name = s64->sh_name;
+		sh->type = s64->sh_type;
+		sh->offset = s64->sh_offset;
+		sh->size = s64->sh_size;
+		sh->link = s64->sh_link;
+	} else {
+		s32 = (const Elf32_Shdr *)shtab + i;
+		sh->name = s32->sh_name;
+		sh->type = s32->sh_type;
+		sh->offset = s32->sh_offset;
+		sh->size = s32->sh_size;
+		sh->link = s32->sh_link;
+	}
+}
+
+/* Extended numbering keeps the real counts in section header 0. */
+static bool
+ehdr_extended(const struct elfinfo *ei)
+{
+
+	return (ei->ei_shnum == 0 || ei->ei_shstrndx == SHN_XINDEX);
+}
+
+static void
+ehdr_extend(struct elfinfo *ei, const void *shdr0)
+{
+	struct secthdr sh;
+
+	shdr_decode(ei, shdr0, 0, &sh);
+	if (ei->ei_shnum == 0)
+		ei->ei_shnum = sh.size;
+	if (ei->ei_shstrndx == SHN_XINDEX)
+		ei->ei_shstrndx = sh.link;
+}
+
+/*
+ * Return the index of the first section at or after i with the given type, or
+ * the section count if there is none.
+ */
+static uint64_t
+shdr_next_type(const struct elfinfo *ei, const void *shtab, uint32_t type,
+    uint64_t i)
+{
+	const Elf64_Shdr *s64;
+	const Elf32_Shdr *s32;
+
+	if (ei->ei_is64) {
+		s64 = shtab;
+		while (i < ei->ei_shnum && s64[i].sh_type != type)
+			i++;
+	} else {
+		s32 = shtab;
+		while (i < ei->ei_shnum && s32[i].sh_type != type)
+			i++;
+	}
+	return (i);
+}
+
+static bool
+shdr_is_dof(const struct secthdr *sh, const char *strtab, uint64_t strsize)
+{
+
+	return (sh->type == SHT_SUNW_dof && strsize >= sizeof(".SUNW_dof") &&
+	    sh->name <= strsize - sizeof(".SUNW_dof") &&
+	    memcmp(strtab + sh->name, ".SUNW_dof", sizeof(".SUNW_dof")) == 0);
+}
+
+/*
+ * An iterator over the DOF sections of an ELF object that is entirely in
+ * memory, such as a mapped file or archive member.  Nothing obliges a linker
+ * to place section data at an aligned file offset, so DOF that is misaligned
+ * in the image is copied into di_buf.
+ */
+struct dofiter {
+	struct elfinfo	di_ei;
+	const char	*di_image;
+	size_t		di_size;
+	const void	*di_shtab;
+	const char	*di_strtab;
+	uint64_t	di_strsize;
+	uint64_t	di_next;
+	void		*di_buf;
+	size_t		di_bufsize;
+};
+
+static bool
+dof_range(size_t size, uint64_t off, uint64_t len)
+{
+
+	return (off <= size && len <= size - off);
+}
+
+/*
+ * Returns false if the image is not an ELF object with DOF-typed sections.
+ * The image must be aligned for the section headers.  dofiter_fini() must be
+ * called either way.
+ */
+static bool
+dofiter_init(struct dofiter *di, const void *image, size_t size)
+{
+	struct elfinfo *ei;
+	struct secthdr strsh;
+
+	ei = &di->di_ei;
+	di->di_buf = NULL;
+	di->di_bufsize = 0;
+	if (!ehdr_decode(image, size, ei) ||
+	    !dof_range(size, ei->ei_shoff, ei->ei_shentsize))
+		return (false);
+	di->di_image = image;
+	di->di_size = size;
+	di->di_shtab = di->di_image + ei->ei_shoff;
+	if (ehdr_extended(ei))
+		ehdr_extend(ei, di->di_shtab);
+	if (ei->ei_shnum == 0 || ei->ei_shstrndx >= ei->ei_shnum ||
+	    ei->ei_shnum > (size - ei->ei_shoff) / ei->ei_shentsize)
+		return (false);
+
+	di->di_next = shdr_next_type(ei, di->di_shtab, SHT_SUNW_dof, 0);
+	if (di->di_next == ei->ei_shnum)
+		return (false);
+
+	shdr_decode(ei, di->di_shtab, ei->ei_shstrndx, &strsh);
+	if (!dof_range(size, strsh.offset, strsh.size))
+		return (false);
+	di->di_strtab = di->di_image + strsh.offset;
+	di->di_strsize = strsh.size;
+	return (true);
+}
+
+/*
+ * Find the next DOF section, returning its index and data.  Sections whose
+ * data lies outside the image are reported and skipped.
+ */
+static bool
+dofiter_next(struct dofiter *di, const char *label, uint64_t *idx,
+    const void **data, size_t *size)
+{
+	struct elfinfo *ei;
+	struct secthdr sh;
+	uint64_t i;
+
+	ei = &di->di_ei;
+	for (i = di->di_next; i < ei->ei_shnum;
+	    i = shdr_next_type(ei, di->di_shtab, SHT_SUNW_dof, i + 1)) {
+		shdr_decode(ei, di->di_shtab, i, &sh);
+		if (!shdr_is_dof(&sh, di->di_strtab, di->di_strsize))
+			continue;
+		if (!dof_range(di->di_size, sh.offset, sh.size)) {
+			warnx("%s: section %ju extends past the end of the "
+			    "object", label, (uintmax_t)i);
+			continue;
+		}
+		di->di_next = shdr_next_type(ei, di->di_shtab, SHT_SUNW_dof,
+		    i + 1);
+		*idx = i;
+		*data = di->di_image + sh.offset;
+		*size = sh.size;
+		if (((uintptr_t)*data & (sizeof(uint64_t) - 1)) != 0) {
+			if (sh.size > di->di_bufsize) {
+				free(di->di_buf);
+				if ((di->di_buf = malloc(sh.size)) == NULL)
+					err(1, "malloc");
+				di->di_bufsize = sh.size;
+			}
+			memcpy(di->di_buf, *data, sh.size);
+			*data = di->di_buf;
+		}
+		return (true);
+	}
+	di->di_next = i;
+	return (false);
+}
+
+static void
+dofiter_fini(struct dofiter *di)
+{
+
+	free(di->di_buf);
+}
+
+/*
+ * Return the image of an ELF object or archive member.  Archive members are
+ * only 2-byte aligned within the archive, so misaligned images are copied.
+ */
+static const void *
+object_image(Elf *e, size_t *size, void **copy)
+{
+	const char *image;
+
+	*copy = NULL;
+	if ((image = elf_rawfile(e, size)) == NULL)
+		return (NULL);
+	if (((uintptr_t)image & (sizeof(uint64_t) - 1)) == 0)
+		return (image);
+	if ((*copy = malloc(*size)) == NULL)
+		err(1, "malloc");
+	memcpy(*copy, image, *size);
+	return (*copy);
+}
+
+/*
+ * Tree scanning.  The walker thread feeds paths through a bounded queue to a
+ * pool of scanner threads.  Scanners don't use libelf for plain objects: they
+ * read the ELF header, the section header table and, only if some section has
+ * type SHT_SUNW_dof, the section name table and the DOF itself, each with a
+ * single pread(2) into a per-thread buffer.
+ */
+#define	SCAN_QUEUE_LEN	1024
+
+struct scanq {
+	pthread_mutex_t	sq_lock;
+	pthread_cond_t	sq_notempty;
+	pthread_cond_t	sq_notfull;
+	char		*sq_paths[SCAN_QUEUE_LEN];
+	unsigned	sq_head;
+	unsigned	sq_count;
+	bool		sq_done;
+	bool		sq_failed;	/* some file couldn't be read */
+};
+
+struct scanbuf {
+	void		*sb_buf;
+	size_t		sb_size;
+};
+
+/* Read a range of a file of the given size, which the range must lie within. */
+static void *
+scanbuf_read(struct scanbuf *sb, int fd, size_t size, uint64_t off,
+    uint64_t len)
+{
+	void *buf;
+
+	if (!dof_range(size, off, len))
+		return (NULL);
+	if (len > sb->sb_size) {
+		/* realloc() returns memory aligned for the DOF structures. */
+		if ((buf = realloc(sb->sb_buf, len)) == NULL)
+			return (NULL);
+		sb->sb_buf = buf;
+		sb->sb_size = len;
+	}
+	if (pread(fd, sb->sb_buf, len, off) != (ssize_t)len)
+		return (NULL);
+	return (sb->sb_buf);
+}
+
+/* Scan one archive member, printing its probe count if it has DOF. */
+static void
+scan_member(const char *path, Elf *e)
+{
+	struct dofiter di;
+	struct dof_view dv;
+	Elf_Arhdr *arh;
+	const void *image, *dof;
+	void *copy;
+	uint64_t idx, nprobes;
+	size_t size, dofsize;
+	int ndof;
+
+	if (elf_kind(e) != ELF_K_ELF || (arh = elf_getarhdr(e)) == NULL ||
+	    (image = object_image(e, &size, &copy)) == NULL)
+		return;
+
+	ndof = 0;
+	nprobes = 0;
+	if (dofiter_init(&di, image, size)) {
+		while (dofiter_next(&di, path, &idx, &dof, &dofsize)) {
+			ndof++;
+			if (dof_view_init(&dv, dof, dofsize) == NULL)
+				nprobes += dof_count_probes(&dv);
+		}
+	}
+	dofiter_fini(&di);
+	free(copy);
+
+	if (ndof > 0)
+		printf("%ju\t%s(%s)\n", (uintmax_t)nprobes, path, arh->ar_name);
+}
+
+/*
+ * Scan the members of an archive.  These are read through libelf, since the
+ * archive has to be walked anyway, and each member with DOF is reported
+ * separately.  Returns false if the archive couldn't be read.
+ */
+static bool
+scan_archive(const char *path, int fd)
+{
+	Elf *ar, *e;
+	Elf_Cmd cmd;
+
+	if ((ar = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL) {
+		warnx("%s: %s", path, elf_errmsg(-1));
+		return (false);
+	}
+	cmd = ELF_C_READ_MMAP;
+	while ((e = elf_begin(fd, cmd, ar)) != NULL) {
+		scan_member(path, e);
+		cmd = elf_next(e);
+		(void)elf_end(e);
+	}
+	(void)elf_end(ar);
+	return (true);
+}
+
+/*
+ * Scan one file, printing its probe count if it has any DOF sections.
+ * Returns false if the file couldn't be read; files that aren't objects, or
+ * are malformed, are passed over silently.
+ */
+static bool
+scan_file(const char *path, struct scanbuf *bufs)
+{
+	union {
+		unsigned char	ident[EI_NIDENT];
+		Elf32_Ehdr	e32;
+		Elf64_Ehdr	e64;
+	} eh;
+	struct elfinfo ei;
+	struct secthdr sh, strsh;
+	struct dof_view dv;
+	struct stat st;
+	const char *strtab;
+	const void *shtab;
+	const void *dof;
+	uint64_t i, nprobes;
+	ssize_t n;
+	int fd, ndof;
+	bool ok;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		warn("%s", path);
+		return (false);
+	}
+	ndof = 0;
+	nprobes = 0;
+	ok = true;
+	if (fstat(fd, &st) != 0 || (n = pread(fd, &eh, sizeof(eh), 0)) < 0) {
+		warn("%s", path);
+		ok = false;
+		goto out;
+	}
+	if ((size_t)n >= SARMAG && memcmp(eh.ident, ARMAG, SARMAG) == 0) {
+		ok = scan_archive(path, fd);
+		goto out;
+	}
+	if (!ehdr_decode(&eh, n, &ei))
+		goto out;
+
+	if (ehdr_extended(&ei)) {
+		if ((shtab = scanbuf_read(&bufs[0], fd, st.st_size,
+		    ei.ei_shoff, ei.ei_shentsize)) == NULL)
+			goto out;
+		ehdr_extend(&ei, shtab);
+	}
+	/*
+	 * With extended numbering the count is a 64-bit field from the file,
+	 * so bound it by the file before sizing the table from it.
+	 */
+	if (ei.ei_shnum == 0 || ei.ei_shstrndx >= ei.ei_shnum ||
+	    ei.ei_shoff > (uint64_t)st.st_size ||
+	    ei.ei_shnum > (st.st_size - ei.ei_shoff) / ei.ei_shentsize ||
+	    (shtab = scanbuf_read(&bufs[0], fd, st.st_size, ei.ei_shoff,
+	    ei.ei_shnum * ei.ei_shentsize)) == NULL)
+		goto out;
+
+	/* The section name table is only read if a candidate turns up. */
+	strtab = NULL;
+	for (i = shdr_next_type(&ei, shtab, SHT_SUNW_dof, 0); i < ei.ei_shnum;
+	    i = shdr_next_type(&ei, shtab, SHT_SUNW_dof, i + 1)) {
+		if (strtab == NULL) {
+			shdr_decode(&ei, shtab, ei.ei_shstrndx, &strsh);
+			if ((strtab = scanbuf_read(&bufs[1], fd, st.st_size,
+			    strsh.offset, strsh.size)) == NULL)
+				goto out;
+		}
+		shdr_decode(&ei, shtab, i, &sh);
+		if (!shdr_is_dof(&sh, strtab, strsh.size))
+			continue;
+
+		ndof++;
+		if ((dof = scanbuf_read(&bufs[2], fd, st.st_size, sh.offset,
+		    sh.size)) != NULL && dof_view_init(&dv, dof, sh.size) == NULL)
+			nprobes += dof_count_probes(&dv);
+	}
+
+out:
+	if (ndof > 0)
+		printf("%ju\t%s\n", (uintmax_t)nprobes, path);
+	(void)close(fd);
+	return (ok);
+}
+
+static void *
+scan_thread(void *arg)
+{
+	struct scanq *q;
+	struct scanbuf bufs[3];
+	char *path;
+
+	q = arg;
+	memset(bufs, 0, sizeof(bufs));
+	for (;;) {
+		pthread_mutex_lock(&q->sq_lock);
+		while (q->sq_count == 0 && !q->sq_done)
+			pthread_cond_wait(&q->sq_notempty, &q->sq_lock);
+		if (q->sq_count == 0) {
+			pthread_mutex_unlock(&q->sq_lock);
+			break;
+		}
+		path = q->sq_paths[q->sq_head];
+		q->sq_head = (q->sq_head + 1) % SCAN_QUEUE_LEN;
+		q->sq_count--;
+		pthread_cond_signal(&q->sq_notfull);
+		pthread_mutex_unlock(&q->sq_lock);
+
+		if (!scan_file(path, bufs)) {
+			pthread_mutex_lock(&q->sq_lock);
+			q->sq_failed = true;
+			pthread_mutex_unlock(&q->sq_lock);
+		}
+		free(path);
+	}
+	free(bufs[0].sb_buf);
+	free(bufs[1].sb_buf);
+	free(bufs[2].sb_buf);
+	return (NULL);
+}
+
+static int
+ftscmp(const FTSENT * const *a, const FTSENT * const *b)
+{
+
+	return (strcmp((*a)->fts_name, (*b)->fts_name));
+}
+
+/*
+ * Scan the trees, and return 1 if some directory or file couldn't be read,
+ * or 0.
+ */
+static int
+scan_trees(char * const *dirs, unsigned nthreads)
+{
+	struct scanq q;
+	pthread_t *threads;
+	FTS *fts;
+	FTSENT *ent;
+	unsigned i;
+	char *path;
+	int error;
+
+	memset(&q, 0, sizeof(q));
+	pthread_mutex_init(&q.sq_lock, NULL);
+	pthread_cond_init(&q.sq_notempty, NULL);
+	pthread_cond_init(&q.sq_notfull, NULL);
+
+	if ((threads = calloc(nthreads, sizeof(*threads))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nthreads; i++)
+		if ((error = pthread_create(&threads[i], NULL, scan_thread,
+		    &q)) != 0)
+			errc(1, error, "pthread_create");
+
+	if ((fts = fts_open(dirs, FTS_PHYSICAL | FTS_NOCHDIR, ftscmp)) == NULL)
+		err(1, "fts_open");
+	while ((ent = fts_read(fts)) != NULL) {
+		switch (ent->fts_info) {
+		case FTS_F:
+			/* Too small to hold an ELF header. */
+			if (ent->fts_statp->st_size < (off_t)sizeof(Elf32_Ehdr))
+				continue;
+			break;
+		case FTS_DNR:
+		case FTS_ERR:
+		case FTS_NS:
+			warnc(ent->fts_errno, "%s", ent->fts_path);
+			pthread_mutex_lock(&q.sq_lock);
+			q.sq_failed = true;
+			pthread_mutex_unlock(&q.sq_lock);
+			continue;
+		default:
+			continue;
+		}
+
+		if ((path = strdup(ent->fts_path)) == NULL)
+			err(1, "strdup");
+		pthread_mutex_lock(&q.sq_lock);
+		while (q.sq_count == SCAN_QUEUE_LEN)
+			pthread_cond_wait(&q.sq_notfull, &q.sq_lock);
+		q.sq_paths[(q.sq_head + q.sq_count) % SCAN_QUEUE_LEN] = path;
+		q.sq_count++;
+		pthread_cond_signal(&q.sq_notempty);
+		pthread_mutex_unlock(&q.sq_lock);
+	}
+	(void)fts_close(fts);
+
+	pthread_mutex_lock(&q.sq_lock);
+	q.sq_done = true;
+	pthread_cond_broadcast(&q.sq_notempty);
+	pthread_mutex_unlock(&q.sq_lock);
+	for (i = 0; i < nthreads; i++)
+		(void)pthread_join(threads[i], NULL);
+	free(threads);
+
+	return (q.sq_failed ? 1 : 0);
+}
+
+/* Dump one DOF object: its header, then each of its sections. */
+static bool
+dump_dof(const char *label, const void *buf, size_t size)
+{
+	const struct dof_hdr *hdr;
+	const char *errstr;
+	struct dof_view dv;
+	struct dof_secview ds;
+	uint32_t i;
 
-	hdr = (struct dof_hdr *)data->d_buf;
-	if (data->d_size < sizeof(*hdr))
-		errx(1, "data buffer is smaller than DOF header");
-	else if (memcmp(hdr->dofh_ident, "\177DOF", 4) != 0)
-		errx(1, "DOF header is invalid or corrupt");
+	if ((errstr = dof_view_init(&dv, buf, size)) != NULL) {
+		warnx("%s: %s", label, errstr);
+		return (false);
+	}
+	hdr = dv.dv_hdr;
 
 	/* Dump the DOF header. */
 	printf("DOF Header:\n");
@@ -142,20 +1119,871 @@ main(int argc, char **argv)
 	printf("    DIF instruction set version: %u\n", hdr->dofh_ident[7]);
 	printf("    DIF integer register count: %u\n", hdr->dofh_ident[8]);
 	printf("    DIF tuple register count: %u\n", hdr->dofh_ident[9]);
+	printf("    DOF flags: 0x%x\n", hdr->dofh_flags);
+	printf("    Section count: %u\n", hdr->dofh_secnum);
+	printf("    Loadable size: %ju\n", (uintmax_t)hdr->dofh_loadsz);
+	printf("    File size: %ju\n", (uintmax_t)hdr->dofh_filesz);
 	printf("\n");
 
 	/* Iterate over the section headers. */
 	for (i = 0; i < hdr->dofh_secnum; i++) {
-		dsec = (struct dof_sec *)((uint8_t *)data->d_buf +
-		    hdr->dofh_hdrsize + i * hdr->dofh_secsize);
+		printf("DOF Section %u:\n", i);
+		if (dof_section(&dv, i, DOF_SECT_NONE, &ds) != 0) {
+			printf("    <invalid section header>\n");
+			continue;
+		}
+		printf("    Section type: %s (%u)\n",
+		    secstr(ds.ds_sec->dofs_type), ds.ds_sec->dofs_type);
+		printf("    Section flags: 0x%x\n", ds.ds_sec->dofs_flags);
+		printf("    Section offset: %ju\n",
+		    (uintmax_t)ds.ds_sec->dofs_offset);
+		printf("    Section data size: %ju\n", (uintmax_t)ds.ds_size);
+		dump_section_data(&dv, &ds);
+	}
+
+	return (true);
+}
+
+/* State shared by the per-object callbacks of walk_objects(). */
+struct objwalk {
+	int		ow_ndof;	/* DOF sections found so far */
+	bool		ow_ok;		/* all of them were valid */
+	struct probeset	*ow_ps;		/* for diffs, the set being built */
+};
+
+typedef void objfn_t(Elf *, const char *, bool, struct objwalk *);
+
+/*
+ * Call fn for each ELF object in a file: the file itself, or each member of an
+ * archive, labelled "archive(member)".  Returns false for any other file.
+ */
+static bool
+walk_objects(Elf *e, int fd, const char *path, objfn_t *fn,
+    struct objwalk *ow)
+{
+	Elf *member;
+	Elf_Arhdr *arh;
+	Elf_Cmd cmd;
+	char *label;
+
+	switch (elf_kind(e)) {
+	case ELF_K_ELF:
+		fn(e, path, false, ow);
+		return (true);
+	case ELF_K_AR:
+		cmd = ELF_C_READ_MMAP;
+		while ((member = elf_begin(fd, cmd, e)) != NULL) {
+			if (elf_kind(member) == ELF_K_ELF &&
+			    (arh = elf_getarhdr(member)) != NULL) {
+				if (asprintf(&label, "%s(%s)", path,
+				    arh->ar_name) < 0)
+					err(1, "asprintf");
+				fn(member, label, true, ow);
+				free(label);
+			}
+			cmd = elf_next(member);
+			(void)elf_end(member);
+		}
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+/*
+ * Dump every DOF section of an ELF object.  The containing section is named
+ * when it might be ambiguous, i.e., for archive members and objects with more
+ * than one DOF section.
+ */
+static void
+dump_object(Elf *e, const char *label, bool member, struct objwalk *ow)
+{
+	struct dofiter di;
+	const void *image, *dof;
+	void *copy;
+	uint64_t idx;
+	size_t size, dofsize;
+	bool named;
+
+	if ((image = object_image(e, &size, &copy)) == NULL)
+		errx(1, "%s: %s", label, elf_errmsg(-1));
+	if (dofiter_init(&di, image, size)) {
+		named = member;
+		while (dofiter_next(&di, label, &idx, &dof, &dofsize)) {
+			if (di.di_next < di.di_ei.ei_shnum)
+				named = true;
+			if (ow->ow_ndof > 0)
+				printf("\n");
+			if (named)
+				printf("%s section %ju:\n\n", label,
+				    (uintmax_t)idx);
+			if (!dump_dof(label, dof, dofsize))
+				ow->ow_ok = false;
+			ow->ow_ndof++;
+		}
+	}
+	dofiter_fini(&di);
+	free(copy);
+}
+
+/*
+ * Probe-set diffs.  The providers and probes of each file are flattened into
+ * arrays, sorted into a canonical order and compared in one merge-join pass.
+ * Strings and offset lists are copied out of the DOF into a pool as they are
+ * collected, since the DOF may sit in a buffer that the next section reuses.
+ */
+#define	POOL_CHUNK	65536
+
+struct poolchunk {
+	struct poolchunk *pc_next;
+	uint64_t	pc_data[];
+};
+
+struct pool {
+	struct poolchunk *p_chunks;
+	char		*p_cur;
+	size_t		p_left;
+};
+
+struct diffprov {
+	const char	*dpv_name;
+	dof_attr_t	dpv_attr[5];
+};
+
+struct diffprobe {
+	const char	*dpr_prov;
+	const char	*dpr_func;
+	const char	*dpr_name;
+	const char	*dpr_nargs;	/* e.g., "(int, char *)" */
+	const char	*dpr_xargs;
+	const uint8_t	*dpr_map;	/* native argument of each xarg */
+	const uint32_t	*dpr_offs;	/* sorted, relative to the function */
+	const uint32_t	*dpr_enoffs;
+	uint32_t	dpr_nmap;
+	uint32_t	dpr_noffs;
+	uint32_t	dpr_nenoffs;
+};
+
+struct probeset {
+	struct diffprov	*ps_provs;
+	size_t		ps_nprovs;
+	size_t		ps_provcap;
+	struct diffprobe *ps_probes;
+	size_t		ps_nprobes;
+	size_t		ps_probecap;
+	struct pool	ps_pool;
+};
+
+static const char *attrnames[] = {
+	"Provider", "Module", "Function", "Name", "Argument",
+};
+
+static void *
+pool_alloc(struct pool *p, size_t size)
+{
+	struct poolchunk *pc;
+	size_t csize;
+	void *ret;
+
+	size = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+	if (size > p->p_left) {
+		csize = size > POOL_CHUNK ? size : POOL_CHUNK;
+		if ((pc = malloc(sizeof(*pc) + csize)) == NULL)
+			err(2, "malloc");
+		pc->pc_next = p->p_chunks;
+		p->p_chunks = pc;
+		p->p_cur = (char *)pc->pc_data;
+		p->p_left = csize;
+	}
+	ret = p->p_cur;
+	p->p_cur += size;
+	p->p_left -= size;
+	return (ret);
+}
+
+static const void *
+pool_copy(struct pool *p, const void *buf, size_t size)
+{
+
+	return (size == 0 ? NULL : memcpy(pool_alloc(p, size), buf, size));
+}
+
+static void
+pool_free(struct pool *p)
+{
+	struct poolchunk *pc;
+
+	while ((pc = p->p_chunks) != NULL) {
+		p->p_chunks = pc->pc_next;
+		free(pc);
+	}
+}
+
+/* Make room for one more element in a growable array. */
+static void *
+grow(void *arr, size_t n, size_t *cap, size_t elsize)
+{
+
+	if (n < *cap)
+		return (arr);
+	*cap = *cap == 0 ? 64 : *cap * 2;
+	if ((arr = realloc(arr, *cap * elsize)) == NULL)
+		err(2, "realloc");
+	return (arr);
+}
+
+/*
+ * Copy a list of n consecutive strings into a "(a, b)" signature.  Returns
+ * NULL if any of them is invalid.
+ */
+static const char *
+pset_strlist(struct probeset *ps, const struct dof_secview *strtab,
+    uint64_t off, unsigned n)
+{
+	const char *s;
+	char *sig, *p;
+	uint64_t o;
+	size_t len;
+	unsigned i;
+
+	len = sizeof("()");
+	for (i = 0, o = off; i < n; i++) {
+		if ((s = dof_string(strtab, o)) == NULL)
+			return (NULL);
+		len += strlen(s) + (i > 0 ? 2 : 0);
+		o += strlen(s) + 1;
+	}
+
+	p = sig = pool_alloc(&ps->ps_pool, len);
+	*p++ = '(';
+	for (i = 0; i < n; i++) {
+		s = dof_string(strtab, off);
+		if (i > 0) {
+			*p++ = ',';
+			*p++ = ' ';
+		}
+		len = strlen(s);
+		memcpy(p, s, len);
+		p += len;
+		off += len + 1;
+	}
+	*p++ = ')';
+	*p = '\0';
+	return (sig);
+}
+
+static int
+u32cmp(const void *a, const void *b)
+{
+	uint32_t x, y;
+
+	x = *(const uint32_t *)a;
+	y = *(const uint32_t *)b;
+	return (x < y ? -1 : x > y);
+}
+
+/* Copy a list of probe offsets, sorting it so that order doesn't matter. */
+static bool
+pset_offsets(struct probeset *ps, const struct dof_secview *ds, uint32_t idx,
+    uint32_t n, const uint32_t **offsp)
+{
+	const uint32_t *offs;
+	uint32_t *copy;
+
+	*offsp = NULL;
+	if (n == 0)
+		return (true);
+	if (ds == NULL || (offs = dof_array(ds, idx, n, sizeof(*offs))) == NULL)
+		return (false);
+	copy = pool_alloc(&ps->ps_pool, n * sizeof(*copy));
+	memcpy(copy, offs, n * sizeof(*copy));
+	qsort(copy, n, sizeof(*copy), u32cmp);
+	*offsp = copy;
+	return (true);
+}
+
+/* Add a provider and its probes to a probe set. */
+static bool
+pset_add_provider(struct probeset *ps, const struct dof_view *dv,
+    const struct dof_provider *pv, bool hasenoffs)
+{
+	struct dof_secview strtab, probes, prargs, proffs, prenoffs;
+	struct diffprov *dpv;
+	struct diffprobe *dpr;
+	const struct dof_probe *pr;
+	const char *name, *s;
+	const uint8_t *map;
+	bool haveargs, haveoffs, haveenoffs, enoffs;
+	uint64_t i;
+
+	if (dof_section(dv, pv->dofpv_strtab, DOF_SECT_STRTAB, &strtab) != 0 ||
+	    (s = dof_string(&strtab, pv->dofpv_name)) == NULL ||
+	    dof_section(dv, pv->dofpv_probes, DOF_SECT_PROBES, &probes) != 0)
+		return (false);
+	name = pool_copy(&ps->ps_pool, s, strlen(s) + 1);
+
+	ps->ps_provs = grow(ps->ps_provs, ps->ps_nprovs, &ps->ps_provcap,
+	    sizeof(*ps->ps_provs));
+	dpv = &ps->ps_provs[ps->ps_nprovs++];
+	dpv->dpv_name = name;
+	dpv->dpv_attr[0] = pv->dofpv_provattr;
+	dpv->dpv_attr[1] = pv->dofpv_modattr;
+	dpv->dpv_attr[2] = pv->dofpv_funcattr;
+	dpv->dpv_attr[3] = pv->dofpv_nameattr;
+	dpv->dpv_attr[4] = pv->dofpv_argsattr;
+
+	haveargs = dof_section(dv, pv->dofpv_prargs, DOF_SECT_PRARGS,
+	    &prargs) == 0;
+	haveoffs = dof_section(dv, pv->dofpv_proffs, DOF_SECT_PROFFS,
+	    &proffs) == 0;
+	haveenoffs = hasenoffs && pv->dofpv_prenoffs != DOF_SECIDX_NONE &&
+	    dof_section(dv, pv->dofpv_prenoffs, DOF_SECT_PRENOFFS,
+	    &prenoffs) == 0;
+	enoffs = probes.ds_sec->dofs_entsize >= sizeof(struct dof_probe);
+
+	for (i = 0; i < probes.ds_nent; i++) {
+		if ((pr = dof_entry(&probes, i,
+		    offsetof(struct dof_probe, dofpr_enoffidx))) == NULL)
+			return (false);
+		ps->ps_probes = grow(ps->ps_probes, ps->ps_nprobes,
+		    &ps->ps_probecap, sizeof(*ps->ps_probes));
+		dpr = &ps->ps_probes[ps->ps_nprobes];
+		dpr->dpr_prov = name;
+		if ((s = dof_string(&strtab, pr->dofpr_func)) == NULL)
+			return (false);
+		dpr->dpr_func = pool_copy(&ps->ps_pool, s, strlen(s) + 1);
+		if ((s = dof_string(&strtab, pr->dofpr_name)) == NULL)
+			return (false);
+		dpr->dpr_name = pool_copy(&ps->ps_pool, s, strlen(s) + 1);
+		if ((dpr->dpr_nargs = pset_strlist(ps, &strtab,
+		    pr->dofpr_nargv, pr->dofpr_nargc)) == NULL ||
+		    (dpr->dpr_xargs = pset_strlist(ps, &strtab,
+		    pr->dofpr_xargv, pr->dofpr_xargc)) == NULL)
+			return (false);
+
+		dpr->dpr_nmap = pr->dofpr_xargc;
+		dpr->dpr_map = NULL;
+		if (pr->dofpr_xargc > 0) {
+			if (!haveargs || (map = dof_array(&prargs,
+			    pr->dofpr_argidx, pr->dofpr_xargc,
+			    sizeof(*map))) == NULL)
+				return (false);
+			dpr->dpr_map = pool_copy(&ps->ps_pool, map,
+			    pr->dofpr_xargc);
+		}
+
+		dpr->dpr_noffs = pr->dofpr_noffs;
+		dpr->dpr_nenoffs = enoffs ? pr->dofpr_nenoffs : 0;
+		if (!pset_offsets(ps, haveoffs ? &proffs : NULL,
+		    pr->dofpr_offidx, dpr->dpr_noffs, &dpr->dpr_offs) ||
+		    !pset_offsets(ps, haveenoffs ? &prenoffs : NULL,
+		    enoffs ? pr->dofpr_enoffidx : 0, dpr->dpr_nenoffs,
+		    &dpr->dpr_enoffs))
+			return (false);
+		ps->ps_nprobes++;
+	}
+	return (true);
+}
+
+/* Collect the providers of one DOF object. */
+static bool
+pset_add_dof(struct probeset *ps, const char *label, uint64_t idx,
+    const void *dof, size_t size)
+{
+	struct dof_view dv;
+	struct dof_secview ds;
+	const struct dof_provider *pv;
+	const char *errstr;
+	uint32_t i;
+	bool ok;
+
+	if ((errstr = dof_view_init(&dv, dof, size)) != NULL) {
+		warnx("%s: %s", label, errstr);
+		return (false);
+	}
+	ok = true;
+	for (i = 0; i < dv.dv_hdr->dofh_secnum; i++) {
+		if (dof_section(&dv, i, DOF_SECT_PROVIDER, &ds) != 0)
+			continue;
+		if ((pv = dof_struct(&ds,
+		    offsetof(struct dof_provider, dofpv_prenoffs))) == NULL ||
+		    !pset_add_provider(ps, &dv, pv,
+		    ds.ds_size >= sizeof(*pv))) {
+			warnx("%s: section %ju: invalid provider in DOF "
+			    "section %u", label, (uintmax_t)idx, i);
+			ok = false;
+		}
+	}
+	return (ok);
+}
+
+/* Collect the providers of every DOF section in an ELF object. */
+static void
+pset_object(Elf *e, const char *label, bool member, struct objwalk *ow)
+{
+	struct dofiter di;
+	const void *image, *dof;
+	void *copy;
+	uint64_t idx;
+	size_t size, dofsize;
+
+	if ((image = object_image(e, &size, &copy)) == NULL) {
+		warnx("%s: %s", label, elf_errmsg(-1));
+		ow->ow_ok = false;
+		return;
+	}
+	if (dofiter_init(&di, image, size)) {
+		while (dofiter_next(&di, label, &idx, &dof, &dofsize)) {
+			ow->ow_ndof++;
+			if (!pset_add_dof(ow->ow_ps, label, idx, dof, dofsize))
+				ow->ow_ok = false;
+		}
+	}
+	dofiter_fini(&di);
+	free(copy);
+}
+
+static int
+provcmp(const void *a, const void *b)
+{
+	const struct diffprov *x, *y;
+	int c;
+
+	x = a;
+	y = b;
+	if ((c = strcmp(x->dpv_name, y->dpv_name)) != 0)
+		return (c);
+	return (memcmp(x->dpv_attr, y->dpv_attr, sizeof(x->dpv_attr)));
+}
+
+static int
+listcmp(const void *a, uint32_t na, const void *b, uint32_t nb,
+    size_t elsize)
+{
+	int c;
+
+	if (na == 0 || nb == 0)
+		return (na < nb ? -1 : na > nb);
+	if ((c = memcmp(a, b, (na < nb ? na : nb) * elsize)) != 0)
+		return (c);
+	return (na < nb ? -1 : na > nb);
+}
+
+static int
+probekeycmp(const struct diffprobe *x, const struct diffprobe *y)
+{
+	int c;
+
+	if ((c = strcmp(x->dpr_prov, y->dpr_prov)) != 0 ||
+	    (c = strcmp(x->dpr_func, y->dpr_func)) != 0)
+		return (c);
+	return (strcmp(x->dpr_name, y->dpr_name));
+}
+
+/*
+ * Order probes by name and then by everything else, so that probes sharing
+ * a name (e.g., in static functions of different objects) pair up
+ * deterministically.
+ */
+static int
+probecmp(const void *a, const void *b)
+{
+	const struct diffprobe *x, *y;
+	int c;
+
+	x = a;
+	y = b;
+	if ((c = probekeycmp(x, y)) != 0 ||
+	    (c = strcmp(x->dpr_nargs, y->dpr_nargs)) != 0 ||
+	    (c = strcmp(x->dpr_xargs, y->dpr_xargs)) != 0 ||
+	    (c = listcmp(x->dpr_map, x->dpr_nmap, y->dpr_map, y->dpr_nmap,
+	    sizeof(*x->dpr_map))) != 0 ||
+	    (c = listcmp(x->dpr_offs, x->dpr_noffs, y->dpr_offs,
+	    y->dpr_noffs, sizeof(uint32_t))) != 0)
+		return (c);
+	return (listcmp(x->dpr_enoffs, x->dpr_nenoffs, y->dpr_enoffs,
+	    y->dpr_nenoffs, sizeof(uint32_t)));
+}
+
+/*
+ * Put a probe set into canonical order.  A provider is declared once per
+ * object that has probes for it, so identical declarations are merged;
+ * declarations that differ are kept, next to each other.
+ */
+static void
+pset_sort(struct probeset *ps)
+{
+	size_t i, n;
+
+	qsort(ps->ps_provs, ps->ps_nprovs, sizeof(*ps->ps_provs), provcmp);
+	for (i = n = 0; i < ps->ps_nprovs; i++)
+		if (n == 0 || provcmp(&ps->ps_provs[n - 1],
+		    &ps->ps_provs[i]) != 0)
+			ps->ps_provs[n++] = ps->ps_provs[i];
+	ps->ps_nprovs = n;
+	qsort(ps->ps_probes, ps->ps_nprobes, sizeof(*ps->ps_probes), probecmp);
+}
+
+static bool
+pset_load(struct probeset *ps, const char *path)
+{
+	struct objwalk ow;
+	Elf *e;
+	int fd;
+
+	memset(ps, 0, sizeof(*ps));
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		warn("opening %s", path);
+		return (false);
+	}
+	if ((e = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL) {
+		warnx("%s: elf_begin() failed: %s", path, elf_errmsg(-1));
+		(void)close(fd);
+		return (false);
+	}
+
+	memset(&ow, 0, sizeof(ow));
+	ow.ow_ok = true;
+	ow.ow_ps = ps;
+	if (!walk_objects(e, fd, path, pset_object, &ow)) {
+		warnx("%s is not an ELF object or archive", path);
+		ow.ow_ok = false;
+	} else if (ow.ow_ndof == 0) {
+		warnx("no DOF section found in %s", path);
+		ow.ow_ok = false;
+	}
+	(void)elf_end(e);
+	(void)close(fd);
+
+	if (ow.ow_ok)
+		pset_sort(ps);
+	return (ow.ow_ok);
+}
+
+static void
+pset_free(struct probeset *ps)
+{
+
+	free(ps->ps_provs);
+	free(ps->ps_probes);
+	pool_free(&ps->ps_pool);
+}
+
+static void
+print_attrval(dof_attr_t attr)
+{
+
+	printf("%s/%s/%s", stabstr(DOF_ATTR_NAME(attr)),
+	    stabstr(DOF_ATTR_DATA(attr)), classstr(DOF_ATTR_CLASS(attr)));
+}
+
+/* Print a list of argument indices (elsize 1) or offsets (elsize 4). */
+static void
+print_list(const void *list, uint32_t n, size_t elsize)
+{
+	uint32_t i;
+
+	if (n == 0)
+		printf(" none");
+	for (i = 0; i < n; i++) {
+		if (elsize == 1)
+			printf(" %u", ((const uint8_t *)list)[i]);
+		else
+			printf(" 0x%x", ((const uint32_t *)list)[i]);
+	}
+}
+
+static void
+print_probe(char mark, const struct diffprobe *dpr)
+{
+
+	printf("%c probe %s:%s:%s %s", mark, dpr->dpr_prov, dpr->dpr_func,
+	    dpr->dpr_name, dpr->dpr_nargs);
+	if (dpr->dpr_nmap > 0)
+		printf(" -> %s", dpr->dpr_xargs);
+	printf("\n");
+}
+
+/* Print a changed list-valued probe field: "! probe p:f:n: what a -> b". */
+static void
+print_change(const struct diffprobe *dpr, const char *what, const void *a,
+    uint32_t na, const void *b, uint32_t nb, size_t elsize)
+{
+
+	printf("! probe %s:%s:%s: %s", dpr->dpr_prov, dpr->dpr_func,
+	    dpr->dpr_name, what);
+	print_list(a, na, elsize);
+	printf(" ->");
+	print_list(b, nb, elsize);
+	printf("\n");
+}
+
+/* Does a run of declarations give attribute i the value attr? */
+static bool
+provs_have_attr(const struct diffprov *p, size_t n, unsigned i,
+    dof_attr_t attr)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++)
+		if (p[k].dpv_attr[i] == attr)
+			return (true);
+	return (false);
+}
+
+/* Print the distinct values of attribute i in a run of declarations. */
+static void
+print_prov_attrs(const struct diffprov *p, size_t n, unsigned i)
+{
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		if (provs_have_attr(p, k, i, p[k].dpv_attr[i]))
+			continue;
+		if (k > 0)
+			printf(", ");
+		print_attrval(p[k].dpv_attr[i]);
+	}
+}
 
-		printf("DOF Section:\n");
-		printf("    Section type: %u\n", dsec->dofs_type);
-		printf("    Section data size: %lu\n", dsec->dofs_size);
+/*
+ * Compare the declarations of a provider in the two files.  A provider is
+ * usually declared the same way everywhere, but objects built from different
+ * definitions may disagree, so each side is a sorted run of distinct
+ * declarations, and each attribute is compared as the set of values that the
+ * run gives it.
+ */
+static bool
+diff_provider(const struct diffprov *a, size_t na, const struct diffprov *b,
+    size_t nb)
+{
+	size_t k;
+	unsigned i;
+	bool differ, same;
+
+	differ = false;
+	for (i = 0; i < nitems(a->dpv_attr); i++) {
+		same = true;
+		for (k = 0; k < na && same; k++)
+			same = provs_have_attr(b, nb, i, a[k].dpv_attr[i]);
+		for (k = 0; k < nb && same; k++)
+			same = provs_have_attr(a, na, i, b[k].dpv_attr[i]);
+		if (same)
+			continue;
+		printf("! provider %s: %s attributes ", a->dpv_name,
+		    attrnames[i]);
+		print_prov_attrs(a, na, i);
+		printf(" -> ");
+		print_prov_attrs(b, nb, i);
+		printf("\n");
+		differ = true;
+	}
+
+	/* The same values, but paired up differently. */
+	if (!differ) {
+		for (k = 0; k < na && k < nb; k++)
+			if (provcmp(&a[k], &b[k]) != 0)
+				break;
+		if (k < na || k < nb) {
+			printf("! provider %s: attributes combined "
+			    "differently\n", a->dpv_name);
+			differ = true;
+		}
+	}
+	return (differ);
+}
+
+/* The length of the run of declarations of the provider at p[0]. */
+static size_t
+prov_run(const struct diffprov *p, size_t n)
+{
+	size_t k;
+
+	for (k = 1; k < n && strcmp(p[k].dpv_name, p->dpv_name) == 0; k++)
+		;
+	return (k);
+}
+
+/* Compare two probes with the same name. */
+static bool
+diff_probe(const struct diffprobe *a, const struct diffprobe *b)
+{
+	bool differ;
+
+	differ = false;
+	if (strcmp(a->dpr_nargs, b->dpr_nargs) != 0) {
+		printf("! probe %s:%s:%s: native arguments %s -> %s\n",
+		    a->dpr_prov, a->dpr_func, a->dpr_name, a->dpr_nargs,
+		    b->dpr_nargs);
+		differ = true;
 	}
+	if (strcmp(a->dpr_xargs, b->dpr_xargs) != 0) {
+		printf("! probe %s:%s:%s: translated arguments %s -> %s\n",
+		    a->dpr_prov, a->dpr_func, a->dpr_name, a->dpr_xargs,
+		    b->dpr_xargs);
+		differ = true;
+	}
+	if (listcmp(a->dpr_map, a->dpr_nmap, b->dpr_map, b->dpr_nmap, 1) != 0) {
+		print_change(a, "argument mapping", a->dpr_map, a->dpr_nmap,
+		    b->dpr_map, b->dpr_nmap, 1);
+		differ = true;
+	}
+	if (listcmp(a->dpr_offs, a->dpr_noffs, b->dpr_offs, b->dpr_noffs,
+	    sizeof(uint32_t)) != 0) {
+		print_change(a, "offsets", a->dpr_offs, a->dpr_noffs,
+		    b->dpr_offs, b->dpr_noffs, sizeof(uint32_t));
+		differ = true;
+	}
+	if (listcmp(a->dpr_enoffs, a->dpr_nenoffs, b->dpr_enoffs,
+	    b->dpr_nenoffs, sizeof(uint32_t)) != 0) {
+		print_change(a, "is-enabled offsets", a->dpr_enoffs,
+		    a->dpr_nenoffs, b->dpr_enoffs, b->dpr_nenoffs,
+		    sizeof(uint32_t));
+		differ = true;
+	}
+	return (differ);
+}
+
+/*
+ * Print the differences between the probes of two files, one line each:
+ * "-" for providers and probes only in the old file, "+" for those only in
+ * the new one and "!" for changes.  Both sets are sorted, so a single pass
+ * over the two arrays finds everything.
+ */
+static int
+diff_files(const char *oldpath, const char *newpath)
+{
+	struct probeset a, b;
+	size_t i, j, na, nb;
+	bool differ;
+	int c;
+
+	if (!pset_load(&a, oldpath) || !pset_load(&b, newpath))
+		return (2);
+
+	differ = false;
+	for (i = j = 0; i < a.ps_nprovs || j < b.ps_nprovs;) {
+		c = i == a.ps_nprovs ? 1 : j == b.ps_nprovs ? -1 :
+		    strcmp(a.ps_provs[i].dpv_name, b.ps_provs[j].dpv_name);
+		if (c < 0) {
+			printf("- provider %s\n", a.ps_provs[i].dpv_name);
+			i += prov_run(&a.ps_provs[i], a.ps_nprovs - i);
+			differ = true;
+		} else if (c > 0) {
+			printf("+ provider %s\n", b.ps_provs[j].dpv_name);
+			j += prov_run(&b.ps_provs[j], b.ps_nprovs - j);
+			differ = true;
+		} else {
+			na = prov_run(&a.ps_provs[i], a.ps_nprovs - i);
+			nb = prov_run(&b.ps_provs[j], b.ps_nprovs - j);
+			if (diff_provider(&a.ps_provs[i], na, &b.ps_provs[j],
+			    nb))
+				differ = true;
+			i += na;
+			j += nb;
+		}
+	}
+	for (i = j = 0; i < a.ps_nprobes || j < b.ps_nprobes;) {
+		c = i == a.ps_nprobes ? 1 : j == b.ps_nprobes ? -1 :
+		    probekeycmp(&a.ps_probes[i], &b.ps_probes[j]);
+		if (c < 0) {
+			print_probe('-', &a.ps_probes[i++]);
+			differ = true;
+		} else if (c > 0) {
+			print_probe('+', &b.ps_probes[j++]);
+			differ = true;
+		} else if (diff_probe(&a.ps_probes[i++], &b.ps_probes[j++]))
+			differ = true;
+	}
+
+	pset_free(&a);
+	pset_free(&b);
+	return (differ ? 1 : 0);
+}
+
+static const struct option longopts[] = {
+	{ "diff",	no_argument,	NULL,	'd' },
+	{ NULL,		0,		NULL,	0 }
+};
+
+int
+main(int argc, char **argv)
+{
+	struct objwalk ow;
+	Elf *e;
+	int fd;
+	unsigned long njobs;
+	char *endptr;
+	const char *path;
+	bool diff, tree;
+	int ch;
+
+	njobs = sysconf(_SC_NPROCESSORS_ONLN);
+	diff = tree = false;
+	while ((ch = getopt_long(argc, argv, "dj:r", longopts, NULL)) != -1) {
+		switch (ch) {
+		case 'd':
+			diff = true;
+			break;
+		case 'j':
+			errno = 0;
+			njobs = strtoul(optarg, &endptr, 10);
+			if (optarg[0] == '\0' || *endptr != '\0' ||
+			    errno != 0 || njobs == 0 || njobs > 1024)
+				usage();
+			break;
+		case 'r':
+			tree = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (elf_version(EV_CURRENT) == EV_NONE)
+		errx(1, "ELF library initialization failed: %s",
+		    elf_errmsg(-1));
+
+	/*
+	 * Scanning reports each ELF object with a DOF section, along with its
+	 * probe count, and is quiet about files without one.
+	 */
+	if (tree) {
+		if (argc < 1 || diff)
+			usage();
+		return (scan_trees(argv, njobs));
+	}
+
+	/* As with diff(1), exit with 1 if there are differences, 2 on error. */
+	if (diff) {
+		if (argc != 2)
+			usage();
+		return (diff_files(argv[0], argv[1]));
+	}
+
+	if (argc != 1)
+		usage();
+	path = argv[0];
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		err(1, "opening %s", path);
+
+	/* Map the file so that section data can be examined in place. */
+	if ((e = elf_begin(fd, ELF_C_READ_MMAP, NULL)) == NULL)
+		errx(1, "elf_begin() failed: %s", elf_errmsg(-1));
+
+	memset(&ow, 0, sizeof(ow));
+	ow.ow_ok = true;
+	if (!walk_objects(e, fd, path, dump_object, &ow))
+		errx(1, "%s is not an ELF object or archive", path);
+
+	if (ow.ow_ndof == 0)
+		errx(1, "no DOF section found in %s", path);
 
 	(void)elf_end(e);
 	(void)close(fd);
 
-	return (0);
+	return (ow.ow_ok ? 0 : 1);
 }
@@ -0,0 +1,184 @@
+#!/bin/sh
+#
+# Measure the throughput of id3v2tagdump and id3v2tagstrip over a synthetic
+# corpus, with a warm and (where possible) a cold page cache.  For each case
+# the harness reports files per second, system calls per file and kilobytes
+# read from disk per file, one tab-separated line per case:
+#
+#	case	cache	files/s	syscalls/file	KB-in/file
+#
+# With -c, the results are compared against an earlier run's output, and the
+# exit status is non-zero if any case got slower, or made more system calls
+# per file, by more than the tolerance.
+#
+# A cold cache is obtained through /proc/sys/vm/drop_caches on Linux.  On
+# FreeBSD the file system holding the corpus has to be remounted, so set
+# BENCH_MOUNT to its mount point (it must be listed in fstab); without it only
+# warm-cache results are produced.  Both require root.
+#
+
+set -e
+
+: ${ID3V2TAGDUMP:=id3v2tagdump}
+: ${ID3V2TAGSTRIP:=id3v2tagstrip}
+: ${MKCORPUS:=mkcorpus}
+
+usage()
+{
+	echo "Usage: $(basename $0) [-a audio_kb] [-c baseline] [-d dir] [-j jobs] [-n files]" >&2
+	echo "       [-o results] [-t tolerance]" >&2
+	exit 1
+}
+
+audiokb=256
+baseline=
+dir=${TMPDIR:-/tmp}/id3v2bench
+jobs=$(sysctl -n hw.ncpu 2>/dev/null || nproc)
+nfiles=2000
+results=
+tolerance=10
+
+while getopts a:c:d:j:n:o:t: ch; do
+	case $ch in
+	a)	audiokb=$OPTARG ;;
+	c)	baseline=$OPTARG ;;
+	d)	dir=$OPTARG ;;
+	j)	jobs=$OPTARG ;;
+	n)	nfiles=$OPTARG ;;
+	o)	results=$OPTARG ;;
+	t)	tolerance=$OPTARG ;;
+	*)	usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -eq 0 ] || usage
+
+corpus=$dir/corpus-$nfiles-$audiokb
+scratch=$dir/scratch
+out=$(mktemp ${TMPDIR:-/tmp}/id3v2bench.XXXXXX)
+trap 'rm -f $out $out.*; rm -rf $scratch' EXIT
+
+if [ ! -d $corpus ]; then
+	echo "generating $nfiles files in $corpus" >&2
+	$MKCORPUS -a $audiokb -n $nfiles $corpus.tmp
+	mv $corpus.tmp $corpus
+fi
+
+drop_caches()
+{
+	sync
+	case $(uname -s) in
+	Linux)
+		echo 3 > /proc/sys/vm/drop_caches 2>/dev/null
+		;;
+	FreeBSD)
+		[ -n "$BENCH_MOUNT" ] && umount $BENCH_MOUNT && mount $BENCH_MOUNT
+		;;
+	*)
+		false
+		;;
+	esac
+}
+
+# Print the wall-clock time and the number of 512-byte blocks read from disk.
+# The tools' own diagnostics (e.g., files that can't be stripped in place) are
+# expected and are discarded.
+timed()
+{
+	case $(uname -s) in
+	Linux)
+		/usr/bin/time -f '%e %I' -o $out.time "$@" > /dev/null 2>&1
+		cat $out.time
+		;;
+	*)
+		/usr/bin/time -l -o $out.time "$@" > /dev/null 2>&1
+		awk '$1 == "real" { t = $2 } / block input operations/ { b = $1 }
+		    END { print t, b * 1 }' $out.time
+		;;
+	esac
+}
+
+# Print the number of system calls made by all threads of a command.
+syscalls()
+{
+	case $(uname -s) in
+	Linux)
+		strace -c -f -o $out.trace "$@" > /dev/null
+		awk '$NF == "total" { print $4 }' $out.trace
+		;;
+	*)
+		truss -c -f -o $out.trace "$@" > /dev/null
+		awk 'NF > 0 { last = $2 } END { print last }' $out.trace
+		;;
+	esac
+}
+
+# Strip runs modify the files, so each one gets a fresh copy of the corpus.
+prepare()
+{
+	case $1 in
+	strip*)
+		rm -rf $scratch
+		cp -R $corpus $scratch
+		;;
+	esac
+}
+
+# run <case> <cache> <command...>
+run()
+{
+	local name=$1 cache=$2 tb calls
+	shift 2
+
+	prepare $name
+	if [ $cache = cold ]; then
+		drop_caches || return 0
+	else
+		"$@" > /dev/null 2>&1
+		prepare $name
+	fi
+	tb=$(timed "$@")
+	prepare $name
+	calls=$(syscalls "$@" 2>/dev/null || echo 0)
+
+	echo $name $cache $tb $calls | awk -v n=$nfiles '{
+	    printf("%s\t%s\t%.1f\t%.1f\t%.1f\n", $1, $2,
+	        $3 > 0 ? n / $3 : 0, $5 / n, $4 * 512 / 1024 / n)
+	}' | tee -a $out
+}
+
+for cache in warm cold; do
+	run dump $cache $ID3V2TAGDUMP -r $corpus
+	run dump-j $cache $ID3V2TAGDUMP -j $jobs -r $corpus
+	run dump-q $cache $ID3V2TAGDUMP -j $jobs -q 256 -r $corpus
+	run dump-jsonl $cache $ID3V2TAGDUMP --format=jsonl -j $jobs -r $corpus
+	run fingerprint $cache $ID3V2TAGDUMP --fingerprint -j $jobs -r $corpus
+	run strip $cache $ID3V2TAGSTRIP -t APIC,COMM -r $scratch
+	run strip-q $cache $ID3V2TAGSTRIP -q 256 -t APIC,COMM -r $scratch
+	run strip-c $cache $ID3V2TAGSTRIP -c -t APIC,COMM -r $scratch
+done
+
+[ -z "$results" ] || cp $out $results
+[ -n "$baseline" ] || exit 0
+
+# Compare each case against the baseline.
+awk -F '\t' -v tol=$tolerance '
+NR == FNR {
+	rate[$1 "\t" $2] = $3
+	calls[$1 "\t" $2] = $4
+	next
+}
+($1 "\t" $2) in rate {
+	k = $1 "\t" $2
+	if ($3 < rate[k] * (1 - tol / 100)) {
+		printf("regression: %s %s: %.1f files/s, was %.1f\n",
+		    $1, $2, $3, rate[k])
+		bad = 1
+	}
+	if ($4 > calls[k] * (1 + tol / 100)) {
+		printf("regression: %s %s: %.1f syscalls/file, was %.1f\n",
+		    $1, $2, $4, calls[k])
+		bad = 1
+	}
+}
+END { exit bad }' $baseline $out >&2
@@ -0,0 +1,348 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Generate a corpus of synthetic MP3 files for benchmarking the tag tools.
+ * The tags vary in version, size, frame count, padding and unsynchronisation,
+ * and some carry cover art; the audio is a run of valid-looking MPEG-1 Layer
+ * III frame headers followed by noise.  The output is a function of the seed
+ * alone, so runs against the same seed measure the same work.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static std::string progname;
+static std::mt19937_64 rng;
+
+void
+usage()
+{
+    std::cout << "Usage: " << progname << " [-a audio_kb] [-n files] [-s seed] <dir>" << std::endl;
+    exit(1);
+}
+
+static unsigned
+pick(unsigned lo, unsigned hi)
+{
+
+    return (std::uniform_int_distribution<unsigned>(lo, hi)(rng));
+}
+
+static bool
+chance(unsigned percent)
+{
+
+    return (pick(0, 99) < percent);
+}
+
+static void
+put_be32(std::vector<uint8_t> &out, uint32_t v, bool syncsafe)
+{
+    int shift = syncsafe ? 7 : 8;
+    uint32_t mask = syncsafe ? 0x7f : 0xff;
+
+    for (int i = 3; i >= 0; i--)
+        out.push_back((v >> (i * shift)) & mask);
+}
+
+static std::string
+word()
+{
+    std::string s;
+
+    for (unsigned i = pick(3, 10); i > 0; i--)
+        s += (char)pick('a', 'z');
+    return (s);
+}
+
+static std::string
+words(unsigned lo, unsigned hi)
+{
+    std::string s;
+
+    for (unsigned i = pick(lo, hi); i > 0; i--) {
+        if (!s.empty())
+            s += ' ';
+        s += word();
+    }
+    return (s);
+}
+
+/*
+ * Insert a zero byte after each 0xff which is followed by a byte that could
+ * be mistaken for part of a sync pattern, and after a trailing 0xff.
+ */
+static std::vector<uint8_t>
+unsynchronise(const std::vector<uint8_t> &in)
+{
+    std::vector<uint8_t> out;
+
+    out.reserve(in.size() + in.size() / 64);
+    for (size_t i = 0; i < in.size(); i++) {
+        out.push_back(in[i]);
+        if (in[i] == 0xff && (i + 1 == in.size() || in[i + 1] >= 0xe0 ||
+            in[i + 1] == 0x00))
+            out.push_back(0x00);
+    }
+    return (out);
+}
+
+static void
+add_frame(std::vector<uint8_t> &tag, int major, bool unsync, const char *id,
+    const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> body(major == 4 && unsync ? unsynchronise(data) :
+        data);
+
+    tag.insert(tag.end(), id, id + 4);
+    put_be32(tag, body.size(), major == 4);
+    tag.push_back(0);
+    tag.push_back(major == 4 && unsync ? 0x02 : 0x00);
+    tag.insert(tag.end(), body.begin(), body.end());
+}
+
+static std::vector<uint8_t>
+text(uint8_t enc, const std::string &s)
+{
+    std::vector<uint8_t> data;
+
+    data.push_back(enc);
+    data.insert(data.end(), s.begin(), s.end());
+    return (data);
+}
+
+/*
+ * Cover art: a JPEG-like header followed by noise, which is full of false
+ * sync patterns and so is what unsynchronisation mostly has to deal with.
+ */
+static std::vector<uint8_t>
+picture(size_t size)
+{
+    static const uint8_t jfif[] = { 0xff, 0xd8, 0xff, 0xe0 };
+    static const char mime[] = "image/jpeg";
+    std::vector<uint8_t> data;
+
+    data.push_back(0);
+    data.insert(data.end(), mime, mime + sizeof(mime));
+    data.push_back(3);
+    data.push_back(0);
+    data.insert(data.end(), jfif, jfif + sizeof(jfif));
+    while (data.size() < size) {
+        uint64_t r = rng();
+
+        for (int i = 0; i < 8; i++, r >>= 8)
+            data.push_back(r & 0xff);
+    }
+    return (data);
+}
+
+static std::vector<uint8_t>
+make_tag()
+{
+    static const char *const ids[] = {
+        "TIT2", "TPE1", "TPE2", "TALB", "TCOM", "TCON", "TRCK", "TPOS",
+        "TBPM", "TKEY", "TLAN", "TPUB", "TCOP", "TENC", "TSSE", "TMED",
+    };
+    static const unsigned paddings[] = { 0, 256, 1024, 4096, 65536 };
+    std::vector<uint8_t> frames, tag;
+    int major = chance(50) ? 4 : 3;
+    bool unsync = chance(10);
+    uint8_t enc = major == 4 && chance(50) ? 3 : 0;
+
+    /* Between a bare title and a heavily annotated file. */
+    unsigned ntext = pick(1, 16);
+    for (unsigned i = 0; i < ntext; i++)
+        add_frame(frames, major, unsync, ids[i], text(enc, words(1, 6)));
+    for (unsigned i = pick(0, 24); i > 0; i--) {
+        std::vector<uint8_t> data(text(enc, word()));
+
+        data.push_back(0);
+        std::string value(words(1, 3));
+        data.insert(data.end(), value.begin(), value.end());
+        add_frame(frames, major, unsync, "TXXX", data);
+    }
+    if (chance(40)) {
+        std::vector<uint8_t> data(1, enc);
+        std::string value(words(5, 40));
+
+        data.insert(data.end(), { 'e', 'n', 'g', 0 });
+        data.insert(data.end(), value.begin(), value.end());
+        add_frame(frames, major, unsync, "COMM", data);
+    }
+    if (chance(30))
+        add_frame(frames, major, unsync, "APIC",
+            picture(chance(20) ? pick(256, 1024) * 1024 : pick(8, 64) * 1024));
+
+    if (major == 3 && unsync)
+        frames = unsynchronise(frames);
+    frames.resize(frames.size() +
+        paddings[pick(0, sizeof(paddings) / sizeof(paddings[0]) - 1)], 0);
+
+    tag.insert(tag.end(), { 'I', 'D', '3', (uint8_t)major, 0 });
+    tag.push_back(major == 3 && unsync ? 0x80 : 0x00);
+    put_be32(tag, frames.size(), true);
+    tag.insert(tag.end(), frames.begin(), frames.end());
+    return (tag);
+}
+
+/* MPEG-1 Layer III, 128 kbit/s, 44.1 kHz: 417-byte frames. */
+static std::vector<uint8_t>
+make_audio(size_t kb)
+{
+    static const uint8_t hdr[] = { 0xff, 0xfb, 0x90, 0x64 };
+    const size_t framelen = 417;
+    std::vector<uint8_t> audio;
+
+    for (size_t n = kb * 1024 / framelen; n > 0; n--) {
+        audio.insert(audio.end(), hdr, hdr + sizeof(hdr));
+        while (audio.size() % framelen != 0)
+            audio.push_back(rng() & 0xff);
+    }
+    return (audio);
+}
+
+static std::vector<uint8_t>
+make_id3v1()
+{
+    std::vector<uint8_t> v1(128, 0);
+    std::string title(words(1, 3));
+
+    memcpy(&v1[0], "TAG", 3);
+    memcpy(&v1[3], title.data(), std::min(title.size(), (size_t)30));
+    v1[127] = 12;
+    return (v1);
+}
+
+static bool
+write_file(const std::string &path, const std::vector<uint8_t> &tag,
+    const std::vector<uint8_t> &audio, const std::vector<uint8_t> &v1)
+{
+    const std::vector<uint8_t> *parts[] = { &tag, &audio, &v1 };
+    int fd;
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return (false);
+    for (const auto *p : parts) {
+        for (size_t off = 0; off < p->size();) {
+            ssize_t n = write(fd, p->data() + off, p->size() - off);
+
+            if (n < 0) {
+                (void)close(fd);
+                return (false);
+            }
+            off += n;
+        }
+    }
+    return (close(fd) == 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    std::string argv0(argv[0]);
+    auto last = argv0.find_last_of("/");
+    progname = argv0.substr(last == std::string::npos ? 0 : last + 1);
+
+    unsigned long nfiles = 1000, audiokb = 256, seed = 1;
+    char *endptr;
+    int ch;
+    while ((ch = getopt(argc, argv, "a:n:s:")) != -1) {
+        switch (ch) {
+        case 'a':
+            audiokb = strtoul(optarg, &endptr, 10);
+            if (optarg[0] == '\0' || *endptr != '\0')
+                usage();
+            break;
+        case 'n':
+            nfiles = strtoul(optarg, &endptr, 10);
+            if (optarg[0] == '\0' || *endptr != '\0')
+                usage();
+            break;
+        case 's':
+            seed = strtoul(optarg, &endptr, 10);
+            if (optarg[0] == '\0' || *endptr != '\0')
+                usage();
+            break;
+        default:
+            usage();
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc != 1)
+        usage();
+    rng.seed(seed);
+
+    /* Files are spread over subdirectories, as they would be in a library. */
+    std::string dir(argv[0]);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << progname << ": " << dir << ": " << strerror(errno) << std::endl;
+        return (1);
+    }
+    for (unsigned long i = 0; i < nfiles; i++) {
+        char name[64];
+
+        if (i % 256 == 0) {
+            snprintf(name, sizeof(name), "/d%03lu", i / 256);
+            if (mkdir((dir + name).c_str(), 0755) != 0 && errno != EEXIST) {
+                std::cerr << progname << ": " << dir << name << ": " <<
+                    strerror(errno) << std::endl;
+                return (1);
+            }
+        }
+        snprintf(name, sizeof(name), "/d%03lu/%06lu.mp3", i / 256, i);
+
+        std::vector<uint8_t> tag(make_tag());
+        std::vector<uint8_t> audio(make_audio(audiokb));
+        std::vector<uint8_t> v1;
+        if (chance(20))
+            v1 = make_id3v1();
+        if (!write_file(dir + name, tag, audio, v1)) {
+            std::cerr << progname << ": " << dir << name << ": " <<
+                strerror(errno) << std::endl;
+            return (1);
+        }
+    }
+
+    return (0);
+}
@@ -0,0 +1,248 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fingerprint.h"
+#include "id3v2.h"
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ull;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t PRIME3 = 0x165667b19e3779f9ull;
+static const uint64_t PRIME4 = 0x85ebca77c2b2ae63ull;
+static const uint64_t PRIME5 = 0x27d4eb2f165667c5ull;
+
+static const size_t CHUNK_SIZE = 1024 * 1024;
+
+/* Compilers reduce these to single loads where the byte order allows. */
+static inline uint32_t
+le32(const uint8_t *p)
+{
+
+    return ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+        (uint32_t)p[3] << 24);
+}
+
+static inline uint64_t
+le64(const uint8_t *p)
+{
+
+    return ((uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32);
+}
+
+static inline uint64_t
+rotl(uint64_t x, int r)
+{
+
+    return ((x << r) | (x >> (64 - r)));
+}
+
+static inline uint64_t
+lane(uint64_t acc, uint64_t input)
+{
+
+    acc += input * PRIME2;
+    acc = rotl(acc, 31);
+    return (acc * PRIME1);
+}
+
+static inline uint64_t
+merge(uint64_t acc, uint64_t val)
+{
+
+    acc ^= lane(0, val);
+    return (acc * PRIME1 + PRIME4);
+}
+
+XXH64::XXH64(uint64_t seed_) :
+    total(0), memlen(0), seed(seed_)
+{
+
+    v[0] = seed + PRIME1 + PRIME2;
+    v[1] = seed + PRIME2;
+    v[2] = seed;
+    v[3] = seed - PRIME1;
+}
+
+void
+XXH64::update(const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint8_t *end = p + len;
+
+    total += len;
+    if (memlen + len < sizeof(mem)) {
+        memcpy(mem + memlen, p, len);
+        memlen += len;
+        return;
+    }
+    if (memlen > 0) {
+        memcpy(mem + memlen, p, sizeof(mem) - memlen);
+        p += sizeof(mem) - memlen;
+        for (int i = 0; i < 4; i++)
+            v[i] = lane(v[i], le64(mem + i * 8));
+        memlen = 0;
+    }
+
+    /* The main loop: four independent lanes of 8 bytes each. */
+    for (; end - p >= 32; p += 32) {
+        v[0] = lane(v[0], le64(p));
+        v[1] = lane(v[1], le64(p + 8));
+        v[2] = lane(v[2], le64(p + 16));
+        v[3] = lane(v[3], le64(p + 24));
+    }
+
+    memcpy(mem, p, end - p);
+    memlen = end - p;
+}
+
+uint64_t
+XXH64::digest() const
+{
+    const uint8_t *p = mem, *end = mem + memlen;
+    uint64_t h;
+
+    if (total >= 32) {
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+        for (int i = 0; i < 4; i++)
+            h = merge(h, v[i]);
+    } else {
+        h = seed + PRIME5;
+    }
+    h += total;
+
+    for (; end - p >= 8; p += 8) {
+        h ^= lane(0, le64(p));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t)le32(p) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return (h);
+}
+
+/*
+ * Find the extent of the audio payload: skip a leading ID3v2 tag and trim an
+ * ID3v1 tag and an APE tag (in that order) from the end of the file.
+ */
+static bool
+payload_extent(int fd, off_t size, off_t &start, off_t &end)
+{
+    uint8_t hdr[id3v2::HEADER_SIZE], trailer[128], ape[32];
+    size_t total;
+
+    start = 0;
+    end = size;
+
+    if (size >= (off_t)sizeof(hdr)) {
+        if (pread(fd, hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr))
+            return (false);
+        if (id3v2::Tag::header(hdr, total) == id3v2::OK)
+            start = total;
+    }
+
+    if (end - start >= (off_t)sizeof(trailer)) {
+        if (pread(fd, trailer, sizeof(trailer), end - sizeof(trailer)) !=
+            (ssize_t)sizeof(trailer))
+            return (false);
+        if (memcmp(trailer, "TAG", 3) == 0)
+            end -= sizeof(trailer);
+    }
+
+    if (end - start >= (off_t)sizeof(ape)) {
+        if (pread(fd, ape, sizeof(ape), end - sizeof(ape)) !=
+            (ssize_t)sizeof(ape))
+            return (false);
+        if (memcmp(ape, "APETAGEX", 8) == 0) {
+            /* The size includes the footer but not the optional header. */
+            off_t apesize = le32(ape + 12);
+
+            if ((le32(ape + 20) & 0x80000000u) != 0)
+                apesize += sizeof(ape);
+            if (apesize <= end - start)
+                end -= apesize;
+        }
+    }
+
+    if (start > end)
+        start = end;
+    return (true);
+}
+
+bool
+fingerprint(const char *path, uint64_t &hash)
+{
+    std::vector<uint8_t> buf(CHUNK_SIZE);
+    struct stat sb;
+    off_t start, end, off;
+    ssize_t n;
+    XXH64 h;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return (false);
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+        !payload_extent(fd, sb.st_size, start, end)) {
+        (void)close(fd);
+        return (false);
+    }
+
+    (void)posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+    for (off = start; off < end; off += n) {
+        n = pread(fd, &buf[0], std::min((off_t)buf.size(), end - off), off);
+        if (n <= 0) {
+            (void)close(fd);
+            return (false);
+        }
+        h.update(&buf[0], n);
+    }
+    (void)posix_fadvise(fd, start, end - start, POSIX_FADV_DONTNEED);
+    (void)close(fd);
+
+    hash = h.digest();
+    return (true);
+}
@@ -0,0 +1,60 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FINGERPRINT_H_
+#define _FINGERPRINT_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Compute a fingerprint of the MPEG audio payload of a file, i.e., of the data
+ * between a leading ID3v2 tag and any trailing APE and ID3v1 tags, so that
+ * files differing only in their tags have the same fingerprint.
+ */
+bool fingerprint(const char *path, uint64_t &hash);
+
+/*
+ * A streaming implementation of the 64-bit xxHash function.  It consumes input
+ * as four independent 64-bit lanes, which keeps several multipliers busy at
+ * once and lets it run at close to memory bandwidth.
+ */
+class XXH64 {
+public:
+    explicit XXH64(uint64_t seed = 0);
+
+    void update(const void *data, size_t len);
+    uint64_t digest() const;
+
+private:
+    uint64_t v[4];
+    uint64_t total;
+    uint8_t mem[32];
+    size_t memlen;
+    uint64_t seed;
+};
+
+#endif /* !_FINGERPRINT_H_ */
@@ -24,22 +24,933 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
 
 #include <taglib/id3v2tag.h>
 #include <taglib/mpegfile.h>
 
+#include "fingerprint.h"
+#include "frameset.h"
+#include "id3v2.h"
+#include "ioengine.h"
+#include "pathsource.h"
+#include "tagindex.h"
+
 static std::string progname;
+static TagIndex *tagindex;
+static enum { TEXT, JSONL, TSV } format = TEXT;
+/*
+ * Text output reproduces TagLib's to8Bit() rendering, which narrows each
+ * character to 8 bits; the machine-readable formats are rendered as UTF-8.
+ */
+static id3v2::Charset charset = id3v2::NARROW;
+static id3v2::FrameSet projection;
+static bool summarize;
+static bool fpmode;
 
 void
 usage()
 {
-    std::cout << "Usage: " << progname << " file1 [file2 [ ... ]]" << std::endl;
+    std::cout << "Usage: " << progname << " [-0s] [-f frames] [-j jobs] [-q depth] [-r dir]\n" <<
+        "       [--format=text|jsonl|tsv] [--fingerprint] [--index file [--prune]] [file1 [file2 [ ... ]]]" << std::endl;
     exit(1);
 }
 
+/*
+ * Output is accumulated in a large buffer and handed to write(2) in big
+ * chunks, rather than being flushed line by line.  Callers append whole files'
+ * worth of output, so a write never ends in the middle of a record unless a
+ * single file's output exceeds the buffer.
+ */
+class OutBuf {
+public:
+    OutBuf(int fd, size_t size);
+    ~OutBuf();
+
+    void append(const std::string &s);
+    void flush();
+
+private:
+    int fd;
+    size_t size;
+    std::string buf;
+};
+
+OutBuf::OutBuf(int fd_, size_t size_) :
+    fd(fd_), size(size_)
+{
+    buf.reserve(size);
+}
+
+OutBuf::~OutBuf()
+{
+
+    flush();
+}
+
+void
+OutBuf::append(const std::string &s)
+{
+
+    if (buf.size() + s.size() > size)
+        flush();
+    buf += s;
+    if (buf.size() >= size)
+        flush();
+}
+
+void
+OutBuf::flush()
+{
+    const char *p = buf.data();
+    size_t resid = buf.size();
+    ssize_t n;
+
+    while (resid > 0) {
+        n = write(fd, p, resid);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << progname << ": write: " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        p += n;
+        resid -= n;
+    }
+    buf.clear();
+}
+
+/*
+ * A work-stealing pool: each worker services its own deque from the front and
+ * steals from the back of its siblings' deques when it runs dry.  Submitted
+ * jobs are dealt out round-robin so that the oldest jobs are picked up first.
+ * Jobs may be submitted from any thread.
+ */
+class WorkPool {
+public:
+    WorkPool(unsigned nthreads, std::function<void(size_t)> fn);
+    ~WorkPool();
+
+    void submit(size_t job);
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<size_t> jobs;
+    };
+
+    bool take(unsigned self, size_t &job);
+    void run(unsigned self);
+
+    std::function<void(size_t)> fn;
+    std::vector<Worker> workers;
+    std::vector<std::thread> threads;
+    std::atomic<unsigned> nextworker;
+
+    std::mutex idlelock;
+    std::condition_variable idlecv;
+    size_t queued;
+    bool done;
+};
+
+WorkPool::WorkPool(unsigned nthreads, std::function<void(size_t)> fn_) :
+    fn(fn_), workers(nthreads), nextworker(0), queued(0), done(false)
+{
+    for (unsigned i = 0; i < nthreads; i++)
+        threads.emplace_back(&WorkPool::run, this, i);
+}
+
+WorkPool::~WorkPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(idlelock);
+        done = true;
+    }
+    idlecv.notify_all();
+    for (auto &thr : threads)
+        thr.join();
+}
+
+void
+WorkPool::submit(size_t job)
+{
+    Worker &w(workers[nextworker++ % workers.size()]);
+
+    {
+        std::lock_guard<std::mutex> guard(w.lock);
+        w.jobs.push_back(job);
+    }
+    {
+        std::lock_guard<std::mutex> guard(idlelock);
+        queued++;
+    }
+    idlecv.notify_one();
+}
+
+bool
+WorkPool::take(unsigned self, size_t &job)
+{
+    for (unsigned i = 0; i < workers.size(); i++) {
+        Worker &w(workers[(self + i) % workers.size()]);
+        std::lock_guard<std::mutex> guard(w.lock);
+
+        if (w.jobs.empty())
+            continue;
+        if (i == 0) {
+            job = w.jobs.front();
+            w.jobs.pop_front();
+        } else {
+            job = w.jobs.back();
+            w.jobs.pop_back();
+        }
+        return (true);
+    }
+    return (false);
+}
+
+void
+WorkPool::run(unsigned self)
+{
+    size_t job;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(idlelock);
+            idlecv.wait(guard, [this] { return (queued > 0 || done); });
+            if (queued == 0)
+                return;
+            queued--;
+        }
+        /* We reserved a job above, so one is guaranteed to be queued. */
+        while (!take(self, job))
+            ;
+        fn(job);
+    }
+}
+
+/*
+ * Emulate TextIdentificationFrame::toString(): the field list is split on
+ * delimiters, empty fields are dropped and the rest are joined with spaces.
+ */
+static bool
+text_string(const id3v2::Frame &f, std::string &out)
+{
+    const uint8_t *p = f.data + 1;
+    unsigned enc;
+    size_t align, len, start, delim;
+    bool first = true;
+
+    if (f.size < 1)
+        return (false);
+    enc = f.data[0];
+    if (enc > 3)
+        return (false);
+    align = enc == 1 || enc == 2 ? 2 : 1;
+    len = f.size - 1;
+    while (len > 0 && f.data[len] == 0)
+        len--;
+    while (len % align != 0)
+        len++;
+    len = std::min(len, f.size - 1);
+
+    for (start = 0; start < len; start = delim + align) {
+        size_t fieldstart;
+
+        delim = id3v2::find_delim(p, len, start, enc);
+        if (delim == SIZE_MAX)
+            delim = len;
+        if (delim == start)
+            continue;
+        if (!first)
+            out += ' ';
+        first = false;
+        fieldstart = out.size();
+        if (!id3v2::append_string(out, p + start, delim - start, enc,
+            charset))
+            return (false);
+        /* TagLib rewrites genre references of the form "(n)". */
+        if (strcmp(f.id, "TCON") == 0 && out.size() > fieldstart &&
+            out[fieldstart] == '(')
+            return (false);
+    }
+    return (true);
+}
+
+static bool
+comment_string(const id3v2::Frame &f, std::string &out)
+{
+    unsigned enc;
+    size_t delim;
+
+    if (f.size < 5)
+        return (true);
+    enc = f.data[0];
+    if (enc > 3)
+        return (false);
+    delim = id3v2::find_delim(f.data, f.size, 4, enc);
+    if (delim == SIZE_MAX)
+        return (true);
+    delim += enc == 1 || enc == 2 ? 2 : 1;
+    return (id3v2::append_string(out, f.data + delim, f.size - delim, enc,
+        charset));
+}
+
+static bool
+picture_string(const id3v2::Frame &f, std::string &out)
+{
+    std::string mime, desc;
+    unsigned enc;
+    size_t delim, pos;
+
+    if (f.size >= 5) {
+        enc = f.data[0];
+        if (enc > 3)
+            return (false);
+        delim = id3v2::find_delim(f.data, f.size, 1, 0);
+        if (delim == SIZE_MAX)
+            return (false);
+        id3v2::append_string(mime, f.data + 1, delim - 1, 0, charset);
+        pos = delim + 2;
+        if (pos < f.size) {
+            delim = id3v2::find_delim(f.data, f.size, pos, enc);
+            if (delim != SIZE_MAX &&
+                !id3v2::append_string(desc, f.data + pos, delim - pos, enc,
+                charset))
+                return (false);
+        }
+    }
+    if (!desc.empty())
+        out += desc + " ";
+    out += "[" + mime + "]";
+    return (true);
+}
+
+/*
+ * Render a frame as TagLib's Frame::toString() would.  Only frame types whose
+ * string form we can reproduce exactly are handled.
+ */
+static bool
+frame_string(const id3v2::Frame &f, std::string &out)
+{
+
+    if (f.size < 1)
+        return (false);
+    if (f.id[0] == 'T' && strcmp(f.id, "TXXX") != 0)
+        return (text_string(f, out));
+    if (f.id[0] == 'W' && strcmp(f.id, "WXXX") != 0 &&
+        strcmp(f.id, "WFED") != 0)
+        return (id3v2::append_string(out, f.data, f.size, 0, charset));
+    if (strcmp(f.id, "COMM") == 0)
+        return (comment_string(f, out));
+    if (strcmp(f.id, "APIC") == 0)
+        return (picture_string(f, out));
+    if (strcmp(f.id, "PRIV") == 0)
+        return (f.size < 2 ||
+            id3v2::append_string(out, f.data, f.size, 0, charset));
+    return (false);
+}
+
+/*
+ * The frames of a tag, grouped by frame ID in the order TagLib's FrameListMap
+ * lists them, with each frame rendered as TagLib's toString() renders it.
+ */
+typedef std::vector<std::pair<std::string, std::vector<std::string> > > FrameMap;
+
+/*
+ * Frames which don't carry text.  With -s they are summarized by their size
+ * rather than decoded.  The size is the one recorded in the frame header, as
+ * TagLib's Frame::size() reports it, so it counts any data length indicator
+ * and unsynchronisation; both readers report the same size, and so can share
+ * index entries.
+ */
+static bool
+is_binary(const char *id)
+{
+
+    return (id[0] != 'T' && id[0] != 'W' && strcmp(id, "COMM") != 0 &&
+        strcmp(id, "USLT") != 0);
+}
+
+static std::string
+size_string(size_t size)
+{
+
+    return ("<" + std::to_string(size) + " bytes>");
+}
+
+/*
+ * Are any of the frames affected by TagLib's v2.3 to v2.4 conversion selected?
+ * If so, we can't answer for lossy tags without TagLib.
+ */
+static bool
+lossy_selected()
+{
+    static const char *ids[] = {
+        "EQUA", "IPLS", "RVAD", "TDAT", "TDRC", "TIME", "TIPL", "TRDA", "TSIZ",
+    };
+
+    if (projection.empty())
+        return (true);
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++)
+        if (projection.lookup(ids[i]) != id3v2::FrameSet::NO)
+            return (true);
+    return (false);
+}
+
+/*
+ * Try to read a file's frames without involving TagLib.  Returns false if the
+ * file must be handled by TagLib instead.  Frames excluded by the projection
+ * cost only the parsing of their header.  If the I/O engine has already read
+ * the tag, it is parsed from the engine's buffer.
+ */
+static bool
+read_fast(const char *path, const id3v2::IoEngine::Request *pre,
+    FrameMap &map)
+{
+    static const bool lossy = lossy_selected();
+    id3v2::Tag tag;
+    std::vector<const id3v2::Frame *> frames;
+
+    switch (pre != NULL ? tag.parse(pre->buf.data(), pre->buf.size()) :
+        tag.open(path)) {
+    case id3v2::NOTAG:
+        return (true);
+    case id3v2::OK:
+        if (tag.lossy() && lossy)
+            return (false);
+        break;
+    default:
+        return (false);
+    }
+
+    for (const auto &f : tag.frames())
+        if (projection.empty() || projection.match(f))
+            frames.push_back(&f);
+
+    /* Order frames by ID as TagLib's FrameListMap does. */
+    std::stable_sort(frames.begin(), frames.end(),
+        [](const id3v2::Frame *a, const id3v2::Frame *b) {
+            return (memcmp(a->id, b->id, 4) < 0);
+        });
+
+    for (size_t i = 0; i < frames.size(); i++) {
+        const id3v2::Frame &f(*frames[i]);
+
+        if (i == 0 || memcmp(frames[i - 1]->id, f.id, 4) != 0)
+            map.emplace_back(f.id, std::vector<std::string>());
+        if (summarize && is_binary(f.id)) {
+            /* The extent is the frame header plus the recorded size. */
+            map.back().second.push_back(size_string(f.extent - 10));
+            continue;
+        }
+        map.back().second.emplace_back();
+        if (!frame_string(f, map.back().second.back())) {
+            map.clear();
+            return (false);
+        }
+    }
+    return (true);
+}
+
+static bool
+read_taglib(const char *path, FrameMap &map)
+{
+    TagLib::MPEG::File file(path, false);
+
+    if (!file.isValid())
+        return (false);
+
+    const TagLib::ID3v2::FrameListMap &flm(file.ID3v2Tag()->frameListMap());
+    for (TagLib::ID3v2::FrameListMap::ConstIterator i = flm.begin(); i != flm.end(); ++i) {
+        const std::string id(i->first.data(), i->first.size());
+        bool first = true;
+
+        if (!projection.empty() &&
+            projection.lookup(id.c_str()) == id3v2::FrameSet::NO)
+            continue;
+        for (TagLib::ID3v2::FrameList::ConstIterator frame = i->second.begin();
+             frame != i->second.end(); ++frame) {
+            if (!projection.empty() && !projection.match(**frame))
+                continue;
+            if (first)
+                map.emplace_back(id, std::vector<std::string>());
+            first = false;
+            if (summarize && is_binary(id.c_str()))
+                map.back().second.push_back(size_string((*frame)->size()));
+            else
+                map.back().second.push_back(
+                    (*frame)->toString().to8Bit(charset == id3v2::UTF8));
+        }
+    }
+    return (true);
+}
+
+static void
+put_varint(std::string &buf, uint64_t v)
+{
+
+    for (; v >= 0x80; v >>= 7)
+        buf += (char)(v | 0x80);
+    buf += (char)v;
+}
+
+static bool
+get_varint(const char *&p, const char *end, uint64_t &v)
+{
+
+    v = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        v |= (uint64_t)(*p & 0x7f) << shift;
+        if ((*p++ & 0x80) == 0)
+            return (true);
+    }
+    return (false);
+}
+
+static std::string
+encode_map(const FrameMap &map)
+{
+    std::string buf;
+
+    put_varint(buf, map.size());
+    for (const auto &e : map) {
+        put_varint(buf, e.first.size());
+        buf += e.first;
+        put_varint(buf, e.second.size());
+        for (const auto &v : e.second) {
+            put_varint(buf, v.size());
+            buf += v;
+        }
+    }
+    return (buf);
+}
+
+static bool
+decode_map(const char *p, size_t len, FrameMap &map)
+{
+    const char *end = p + len;
+    uint64_t nkeys, nvals, n;
+
+    if (!get_varint(p, end, nkeys))
+        return (false);
+    for (; nkeys > 0; nkeys--) {
+        if (!get_varint(p, end, n) || n > (size_t)(end - p))
+            return (false);
+        map.emplace_back(std::string(p, n), std::vector<std::string>());
+        p += n;
+        if (!get_varint(p, end, nvals))
+            return (false);
+        for (; nvals > 0; nvals--) {
+            if (!get_varint(p, end, n) || n > (size_t)(end - p))
+                return (false);
+            map.back().second.emplace_back(p, n);
+            p += n;
+        }
+    }
+    return (p == end);
+}
+
+static void
+render_text(const FrameMap &map, std::string &out)
+{
+
+    for (const auto &e : map) {
+        out += e.first;
+        out += ": ";
+        for (size_t i = 0; i < e.second.size(); i++) {
+            if (i != 0)
+                out += ", ";
+            out += "'";
+            out += e.second[i];
+            out += "'";
+        }
+        out += "\n";
+    }
+}
+
+/*
+ * Append a JSON string.  Frame values are rendered as UTF-8 for JSON and are
+ * passed through, as are paths that are valid UTF-8.  Other bytes are escaped.
+ */
+static void
+json_string(std::string &out, const std::string &s)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    out += '"';
+    for (size_t i = 0; i < s.size(); i++) {
+        uint8_t c = s[i];
+
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            continue;
+        case '\\':
+            out += "\\\\";
+            continue;
+        case '\n':
+            out += "\\n";
+            continue;
+        case '\r':
+            out += "\\r";
+            continue;
+        case '\t':
+            out += "\\t";
+            continue;
+        }
+        if (c < 0x20 || c >= 0x80) {
+            size_t len = 0;
+
+            if (c >= 0xc2 && c <= 0xf4) {
+                len = c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+                for (size_t j = 1; j < len; j++)
+                    if (i + j >= s.size() || ((uint8_t)s[i + j] & 0xc0) != 0x80)
+                        len = 0;
+            }
+            if (len != 0) {
+                out.append(s, i, len);
+                i += len - 1;
+            } else {
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xf];
+            }
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+/*
+ * One JSON object per file:
+ * {"path":"a.mp3","frames":{"TIT2":["Title"],"TPE1":["A","B"]}}
+ */
+static void
+render_jsonl(const char *path, const FrameMap &map, std::string &out)
+{
+
+    out += "{\"path\":";
+    json_string(out, path);
+    out += ",\"frames\":{";
+    for (size_t i = 0; i < map.size(); i++) {
+        if (i != 0)
+            out += ',';
+        json_string(out, map[i].first);
+        out += ":[";
+        for (size_t j = 0; j < map[i].second.size(); j++) {
+            if (j != 0)
+                out += ',';
+            json_string(out, map[i].second[j]);
+        }
+        out += ']';
+    }
+    out += "}}\n";
+}
+
+/*
+ * Append a TSV field.  Tabs, newlines and backslashes are escaped, and values
+ * are UTF-8 as for JSON.
+ */
+static void
+tsv_field(std::string &out, const std::string &s)
+{
+
+    for (size_t i = 0; i < s.size(); i++) {
+        uint8_t c = s[i];
+
+        switch (c) {
+        case '\t':
+            out += "\\t";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        default:
+            out += (char)c;
+            break;
+        }
+    }
+}
+
+/* One line per frame: path, frame ID, value. */
+static void
+render_tsv(const char *path, const FrameMap &map, std::string &out)
+{
+
+    for (const auto &e : map) {
+        for (const auto &v : e.second) {
+            tsv_field(out, path);
+            out += '\t';
+            out += e.first;
+            out += '\t';
+            tsv_field(out, v);
+            out += '\n';
+        }
+    }
+}
+
+static bool
+read_tag(const char *path, const id3v2::IoEngine::Request *pre, FrameMap &map)
+{
+
+    return (read_fast(path, pre, map) || read_taglib(path, map));
+}
+
+/*
+ * With --fingerprint, print the hash of each file's audio payload instead of
+ * its frames, so that files differing only in their tags can be paired up by
+ * sorting the output.
+ */
+static void
+dump_fingerprint(const char *path, std::string &out, std::string &errs)
+{
+    struct stat sb;
+    const char *data;
+    std::string hex;
+    uint64_t hash;
+    size_t len;
+    char buf[17];
+    bool ok;
+
+    if (tagindex != NULL && stat(path, &sb) == 0 && S_ISREG(sb.st_mode) &&
+        tagindex->lookup(sb, data, len) && len == 16) {
+        hex.assign(data, len);
+        ok = true;
+    } else if ((ok = fingerprint(path, hash))) {
+        snprintf(buf, sizeof(buf), "%016jx", (uintmax_t)hash);
+        hex = buf;
+        if (tagindex != NULL && stat(path, &sb) == 0 && S_ISREG(sb.st_mode))
+            tagindex->insert(sb, path, hex);
+    }
+
+    if (!ok) {
+        errs += progname + ": skipping " + path + "\n";
+        return;
+    }
+
+    switch (format) {
+    case TEXT:
+        out += hex;
+        out += '\t';
+        out += path;
+        out += '\n';
+        break;
+    case JSONL:
+        out += "{\"path\":";
+        json_string(out, path);
+        out += ",\"fingerprint\":\"";
+        out += hex;
+        out += "\"}\n";
+        break;
+    case TSV:
+        out += hex;
+        out += '\t';
+        tsv_field(out, path);
+        out += '\n';
+        break;
+    }
+}
+
+static void
+render_map(const char *path, const FrameMap &map, std::string &out)
+{
+
+    switch (format) {
+    case TEXT:
+        render_text(map, out);
+        break;
+    case JSONL:
+        render_jsonl(path, map, out);
+        break;
+    case TSV:
+        render_tsv(path, map, out);
+        break;
+    }
+}
+
+/*
+ * Dump one file.  "pre" holds the file's tag if it was read ahead by the I/O
+ * engine, in which case the engine's stat of the file is used for the index.
+ */
+static void
+dump_file(const char *path, std::string &out, std::string &errs,
+    const id3v2::IoEngine::Request *pre = NULL)
+{
+    FrameMap map;
+    struct stat sb;
+    const char *data;
+    size_t len;
+    bool ok;
+
+    if (fpmode) {
+        dump_fingerprint(path, out, errs);
+        return;
+    }
+
+    /* Errors are reported by the normal path. */
+    if (pre != NULL && pre->error != 0)
+        pre = NULL;
+    if (pre != NULL)
+        sb = pre->sb;
+
+    if (tagindex != NULL && (pre != NULL || stat(path, &sb) == 0) &&
+        S_ISREG(sb.st_mode)) {
+        /* Unchanged files are answered without being opened. */
+        if (tagindex->lookup(sb, data, len) && decode_map(data, len, map)) {
+            ok = true;
+        } else {
+            map.clear();
+            if ((ok = read_tag(path, pre, map)))
+                tagindex->insert(sb, path, encode_map(map));
+        }
+    } else {
+        ok = read_tag(path, pre, map);
+    }
+
+    if (!ok) {
+        errs += progname + ": skipping " + path + "\n";
+        return;
+    }
+    render_map(path, map, out);
+}
+
+/*
+ * Dump a file from the index alone, if its entry is current.  Returns false,
+ * having output nothing, if the file has to be read.
+ */
+static bool
+dump_indexed(const char *path, std::string &out)
+{
+    FrameMap map;
+    struct stat sb;
+    const char *data;
+    size_t len;
+
+    if (stat(path, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+        !tagindex->lookup(sb, data, len) || !decode_map(data, len, map))
+        return (false);
+    render_map(path, map, out);
+    return (true);
+}
+
+/*
+ * Dump files using a pool of worker threads.  Each worker renders a file's
+ * output into a private buffer, and the main thread emits the buffers in the
+ * order the files were given, so the output is identical to that of a serial
+ * run.  At most "window" files are in flight at a time, which bounds the
+ * memory used to hold completed but not-yet-printed output.
+ *
+ * With an I/O depth, each file's tag is first read by the I/O engine, and the
+ * file is handed to a worker once the read completes, so that up to "depth"
+ * opens and reads are outstanding at once regardless of the number of workers.
+ * With an index, a worker first tries to answer the file from the index, and
+ * only files it can't answer are passed to the engine.
+ */
+static void
+dump_parallel(id3v2::PathSource &files, unsigned njobs, unsigned depth,
+    OutBuf &outbuf)
+{
+    struct Slot {
+        std::string path;
+        std::string out, errs;
+        id3v2::IoEngine::Request req;
+        bool indexed;   /* The index has been tried, or there is none. */
+        bool ready;
+    };
+
+    const size_t window = std::max<size_t>(njobs * 16, depth);
+    std::vector<Slot> slots(window);
+    std::mutex lock;
+    std::condition_variable cv;
+    std::unique_ptr<id3v2::IoEngine> io;
+
+    WorkPool pool(njobs, [&](size_t seq) {
+        Slot &slot(slots[seq % window]);
+
+        /* The slot belongs to this worker until it is marked ready. */
+        slot.out.clear();
+        slot.errs.clear();
+        if (io && !slot.indexed) {
+            if (!dump_indexed(slot.path.c_str(), slot.out)) {
+                slot.indexed = true;
+                io->submit(&slot.req);
+                return;
+            }
+        } else {
+            dump_file(slot.path.c_str(), slot.out, slot.errs,
+                io ? &slot.req : NULL);
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        slot.ready = true;
+        cv.notify_all();
+    });
+
+    if (depth > 0)
+        io = id3v2::IoEngine::create(depth,
+            [&pool](id3v2::IoEngine::Request *req) { pool.submit(req->seq); });
+
+    size_t next = 0, seq = 0;
+    bool more = true;
+    for (;;) {
+        for (; more && seq - next < window; seq++) {
+            Slot &slot(slots[seq % window]);
+
+            if (!(more = files.next(slot.path)))
+                break;
+            slot.ready = false;
+            slot.indexed = tagindex == NULL;
+            if (io) {
+                slot.req.path = slot.path.c_str();
+                slot.req.seq = seq;
+            }
+            if (io && slot.indexed)
+                io->submit(&slot.req);
+            else
+                pool.submit(seq);
+        }
+        if (next == seq)
+            break;
+
+        Slot &slot(slots[next % window]);
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [&slot] { return (slot.ready); });
+        }
+        outbuf.append(slot.out);
+        std::cerr << slot.errs;
+        next++;
+    }
+}
+
 int
 main(int argc, char **argv)
 {
@@ -47,28 +958,130 @@ main(int argc, char **argv)
     auto last = argv0.find_last_of("/");
     progname = argv0.substr(last == std::string::npos ? 0 : last + 1);
 
-    if (argc < 2)
-        usage();
+    enum { OPT_FINGERPRINT = 256, OPT_FORMAT, OPT_INDEX, OPT_PRUNE };
+    static const struct option longopts[] = {
+        { "fingerprint", no_argument, NULL, OPT_FINGERPRINT },
+        { "format", required_argument, NULL, OPT_FORMAT },
+        { "index", required_argument, NULL, OPT_INDEX },
+        { "prune", no_argument, NULL, OPT_PRUNE },
+        { NULL, 0, NULL, 0 },
+    };
 
-    const char *tag = argv[1];
-    for (int i = 1; argv[i] != NULL; i++) {
-        auto *file = new TagLib::MPEG::File(argv[i], false);
-        if (file == NULL || !file->isValid()) {
-            std::cerr << progname << ": skipping " << argv[i] << std::endl;
-            continue;
+    id3v2::PathSource files;
+    unsigned long njobs = 1, depth = 0;
+    const char *indexpath = NULL;
+    std::string projspec;
+    bool nul = false, prune = false, tree = false;
+    char *endptr;
+    int ch;
+    while ((ch = getopt_long(argc, argv, "0f:j:q:r:s", longopts, NULL)) != -1) {
+        switch (ch) {
+        case OPT_FINGERPRINT:
+            fpmode = true;
+            break;
+        case OPT_FORMAT:
+            if (strcmp(optarg, "text") == 0)
+                format = TEXT;
+            else if (strcmp(optarg, "jsonl") == 0)
+                format = JSONL;
+            else if (strcmp(optarg, "tsv") == 0)
+                format = TSV;
+            else
+                usage();
+            break;
+        case OPT_INDEX:
+            indexpath = optarg;
+            break;
+        case OPT_PRUNE:
+            prune = true;
+            break;
+        case '0':
+            nul = true;
+            break;
+        case 'f':
+            if (!projection.add(optarg))
+                usage();
+            projspec += optarg;
+            projspec += ',';
+            break;
+        case 'j':
+            njobs = strtoul(optarg, &endptr, 10);
+            if (optarg[0] == '\0' || *endptr != '\0' || njobs == 0 ||
+                njobs > 1024)
+                usage();
+            break;
+        case 'q':
+            depth = strtoul(optarg, &endptr, 10);
+            if (optarg[0] == '\0' || *endptr != '\0' || depth > 4096)
+                usage();
+            break;
+        case 'r':
+            files.addtree(optarg);
+            tree = true;
+            break;
+        case 's':
+            summarize = true;
+            break;
+        default:
+            usage();
         }
+    }
+    argc -= optind;
+    argv += optind;
 
-        const TagLib::ID3v2::FrameListMap &flm(file->ID3v2Tag()->frameListMap());
-        for (TagLib::ID3v2::FrameListMap::ConstIterator i = flm.begin(); i != flm.end(); ++i) {
-            std::cout << i->first << ": ";
-            for (TagLib::ID3v2::FrameList::ConstIterator frame = i->second.begin();
-                 frame != i->second.end(); ++frame)
-                std::cout << (frame == i->second.begin() ? "" : ", ") << "'" << (*frame)->toString() << "'";
-            std::cout << std::endl;
-        }
+    if (argc < 1 && !tree && !nul)
+        usage();
+    if (prune && indexpath == NULL)
+        usage();
+    if (fpmode && (!projection.empty() || summarize))
+        usage();
+    /* Fingerprinting reads whole files, so reading tags ahead is no help. */
+    if (fpmode)
+        depth = 0;
+
+    if (format != TEXT)
+        charset = id3v2::UTF8;
 
-        delete file;
+    /*
+     * Index entries hold the frames as selected and rendered by this run's
+     * options, so entries made under other options must not be used.  Text
+     * output and the other formats render frames in different character
+     * sets.  Fingerprints are kept in a view of their own.
+     */
+    TagIndex index;
+    if (indexpath != NULL) {
+        if (!index.open(indexpath, fpmode ? std::string("fingerprint") :
+            projspec + (summarize ? "s" : "") +
+            (charset == id3v2::UTF8 ? "u" : "")))
+            return (1);
+        tagindex = &index;
     }
+    if (argc < 1 && nul)
+        files.addstdin('\0');
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-") == 0)
+            files.addstdin(nul ? '\0' : '\n');
+        else
+            files.addfile(argv[i]);
+    }
+
+    OutBuf outbuf(STDOUT_FILENO, 256 * 1024);
+    if (njobs > 1 || depth > 0) {
+        dump_parallel(files, njobs, depth, outbuf);
+    } else {
+        std::string path, out, errs;
+        while (files.next(path)) {
+            out.clear();
+            errs.clear();
+            dump_file(path.c_str(), out, errs);
+            outbuf.append(out);
+            std::cerr << errs;
+        }
+    }
+    outbuf.flush();
+
+    if (prune && !index.prune())
+        return (1);
 
     return (0);
 }
@@ -0,0 +1,306 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <err.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tagindex.h"
+
+static const char magic[8] = { 'I', 'D', '3', 'I', 'D', 'X', '0', '3' };
+
+/* Records are padded to keep their headers aligned. */
+size_t
+TagIndex::reclen(const Record &rec)
+{
+
+    return ((sizeof(Record) + (size_t)rec.pathlen + rec.len + 7) &
+        ~(size_t)7);
+}
+
+TagIndex::TagIndex() :
+    fd(-1), map(MAP_FAILED), maplen(0), end(0), view(0)
+{
+}
+
+TagIndex::~TagIndex()
+{
+
+    if (map != MAP_FAILED)
+        (void)munmap(map, maplen);
+    if (fd >= 0)
+        (void)close(fd);
+}
+
+size_t
+TagIndex::KeyHash::operator()(const Key &k) const
+{
+    uint64_t h;
+
+    h = k.ino * 0x9e3779b97f4a7c15ull;
+    h ^= k.dev + (h << 6) + (h >> 2);
+    h ^= k.size + (h << 6) + (h >> 2);
+    h ^= (uint64_t)k.mtime + (h << 6) + (h >> 2);
+    h ^= k.view + (h << 6) + (h >> 2);
+    return (h);
+}
+
+TagIndex::Key
+TagIndex::makekey(const struct stat &sb) const
+{
+    Key k;
+
+    k.dev = sb.st_dev;
+    k.ino = sb.st_ino;
+    k.size = sb.st_size;
+    k.mtime = (int64_t)sb.st_mtim.tv_sec * 1000000000 + sb.st_mtim.tv_nsec;
+    k.view = view;
+    return (k);
+}
+
+/* FNV-1a over the record key and payload, i.e., the path and data. */
+uint32_t
+TagIndex::checksum(const Record &rec, const void *payload)
+{
+    const uint8_t *p;
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    p = reinterpret_cast<const uint8_t *>(&rec.key);
+    for (i = 0; i < sizeof(rec.key); i++)
+        h = (h ^ p[i]) * 16777619u;
+    p = static_cast<const uint8_t *>(payload);
+    for (i = 0; i < (size_t)rec.pathlen + rec.len; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return (h ^ rec.len ^ rec.pathlen);
+}
+
+/*
+ * Discard the contents of the index and start over with an empty one.
+ */
+bool
+TagIndex::reset()
+{
+
+    if (ftruncate(fd, 0) != 0 ||
+        pwrite(fd, magic, sizeof(magic), 0) != (ssize_t)sizeof(magic)) {
+        warn("%s", path.c_str());
+        return (false);
+    }
+    end = sizeof(magic);
+    return (true);
+}
+
+bool
+TagIndex::open(const char *file, const std::string &viewname)
+{
+    struct stat sb;
+    const uint8_t *base;
+    uint64_t off;
+
+    /* FNV-1a. */
+    view = 14695981039346656037ull;
+    for (size_t i = 0; i < viewname.size(); i++)
+        view = (view ^ (uint8_t)viewname[i]) * 1099511628211ull;
+
+    /* Relative paths are recorded relative to this. */
+    char *dir = getcwd(NULL, 0);
+    if (dir == NULL) {
+        warn("getcwd");
+        return (false);
+    }
+    cwd = dir;
+    free(dir);
+
+    path = file;
+    fd = ::open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+        warn("%s", file);
+        return (false);
+    }
+    if (sb.st_size == 0)
+        return (reset());
+
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        warn("mmap(%s)", file);
+        return (false);
+    }
+    maplen = sb.st_size;
+    base = static_cast<const uint8_t *>(map);
+
+    if (maplen < sizeof(magic) || memcmp(base, magic, sizeof(magic)) != 0) {
+        warnx("%s: not a tag index", file);
+        return (false);
+    }
+
+    /* Index the records, stopping at the first torn or corrupt one. */
+    for (off = sizeof(magic); off + sizeof(Record) <= maplen;
+         off += reclen(*(const Record *)(base + off))) {
+        const Record *rec = reinterpret_cast<const Record *>(base + off);
+
+        if (reclen(*rec) > maplen - off ||
+            checksum(*rec, rec + 1) != rec->sum)
+            break;
+        table[rec->key] = off;
+    }
+    if (off != maplen && ftruncate(fd, off) != 0) {
+        warn("%s", file);
+        return (false);
+    }
+    end = off;
+    return (true);
+}
+
+bool
+TagIndex::lookup(const struct stat &sb, const char *&data, size_t &len)
+{
+    const Record *rec;
+
+    auto it = table.find(makekey(sb));
+    if (it == table.end())
+        return (false);
+
+    rec = reinterpret_cast<const Record *>(
+        static_cast<const uint8_t *>(map) + it->second);
+    data = reinterpret_cast<const char *>(rec + 1) + rec->pathlen;
+    len = rec->len;
+    return (true);
+}
+
+bool
+TagIndex::insert(const struct stat &sb, const char *file,
+    const std::string &data)
+{
+    std::string abspath(file[0] == '/' ? file : cwd + "/" + file);
+    Record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.len = data.size();
+    rec.pathlen = abspath.size();
+    rec.key = makekey(sb);
+
+    std::vector<char> buf(reclen(rec));
+    memcpy(&buf[sizeof(rec)], abspath.data(), abspath.size());
+    memcpy(&buf[sizeof(rec) + abspath.size()], data.data(), data.size());
+    rec.sum = checksum(rec, &buf[sizeof(rec)]);
+    memcpy(&buf[0], &rec, sizeof(rec));
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (pwrite(fd, &buf[0], buf.size(), end) != (ssize_t)buf.size()) {
+        warn("%s", path.c_str());
+        return (false);
+    }
+    appended.push_back(end);
+    end += buf.size();
+    return (true);
+}
+
+/*
+ * Rewrite the index with the newest record for each key whose path still
+ * names the file the record was made for, unchanged.  Each distinct path is
+ * stat(2)ed once.
+ */
+bool
+TagIndex::prune()
+{
+    std::string tmp(path + ".XXXXXX");
+    std::unordered_map<std::string, Key> seen;
+    std::vector<uint64_t> keep;
+    const uint8_t *base;
+    struct stat sb;
+    void *cur;
+    int tmpfd;
+    bool ok;
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    cur = mmap(NULL, end, PROT_READ, MAP_SHARED, fd, 0);
+    if (cur == MAP_FAILED) {
+        warn("mmap(%s)", path.c_str());
+        return (false);
+    }
+    base = static_cast<const uint8_t *>(cur);
+
+    /* Records appended during this run supersede those read at open. */
+    std::unordered_map<Key, uint64_t, KeyHash> latest(table);
+    for (auto off : appended)
+        latest[reinterpret_cast<const Record *>(base + off)->key] = off;
+
+    for (const auto &e : latest) {
+        const Record *rec = reinterpret_cast<const Record *>(base + e.second);
+        std::string file(reinterpret_cast<const char *>(rec + 1),
+            rec->pathlen);
+
+        auto it = seen.find(file);
+        if (it == seen.end()) {
+            Key k;
+
+            if (stat(file.c_str(), &sb) == 0 && S_ISREG(sb.st_mode))
+                k = makekey(sb);
+            else
+                memset(&k, 0, sizeof(k));
+            it = seen.emplace(file, k).first;
+        }
+        if (it->second.samefile(rec->key))
+            keep.push_back(e.second);
+    }
+    std::sort(keep.begin(), keep.end());
+
+    tmpfd = mkstemp(&tmp[0]);
+    if (tmpfd < 0) {
+        warn("mkstemp(%s)", tmp.c_str());
+        (void)munmap(cur, end);
+        return (false);
+    }
+
+    ok = write(tmpfd, magic, sizeof(magic)) == (ssize_t)sizeof(magic);
+    for (size_t i = 0; ok && i < keep.size(); i++) {
+        const Record *rec = reinterpret_cast<const Record *>(base + keep[i]);
+        size_t len = reclen(*rec);
+
+        ok = write(tmpfd, rec, len) == (ssize_t)len;
+    }
+    ok = ok && fchmod(tmpfd, 0644) == 0 && fsync(tmpfd) == 0;
+    if (ok && rename(tmp.c_str(), path.c_str()) != 0)
+        ok = false;
+    if (!ok) {
+        warn("%s", tmp.c_str());
+        (void)unlink(tmp.c_str());
+    }
+    (void)close(tmpfd);
+    (void)munmap(cur, end);
+    return (ok);
+}
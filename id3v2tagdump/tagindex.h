@@ -0,0 +1,117 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _TAGINDEX_H_
+#define _TAGINDEX_H_
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * A persistent cache of per-file results, keyed by the identity and version of
+ * the file: its device, inode, size and modification time, plus a "view"
+ * which identifies the options the result was computed under.  The index is an
+ * append-only log of checksummed records following a short header.  It is
+ * mapped and scanned once when opened, later records superseding earlier ones,
+ * and a torn record at the tail is truncated away.  A file that is neither
+ * empty nor an index is left alone and refused.  New results are appended as
+ * they're produced.  Each record also holds the absolute path the file was
+ * found under, and prune() rewrites the index, via a temporary file and
+ * rename(2), without the records whose path no longer names the same, unchanged
+ * file.  Records of every view are kept, whether or not this run used them.
+ *
+ * lookup() and insert() may be called concurrently.
+ */
+class TagIndex {
+public:
+    TagIndex();
+    ~TagIndex();
+
+    bool open(const char *path, const std::string &view);
+    bool lookup(const struct stat &sb, const char *&data, size_t &len);
+    bool insert(const struct stat &sb, const char *file,
+        const std::string &data);
+    bool prune();
+
+private:
+    TagIndex(const TagIndex &);
+    TagIndex &operator=(const TagIndex &);
+
+    struct Key {
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t size;
+        int64_t mtime;
+        uint64_t view;
+
+        bool samefile(const Key &k) const {
+            return (dev == k.dev && ino == k.ino && size == k.size &&
+                mtime == k.mtime);
+        }
+        bool operator==(const Key &k) const {
+            return (samefile(k) && view == k.view);
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &k) const;
+    };
+
+    /* A record is followed by its path and then its data. */
+    struct Record {
+        uint32_t len;
+        uint32_t sum;
+        Key key;
+        uint32_t pathlen;
+        uint32_t pad;
+    };
+
+    static size_t reclen(const Record &rec);
+    Key makekey(const struct stat &sb) const;
+    static uint32_t checksum(const Record &rec, const void *payload);
+    bool reset();
+
+    std::string path;
+    std::string cwd;
+    int fd;
+    void *map;
+    size_t maplen;
+    uint64_t end;
+    uint64_t view;
+    std::unordered_map<Key, uint64_t, KeyHash> table;
+
+    std::mutex lock;
+    std::vector<uint64_t> appended;
+};
+
+#endif /* !_TAGINDEX_H_ */
@@ -24,22 +24,296 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/types.h>
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
+
+#include <unistd.h>
 
+#include <taglib/id3v2frame.h>
+#include <taglib/id3v2header.h>
 #include <taglib/id3v2tag.h>
 #include <taglib/mpegfile.h>
 
+#include "frameset.h"
+#include "id3v2.h"
+#include "ioengine.h"
+#include "pathsource.h"
+#include "rewrite.h"
+
 static std::string progname;
 
 void
 usage()
 {
-    std::cout << "Usage: " << progname << " <TAG> file1 [file2 [ ... ]]" << std::endl;
+    std::cout << "Usage: " << progname << " [-0] [-c [-b batch]] [-q depth] [-r dir] <TAG> [file1 [file2 [ ... ]]]" << std::endl;
+    std::cout << "       " << progname << " [-0] [-c [-b batch]] [-q depth] [-r dir] -t <TAG>[:<DESC>][,...] [file1 [file2 [ ... ]]]" << std::endl;
     exit(1);
 }
 
+/*
+ * Use the fast tag reader to decide whether a file might contain a frame
+ * we're removing.  Files without a tag or without a matching frame are left
+ * alone, so TagLib never has to scan them.  If the I/O engine has already
+ * read the tag, it is parsed from the engine's buffer.
+ */
+static bool
+has_match(const char *path, const id3v2::FrameSet &set,
+    const id3v2::IoEngine::Request *pre = NULL)
+{
+    id3v2::Tag id3;
+
+    /* Let the strip routines report the error. */
+    if (pre != NULL && pre->error != 0)
+        return (true);
+
+    switch (pre != NULL ? id3.parse(pre->buf.data(), pre->buf.size()) :
+        id3.open(path)) {
+    case id3v2::NOTAG:
+        return (false);
+    case id3v2::OK:
+        for (const auto &f : id3.frames())
+            if (set.match(f))
+                return (true);
+        return (false);
+    default:
+        return (true);
+    }
+}
+
+/*
+ * Render frames as a v2.4 tag with no padding.  Frames are rendered as
+ * ID3v2::Tag::render() renders them, but Tag::render() also pads the new tag
+ * out to the size of the old one, which would leave nothing to compact.
+ * Returns an empty ByteVector if no frames remain, in which case the tag is
+ * dropped altogether.
+ */
+static TagLib::ByteVector
+render_frames(const std::vector<TagLib::ID3v2::Frame *> &frames)
+{
+    TagLib::ByteVector body, data;
+
+    for (auto *frame : frames) {
+        TagLib::ID3v2::Frame::Header *header = frame->header();
+
+        header->setVersion(4);
+        if (header->frameID().size() != 4 || header->tagAlterPreservation())
+            continue;
+        data = frame->render();
+        if (data.size() == TagLib::ID3v2::Frame::headerSize(4))
+            continue;
+        body.append(data);
+    }
+    if (body.isEmpty())
+        return (body);
+
+    TagLib::ID3v2::Header header;
+    header.setMajorVersion(4);
+    header.setTagSize(body.size());
+    data = header.render();
+    data.append(body);
+    return (data);
+}
+
+/*
+ * Remove matching frames with TagLib and rewrite the file, which compacts it.
+ * The surviving frames are collected in a single pass over the frame list and
+ * rendered into a new tag; removing the victims from TagLib's tag one by one
+ * would search its frame list and map for each of them.  Rather than letting
+ * TagLib save the file in place, where a crash would leave it truncated or
+ * mangled, the new tag is handed to the rewriter along with the offset of the
+ * audio data following the old tag.  That offset assumes that the tag starts
+ * the file, so files where TagLib found it elsewhere are skipped.  Returns
+ * false if the file has matching frames that couldn't be removed.
+ */
+static bool
+strip_compact(const char *path, const id3v2::FrameSet &set, Rewriter &rw)
+{
+    std::vector<TagLib::ID3v2::Frame *> keep;
+    bool matched = false;
+
+    TagLib::MPEG::File file(path, false);
+    if (!file.isValid()) {
+        std::cerr << progname << ": skipping " << path << std::endl;
+        return (false);
+    }
+
+    TagLib::ID3v2::Tag *tag = file.ID3v2Tag();
+    const TagLib::ID3v2::FrameList &frames(tag->frameList());
+    for (TagLib::ID3v2::FrameList::ConstIterator i = frames.begin();
+         i != frames.end(); ++i) {
+        if (set.match(**i))
+            matched = true;
+        else
+            keep.push_back(*i);
+    }
+    if (!matched)
+        return (true);
+
+    file.seek(0);
+    if (file.readBlock(3) != "ID3") {
+        std::cerr << progname << ": skipping " << path <<
+            ", whose tag does not start the file" << std::endl;
+        return (false);
+    }
+    off_t bodyoff = tag->header()->completeTagSize();
+    TagLib::ByteVector data(render_frames(keep));
+    return (rw.rewrite(path, data.data(), data.size(), bodyoff));
+}
+
+/*
+ * Remove matching frames by rewriting the tag within its existing extent.
+ * The frames following the first removed frame are moved down and the space
+ * they vacate becomes padding, so only the tag is written and the audio data
+ * is never touched.  Returns false if the file has matching frames that
+ * couldn't be removed.
+ */
+static bool
+strip_inplace(const char *path, const id3v2::FrameSet &set)
+{
+    id3v2::Tag id3;
+    std::vector<uint8_t> buf;
+    size_t start, i;
+    ssize_t n;
+
+    switch (id3.open(path, true)) {
+    case id3v2::NOTAG:
+        return (true);
+    case id3v2::OK:
+        break;
+    case id3v2::REJECT:
+        std::cerr << progname << ": cannot strip " << path <<
+            " in place, use -c" << std::endl;
+        return (false);
+    case id3v2::FAIL:
+        std::cerr << progname << ": " << path << ": " << strerror(errno) << std::endl;
+        return (false);
+    }
+
+    const std::vector<id3v2::Frame> &frames(id3.frames());
+    std::vector<bool> victim(frames.size());
+    for (i = 0; i < frames.size(); i++)
+        victim[i] = set.match(frames[i]);
+    for (i = 0; i < frames.size(); i++)
+        if (victim[i])
+            break;
+    if (i == frames.size())
+        return (true);
+
+    /*
+     * An unsynchronised v2.3 tag has to be re-encoded as a whole, and v2.3
+     * extended headers record the padding size and may carry a CRC.  A v2.4
+     * tag with a footer may not have padding at all.
+     */
+    if (id3.unsynchronised() || id3.extheader() || id3.footer()) {
+        std::cerr << progname << ": cannot strip " << path <<
+            " in place, use -c" << std::endl;
+        return (false);
+    }
+
+    start = frames[i].offset;
+    for (; i < frames.size(); i++) {
+        const id3v2::Frame &f(frames[i]);
+
+        if (!victim[i])
+            buf.insert(buf.end(), id3.raw() + f.offset,
+                id3.raw() + f.offset + f.extent);
+    }
+    buf.resize(id3.framesend() - start, 0);
+
+    n = pwrite(id3.descriptor(), buf.data(), buf.size(), start);
+    if (n < 0) {
+        std::cerr << progname << ": " << path << ": " << strerror(errno) << std::endl;
+        return (false);
+    }
+    if ((size_t)n != buf.size()) {
+        std::cerr << progname << ": " << path << ": short write" << std::endl;
+        return (false);
+    }
+    return (true);
+}
+
+static bool
+strip_file(const char *path, const id3v2::FrameSet &set, bool compact,
+    Rewriter &rw, const id3v2::IoEngine::Request *pre = NULL)
+{
+
+    if (compact) {
+        if (has_match(path, set, pre))
+            return (strip_compact(path, set, rw));
+    } else if (pre == NULL || has_match(path, set, pre)) {
+        return (strip_inplace(path, set));
+    }
+    return (true);
+}
+
+/*
+ * Read files' tags ahead with the I/O engine, keeping up to "depth" reads in
+ * flight, and strip files in the order their reads complete.  Most files in a
+ * typical run have nothing to strip, and those are dismissed from the engine's
+ * buffer without being opened again.  Returns false if any file failed.
+ */
+static bool
+strip_prefetched(id3v2::PathSource &files, const id3v2::FrameSet &set,
+    bool compact, Rewriter &rw, unsigned depth)
+{
+    std::vector<id3v2::IoEngine::Request> reqs(depth);
+    std::vector<std::string> paths(depth);
+    std::vector<size_t> idle;
+    std::deque<size_t> completed;
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t inflight = 0, i;
+    bool more = true, ok = true;
+
+    for (i = depth; i > 0; i--)
+        idle.push_back(i - 1);
+
+    std::unique_ptr<id3v2::IoEngine> io(id3v2::IoEngine::create(depth,
+        [&](id3v2::IoEngine::Request *req) {
+            std::lock_guard<std::mutex> guard(lock);
+            completed.push_back(req->seq);
+            cv.notify_one();
+        }));
+
+    for (;;) {
+        while (more && !idle.empty()) {
+            i = idle.back();
+            if (!(more = files.next(paths[i])))
+                break;
+            idle.pop_back();
+            reqs[i].path = paths[i].c_str();
+            reqs[i].seq = i;
+            io->submit(&reqs[i]);
+            inflight++;
+        }
+        if (inflight == 0)
+            break;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [&completed] { return (!completed.empty()); });
+            i = completed.front();
+            completed.pop_front();
+        }
+        inflight--;
+        if (!strip_file(paths[i].c_str(), set, compact, rw, &reqs[i]))
+            ok = false;
+        idle.push_back(i);
+    }
+    return (ok);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -47,24 +321,75 @@ main(int argc, char **argv)
     auto last = argv0.find_last_of("/");
     progname = argv0.substr(last == std::string::npos ? 0 : last + 1);
 
-    if (argc < 3)
-        usage();
-
-    const char *tag = argv[1];
-    for (int i = 2; argv[i] != NULL; i++) {
-        auto *file = new TagLib::MPEG::File(argv[i], false);
-        if (file == NULL || !file->isValid()) {
-            std::cerr << progname << ": skipping " << argv[i] << std::endl;
-            continue;
+    id3v2::PathSource files;
+    id3v2::FrameSet set;
+    unsigned long batch = 64, depth = 0;
+    bool compact = false, nul = false, ok = true, tree = false;
+    char *endptr;
+    int ch;
+    while ((ch = getopt(argc, argv, "0b:cq:r:t:")) != -1) {
+        switch (ch) {
+        case '0':
+            nul = true;
+            break;
+        case 'b':
+            batch = strtoul(optarg, &endptr, 10);
+            if (optarg[0] == '\0' || *endptr != '\0' || batch == 0 ||
+                batch > 4096)
+                usage();
+            break;
+        case 'c':
+            compact = true;
+            break;
+        case 'q':
+            depth = strtoul(optarg, &endptr, 10);
+            if (optarg[0] == '\0' || *endptr != '\0' || depth > 4096)
+                usage();
+            break;
+        case 'r':
+            files.addtree(optarg);
+            tree = true;
+            break;
+        case 't':
+            if (!set.add(optarg))
+                usage();
+            break;
+        default:
+            usage();
         }
+    }
+    argc -= optind;
+    argv += optind;
 
-        while (!file->ID3v2Tag()->frameListMap()[tag].isEmpty())
-            file->ID3v2Tag()->removeFrame(file->ID3v2Tag()->frameListMap()[tag].front());
-
-        file->save();
+    if (set.empty()) {
+        if (argc < 1 || !set.add(argv[0]))
+            usage();
+        argc--;
+        argv++;
+    }
+    if (argc < 1 && !tree && !nul)
+        usage();
+    if (argc < 1 && nul)
+        files.addstdin('\0');
+    for (int i = 0; argv[i] != NULL; i++) {
+        if (strcmp(argv[i], "-") == 0)
+            files.addstdin(nul ? '\0' : '\n');
+        else
+            files.addfile(argv[i]);
+    }
 
-        delete file;
+    /* Each pending file holds a descriptor until its batch is committed. */
+    Rewriter rw(batch);
+    if (depth > 0) {
+        ok = strip_prefetched(files, set, compact, rw, depth);
+    } else {
+        std::string path;
+        while (files.next(path))
+            if (!strip_file(path.c_str(), set, compact, rw))
+                ok = false;
     }
 
-    return (0);
+    if (!rw.commit())
+        ok = false;
+    return (ok ? 0 : 1);
 }
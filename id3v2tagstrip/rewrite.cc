@@ -0,0 +1,208 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <set>
+#include <vector>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rewrite.h"
+
+static std::string
+dirof(const std::string &path)
+{
+    auto slash = path.find_last_of('/');
+
+    if (slash == std::string::npos)
+        return (".");
+    if (slash == 0)
+        return ("/");
+    return (path.substr(0, slash));
+}
+
+Rewriter::Rewriter(size_t batch_) :
+    batch(batch_ == 0 ? 1 : batch_)
+{
+}
+
+Rewriter::~Rewriter()
+{
+
+    (void)commit();
+}
+
+/*
+ * Copy the body of the file, falling back to read(2) and write(2) if the
+ * kernel or file system can't copy between the two files directly.
+ */
+bool
+Rewriter::copy(int from, off_t off, off_t len, int to)
+{
+    std::vector<char> buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = copy_file_range(from, &off, to, NULL, len, 0);
+        if (n < 0 && (errno == EXDEV || errno == EINVAL ||
+            errno == ENOSYS || errno == EOPNOTSUPP))
+            break;
+        if (n < 0)
+            return (false);
+        if (n == 0) {
+            errno = EIO;
+            return (false);
+        }
+        len -= n;
+    }
+
+    if (len > 0)
+        buf.resize(1024 * 1024);
+    while (len > 0) {
+        n = pread(from, buf.data(), std::min((off_t)buf.size(), len), off);
+        if (n <= 0) {
+            if (n == 0)
+                errno = EIO;
+            return (false);
+        }
+        for (ssize_t done = 0, w; done < n; done += w)
+            if ((w = write(to, buf.data() + done, n - done)) < 0)
+                return (false);
+        off += n;
+        len -= n;
+    }
+    return (true);
+}
+
+bool
+Rewriter::rewrite(const char *path, const void *tag, size_t taglen,
+    off_t bodyoff)
+{
+    const char *p = static_cast<const char *>(tag);
+    struct stat sb;
+    Pending job;
+    ssize_t n;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &sb) != 0) {
+        warn("%s", path);
+        if (fd >= 0)
+            (void)close(fd);
+        return (false);
+    }
+    /* Renaming over the file would break the other links to it. */
+    if (sb.st_nlink > 1 || bodyoff > sb.st_size) {
+        warnx("%s: cannot be rewritten safely", path);
+        (void)close(fd);
+        return (false);
+    }
+
+    job.path = path;
+    auto slash = job.path.find_last_of('/');
+    job.tmp = slash == std::string::npos ? std::string() :
+        job.path.substr(0, slash + 1);
+    job.tmp += "." + job.path.substr(slash + 1) + ".XXXXXX";
+    if ((job.fd = mkstemp(&job.tmp[0])) < 0) {
+        warn("%s", job.tmp.c_str());
+        (void)close(fd);
+        return (false);
+    }
+
+    for (size_t done = 0; done < taglen; done += n)
+        if ((n = write(job.fd, p + done, taglen - done)) < 0)
+            goto fail;
+    if (!copy(fd, bodyoff, sb.st_size - bodyoff, job.fd))
+        goto fail;
+    if (fchmod(job.fd, sb.st_mode & ALLPERMS) != 0)
+        goto fail;
+    (void)fchown(job.fd, sb.st_uid, sb.st_gid);
+    (void)close(fd);
+
+    pending.push_back(job);
+    if (pending.size() >= batch)
+        return (commit());
+    return (true);
+
+fail:
+    warn("%s", job.tmp.c_str());
+    (void)unlink(job.tmp.c_str());
+    (void)close(job.fd);
+    (void)close(fd);
+    return (false);
+}
+
+/*
+ * Make the pending files durable and move them into place.  A file is renamed
+ * only after its own data has been synced, so a crash at any point leaves
+ * either the old or the new contents under the original name.
+ */
+bool
+Rewriter::commit()
+{
+    std::set<std::string> dirs;
+    bool ok = true;
+    int fd;
+
+    for (auto &job : pending) {
+        if (fsync(job.fd) != 0) {
+            warn("%s", job.tmp.c_str());
+            (void)unlink(job.tmp.c_str());
+            job.tmp.clear();
+            ok = false;
+        }
+        (void)close(job.fd);
+    }
+    for (const auto &job : pending) {
+        if (job.tmp.empty())
+            continue;
+        if (rename(job.tmp.c_str(), job.path.c_str()) != 0) {
+            warn("%s", job.path.c_str());
+            (void)unlink(job.tmp.c_str());
+            ok = false;
+            continue;
+        }
+        dirs.insert(dirof(job.path));
+    }
+    pending.clear();
+
+    for (const auto &dir : dirs) {
+        if ((fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0 ||
+            fsync(fd) != 0) {
+            warn("%s", dir.c_str());
+            ok = false;
+        }
+        if (fd >= 0)
+            (void)close(fd);
+    }
+    return (ok);
+}
@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _REWRITE_H_
+#define _REWRITE_H_
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Replace files without ever exposing a partially written copy.  The new
+ * contents are written to a temporary file in the same directory, and the
+ * temporary file is renamed over the original once its data is on stable
+ * storage.  fsyncs are deferred and issued for a batch of files at a time,
+ * followed by one fsync of each directory containing a renamed file.
+ */
+class Rewriter {
+public:
+    explicit Rewriter(size_t batch);
+    ~Rewriter();
+
+    /*
+     * Replace everything in the file before offset "bodyoff" with the given
+     * tag.  The rest of the file is copied with copy_file_range(2), so file
+     * systems which support it may share the blocks rather than copy them.
+     * The replacement takes effect at the next commit.
+     */
+    bool rewrite(const char *path, const void *tag, size_t taglen,
+        off_t bodyoff);
+    bool commit();
+
+private:
+    struct Pending {
+        std::string path;
+        std::string tmp;
+        int fd;
+    };
+
+    bool copy(int from, off_t off, off_t len, int to);
+
+    std::vector<Pending> pending;
+    size_t batch;
+};
+
+#endif /* !_REWRITE_H_ */
@@ -0,0 +1,481 @@
+/*-
+ * Copyright (c) 2013 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+
+#include <string.h>
+
+#include "dof.h"
+
+/*
+ * Validate the DOF header and the section header table.  Returns NULL on
+ * success and a description of the problem otherwise.
+ */
+const char *
+dof_view_init(struct dof_view *dv, const void *buf, size_t size)
+{
+	const struct dof_hdr *hdr;
+
+	hdr = buf;
+	if (size < sizeof(*hdr))
+		return ("data buffer is smaller than DOF header");
+	if (memcmp(hdr->dofh_ident, "\177DOF", 4) != 0)
+		return ("DOF header is invalid or corrupt");
+	if (hdr->dofh_ident[5] != DOF_ENCODE_NATIVE)
+		return ("DOF encoding does not match the host byte order");
+	if (hdr->dofh_hdrsize < sizeof(*hdr) ||
+	    hdr->dofh_secsize < sizeof(struct dof_sec))
+		return ("DOF header or section header size is too small");
+	if (hdr->dofh_secsize % _Alignof(struct dof_sec) != 0)
+		return ("DOF section header size is misaligned");
+	if (hdr->dofh_loadsz > hdr->dofh_filesz || hdr->dofh_filesz > size)
+		return ("DOF size exceeds the section size");
+	if (hdr->dofh_secoff < hdr->dofh_hdrsize ||
+	    hdr->dofh_secoff > hdr->dofh_loadsz ||
+	    hdr->dofh_secoff % sizeof(uint64_t) != 0 ||
+	    (uint64_t)hdr->dofh_secnum * hdr->dofh_secsize >
+	    hdr->dofh_loadsz - hdr->dofh_secoff)
+		return ("DOF section headers lie outside the loadable data");
+
+	dv->dv_base = buf;
+	dv->dv_hdr = hdr;
+	dv->dv_loadsz = hdr->dofh_loadsz;
+	dv->dv_filesz = hdr->dofh_filesz;
+	return (NULL);
+}
+
+/*
+ * The alignment that the contents of each type of section need in order to be
+ * accessed in place.  Sections and table entries that don't honour it are
+ * rejected, whatever alignment they claim.
+ */
+static const uint8_t secalign[] = {
+	[DOF_SECT_ECBDESC] = _Alignof(struct dof_ecbdesc),
+	[DOF_SECT_PROBEDESC] = _Alignof(struct dof_probedesc),
+	[DOF_SECT_ACTDESC] = _Alignof(struct dof_actdesc),
+	[DOF_SECT_DIFOHDR] = _Alignof(struct dof_difohdr),
+	[DOF_SECT_DIF] = sizeof(uint32_t),
+	[DOF_SECT_VARTAB] = _Alignof(struct dtrace_difv),
+	[DOF_SECT_RELTAB] = _Alignof(struct dof_relodesc),
+	[DOF_SECT_TYPTAB] = _Alignof(struct dtrace_diftype),
+	[DOF_SECT_URELHDR] = _Alignof(struct dof_relohdr),
+	[DOF_SECT_KRELHDR] = _Alignof(struct dof_relohdr),
+	[DOF_SECT_OPTDESC] = _Alignof(struct dof_optdesc),
+	[DOF_SECT_PROVIDER] = _Alignof(struct dof_provider),
+	[DOF_SECT_PROBES] = _Alignof(struct dof_probe),
+	[DOF_SECT_PROFFS] = sizeof(uint32_t),
+	[DOF_SECT_INTTAB] = sizeof(uint64_t),
+	[DOF_SECT_XLTAB] = _Alignof(struct dof_xlref),
+	[DOF_SECT_XLMEMBERS] = _Alignof(struct dof_xlmember),
+	[DOF_SECT_XLIMPORT] = _Alignof(struct dof_xlator),
+	[DOF_SECT_XLEXPORT] = _Alignof(struct dof_xlator),
+	[DOF_SECT_PRENOFFS] = sizeof(uint32_t),
+};
+
+/*
+ * Look up a section and validate its extent and alignment.  A type of
+ * DOF_SECT_NONE matches any section.
+ */
+int
+dof_section(const struct dof_view *dv, uint32_t idx, uint32_t type,
+    struct dof_secview *ds)
+{
+	const struct dof_sec *sec;
+	uint64_t limit;
+	uint32_t align;
+
+	if (idx >= dv->dv_hdr->dofh_secnum)
+		return (-1);
+	sec = (const struct dof_sec *)(dv->dv_base + dv->dv_hdr->dofh_secoff +
+	    (uint64_t)idx * dv->dv_hdr->dofh_secsize);
+	if (type != DOF_SECT_NONE && sec->dofs_type != type)
+		return (-1);
+
+	limit = (sec->dofs_flags & DOF_SECF_LOAD) != 0 ? dv->dv_loadsz :
+	    dv->dv_filesz;
+	if (sec->dofs_offset > limit || sec->dofs_size > limit - sec->dofs_offset)
+		return (-1);
+	if (sec->dofs_align != 0 &&
+	    ((sec->dofs_align & (sec->dofs_align - 1)) != 0 ||
+	    sec->dofs_offset % sec->dofs_align != 0))
+		return (-1);
+	align = sec->dofs_type < sizeof(secalign) ? secalign[sec->dofs_type] :
+	    0;
+	if (align > 1 && (sec->dofs_offset % align != 0 ||
+	    sec->dofs_entsize % align != 0))
+		return (-1);
+
+	ds->ds_sec = sec;
+	ds->ds_data = dv->dv_base + sec->dofs_offset;
+	ds->ds_size = sec->dofs_size;
+	ds->ds_nent = sec->dofs_entsize != 0 ?
+	    sec->dofs_size / sec->dofs_entsize : 0;
+	return (0);
+}
+
+/*
+ * Return the i'th entry of a table section, provided that entries are at
+ * least "minsize" bytes long.
+ */
+const void *
+dof_entry(const struct dof_secview *ds, uint64_t i, size_t minsize)
+{
+
+	if (ds->ds_sec->dofs_entsize < minsize || i >= ds->ds_nent)
+		return (NULL);
+	return (ds->ds_data + i * ds->ds_sec->dofs_entsize);
+}
+
+/* Return a section holding a single structure of at least "size" bytes. */
+const void *
+dof_struct(const struct dof_secview *ds, size_t size)
+{
+
+	return (ds->ds_size >= size ? ds->ds_data : NULL);
+}
+
+/* Return a run of n elements starting at element idx of an array section. */
+const void *
+dof_array(const struct dof_secview *ds, uint64_t idx, uint64_t n,
+    size_t elsize)
+{
+
+	if (idx > ds->ds_size / elsize || n > ds->ds_size / elsize - idx)
+		return (NULL);
+	return (ds->ds_data + idx * elsize);
+}
+
+/* Return a string from a string table, which must be NUL-terminated. */
+const char *
+dof_string(const struct dof_secview *strtab, uint64_t off)
+{
+	const char *s;
+
+	if (strtab->ds_sec->dofs_type != DOF_SECT_STRTAB ||
+	    off >= strtab->ds_size)
+		return (NULL);
+	s = (const char *)strtab->ds_data + off;
+	if (memchr(s, '\0', strtab->ds_size - off) == NULL)
+		return (NULL);
+	return (s);
+}
+
+/* Count the probes declared by the providers in a DOF object. */
+uint64_t
+dof_count_probes(const struct dof_view *dv)
+{
+	struct dof_secview ds, probes;
+	const struct dof_provider *pv;
+	uint64_t n;
+	uint32_t i;
+
+	n = 0;
+	for (i = 0; i < dv->dv_hdr->dofh_secnum; i++) {
+		if (dof_section(dv, i, DOF_SECT_PROVIDER, &ds) != 0 ||
+		    (pv = dof_struct(&ds,
+		    offsetof(struct dof_provider, dofpv_prenoffs))) == NULL)
+			continue;
+		if (dof_section(dv, pv->dofpv_probes, DOF_SECT_PROBES,
+		    &probes) == 0 && probes.ds_sec->dofs_entsize >=
+		    offsetof(struct dof_probe, dofpr_enoffidx))
+			n += probes.ds_nent;
+	}
+	return (n);
+}
+
+/*
+ * Full validation.  dof_parse() follows every reference that the sections of
+ * a DOF object make, to other sections, to table entries, to strings and to
+ * offset arrays, exactly as a consumer decoding the whole object would, and
+ * counts what it finds.  It is the entry point for fuzzing the accessors above
+ * and the unit of work for measuring their speed.
+ */
+
+static void
+parse_string(const struct dof_secview *strtab, uint64_t off,
+    struct dof_stats *st)
+{
+
+	if (dof_string(strtab, off) != NULL)
+		st->dst_strings++;
+	else
+		st->dst_invalid++;
+}
+
+static void
+parse_strlist(const struct dof_secview *strtab, uint64_t off, unsigned n,
+    struct dof_stats *st)
+{
+	const char *s;
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		if ((s = dof_string(strtab, off)) == NULL) {
+			st->dst_invalid++;
+			return;
+		}
+		st->dst_strings++;
+		off += strlen(s) + 1;
+	}
+}
+
+static void
+parse_array(const struct dof_view *dv, uint32_t sec, uint32_t type,
+    uint64_t idx, uint64_t n, size_t elsize, struct dof_stats *st)
+{
+	struct dof_secview ds;
+
+	if (n > 0 && (dof_section(dv, sec, type, &ds) != 0 ||
+	    dof_array(&ds, idx, n, elsize) == NULL))
+		st->dst_invalid++;
+}
+
+static void
+parse_secref(const struct dof_view *dv, dof_secidx_t idx,
+    struct dof_stats *st)
+{
+	struct dof_secview ds;
+
+	if (idx != DOF_SECIDX_NONE &&
+	    dof_section(dv, idx, DOF_SECT_NONE, &ds) != 0)
+		st->dst_invalid++;
+}
+
+static void
+parse_provider(const struct dof_view *dv, const struct dof_secview *ds,
+    struct dof_stats *st)
+{
+	struct dof_secview strtab, probes;
+	const struct dof_provider *pv;
+	const struct dof_probe *pr;
+	uint32_t prenoffs;
+	uint64_t i;
+	bool enoffs;
+
+	if ((pv = dof_struct(ds,
+	    offsetof(struct dof_provider, dofpv_prenoffs))) == NULL ||
+	    dof_section(dv, pv->dofpv_strtab, DOF_SECT_STRTAB, &strtab) != 0 ||
+	    dof_section(dv, pv->dofpv_probes, DOF_SECT_PROBES, &probes) != 0) {
+		st->dst_invalid++;
+		return;
+	}
+	st->dst_providers++;
+	parse_string(&strtab, pv->dofpv_name, st);
+
+	/* Version 1 providers and probes lack the is-enabled offsets. */
+	prenoffs = ds->ds_size >= sizeof(*pv) ? pv->dofpv_prenoffs :
+	    DOF_SECIDX_NONE;
+	enoffs = probes.ds_sec->dofs_entsize >= sizeof(struct dof_probe);
+	for (i = 0; i < probes.ds_nent; i++) {
+		if ((pr = dof_entry(&probes, i,
+		    offsetof(struct dof_probe, dofpr_enoffidx))) == NULL) {
+			st->dst_invalid++;
+			return;
+		}
+		st->dst_probes++;
+		parse_string(&strtab, pr->dofpr_func, st);
+		parse_string(&strtab, pr->dofpr_name, st);
+		parse_strlist(&strtab, pr->dofpr_nargv, pr->dofpr_nargc, st);
+		parse_strlist(&strtab, pr->dofpr_xargv, pr->dofpr_xargc, st);
+		parse_array(dv, pv->dofpv_prargs, DOF_SECT_PRARGS,
+		    pr->dofpr_argidx, pr->dofpr_xargc, sizeof(uint8_t), st);
+		parse_array(dv, pv->dofpv_proffs, DOF_SECT_PROFFS,
+		    pr->dofpr_offidx, pr->dofpr_noffs, sizeof(uint32_t), st);
+		if (enoffs && prenoffs != DOF_SECIDX_NONE)
+			parse_array(dv, prenoffs, DOF_SECT_PRENOFFS,
+			    pr->dofpr_enoffidx, pr->dofpr_nenoffs,
+			    sizeof(uint32_t), st);
+	}
+}
+
+static void
+parse_relocs(const struct dof_view *dv, const struct dof_secview *ds,
+    struct dof_stats *st)
+{
+	struct dof_secview strtab, relsec;
+	const struct dof_relohdr *rh;
+	const struct dof_relodesc *r;
+	uint64_t i;
+
+	if ((rh = dof_struct(ds, sizeof(*rh))) == NULL ||
+	    dof_section(dv, rh->dofr_strtab, DOF_SECT_STRTAB, &strtab) != 0 ||
+	    dof_section(dv, rh->dofr_relsec, DOF_SECT_RELTAB, &relsec) != 0) {
+		st->dst_invalid++;
+		return;
+	}
+	parse_secref(dv, rh->dofr_tgtsec, st);
+	for (i = 0; i < relsec.ds_nent; i++) {
+		if ((r = dof_entry(&relsec, i, sizeof(*r))) == NULL) {
+			st->dst_invalid++;
+			return;
+		}
+		parse_string(&strtab, r->dofr_name, st);
+	}
+}
+
+static void
+parse_probedesc(const struct dof_view *dv, const struct dof_secview *ds,
+    struct dof_stats *st)
+{
+	struct dof_secview strtab;
+	const struct dof_probedesc *pd;
+
+	if ((pd = dof_struct(ds, sizeof(*pd))) == NULL ||
+	    dof_section(dv, pd->dofp_strtab, DOF_SECT_STRTAB, &strtab) != 0) {
+		st->dst_invalid++;
+		return;
+	}
+	parse_string(&strtab, pd->dofp_provider, st);
+	parse_string(&strtab, pd->dofp_mod, st);
+	parse_string(&strtab, pd->dofp_func, st);
+	parse_string(&strtab, pd->dofp_name, st);
+}
+
+/* Check that a table section holds entries of at least "size" bytes. */
+static const void *
+parse_table(const struct dof_secview *ds, size_t size, struct dof_stats *st)
+{
+	const void *p;
+	uint64_t i;
+
+	p = NULL;
+	for (i = 0; i < ds->ds_nent; i++) {
+		if ((p = dof_entry(ds, i, size)) == NULL) {
+			st->dst_invalid++;
+			break;
+		}
+	}
+	return (p);
+}
+
+static void
+parse_section(const struct dof_view *dv, const struct dof_secview *ds,
+    struct dof_stats *st)
+{
+	const struct dof_ecbdesc *ecb;
+	const struct dof_actdesc *ad;
+	const struct dof_difohdr *dh;
+	const struct dof_xlator *xl;
+	const struct dof_xlmember *xm;
+	uint64_t i, n;
+
+	switch (ds->ds_sec->dofs_type) {
+	case DOF_SECT_PROVIDER:
+		parse_provider(dv, ds, st);
+		break;
+	case DOF_SECT_URELHDR:
+	case DOF_SECT_KRELHDR:
+		parse_relocs(dv, ds, st);
+		break;
+	case DOF_SECT_PROBEDESC:
+		parse_probedesc(dv, ds, st);
+		break;
+	case DOF_SECT_ECBDESC:
+		if ((ecb = dof_struct(ds, sizeof(*ecb))) == NULL) {
+			st->dst_invalid++;
+			break;
+		}
+		parse_secref(dv, ecb->dofe_probes, st);
+		parse_secref(dv, ecb->dofe_pred, st);
+		parse_secref(dv, ecb->dofe_actions, st);
+		break;
+	case DOF_SECT_ACTDESC:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((ad = dof_entry(ds, i, sizeof(*ad))) == NULL) {
+				st->dst_invalid++;
+				break;
+			}
+			parse_secref(dv, ad->dofa_difo, st);
+		}
+		break;
+	case DOF_SECT_DIFOHDR:
+		if ((dh = dof_struct(ds,
+		    offsetof(struct dof_difohdr, dofd_links))) == NULL) {
+			st->dst_invalid++;
+			break;
+		}
+		n = (ds->ds_size - offsetof(struct dof_difohdr, dofd_links)) /
+		    sizeof(dof_secidx_t);
+		for (i = 0; i < n; i++)
+			parse_secref(dv, dh->dofd_links[i], st);
+		break;
+	case DOF_SECT_XLMEMBERS:
+		for (i = 0; i < ds->ds_nent; i++) {
+			if ((xm = dof_entry(ds, i, sizeof(*xm))) == NULL) {
+				st->dst_invalid++;
+				break;
+			}
+			parse_secref(dv, xm->dofxm_difo, st);
+		}
+		break;
+	case DOF_SECT_XLIMPORT:
+	case DOF_SECT_XLEXPORT:
+		if ((xl = dof_struct(ds, sizeof(*xl))) == NULL)
+			st->dst_invalid++;
+		else
+			parse_secref(dv, xl->dofxl_members, st);
+		break;
+	case DOF_SECT_VARTAB:
+		(void)parse_table(ds, sizeof(struct dtrace_difv), st);
+		break;
+	case DOF_SECT_TYPTAB:
+		(void)parse_table(ds, sizeof(struct dtrace_diftype), st);
+		break;
+	case DOF_SECT_OPTDESC:
+		(void)parse_table(ds, sizeof(struct dof_optdesc), st);
+		break;
+	case DOF_SECT_XLTAB:
+		(void)parse_table(ds, sizeof(struct dof_xlref), st);
+		break;
+	}
+}
+
+/*
+ * Validate a DOF object and everything its sections refer to.  Returns NULL
+ * if the header and section table are sound, in which case *st describes the
+ * sections, with st->dst_invalid counting the bad ones and bad references;
+ * otherwise returns a description of the problem.
+ */
+const char *
+dof_parse(const void *buf, size_t size, struct dof_stats *st)
+{
+	struct dof_view dv;
+	struct dof_secview ds;
+	const char *errstr;
+	uint32_t i;
+
+	memset(st, 0, sizeof(*st));
+	if ((errstr = dof_view_init(&dv, buf, size)) != NULL)
+		return (errstr);
+	for (i = 0; i < dv.dv_hdr->dofh_secnum; i++) {
+		st->dst_sections++;
+		if (dof_section(&dv, i, DOF_SECT_NONE, &ds) != 0)
+			st->dst_invalid++;
+		else
+			parse_section(&dv, &ds, st);
+	}
+	return (NULL);
+}
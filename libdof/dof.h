@@ -0,0 +1,279 @@
+/*-
+ * Copyright (c) 2013 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _DOF_H_
+#define	_DOF_H_
+
+/*
+ * The DOF (DTrace Object Format) structures found in .SUNW_dof sections, and
+ * bounds-checked accessors for them.  The parser only ever reads the buffer
+ * it is given, so it can be pointed at untrusted input.
+ */
+
+#include <sys/types.h>
+#include <sys/endian.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define	DOF_ID_SIZE	16
+
+#define	DOF_ENCODE_LSB	1
+#define	DOF_ENCODE_MSB	2
+#if BYTE_ORDER == LITTLE_ENDIAN
+#define	DOF_ENCODE_NATIVE	DOF_ENCODE_LSB
+#else
+#define	DOF_ENCODE_NATIVE	DOF_ENCODE_MSB
+#endif
+
+#define	DOF_SECF_LOAD		1
+
+#define	DOF_SECT_NONE		0
+#define	DOF_SECT_COMMENTS	1
+#define	DOF_SECT_SOURCE		2
+#define	DOF_SECT_ECBDESC	3
+#define	DOF_SECT_PROBEDESC	4
+#define	DOF_SECT_ACTDESC	5
+#define	DOF_SECT_DIFOHDR	6
+#define	DOF_SECT_DIF		7
+#define	DOF_SECT_STRTAB		8
+#define	DOF_SECT_VARTAB		9
+#define	DOF_SECT_RELTAB		10
+#define	DOF_SECT_TYPTAB		11
+#define	DOF_SECT_URELHDR	12
+#define	DOF_SECT_KRELHDR	13
+#define	DOF_SECT_OPTDESC	14
+#define	DOF_SECT_PROVIDER	15
+#define	DOF_SECT_PROBES		16
+#define	DOF_SECT_PRARGS		17
+#define	DOF_SECT_PROFFS		18
+#define	DOF_SECT_INTTAB		19
+#define	DOF_SECT_UTSNAME	20
+#define	DOF_SECT_XLTAB		21
+#define	DOF_SECT_XLMEMBERS	22
+#define	DOF_SECT_XLIMPORT	23
+#define	DOF_SECT_XLEXPORT	24
+#define	DOF_SECT_PREXPORT	25
+#define	DOF_SECT_PRENOFFS	26
+
+#define	DOF_SECIDX_NONE		0xffffffffU
+
+#define	DOF_RELO_NONE		0
+#define	DOF_RELO_SETX		1
+#define	DOF_RELO_DOFREL		2
+
+#define	DOF_ATTR_NAME(a)	(((a) >> 24) & 0xff)
+#define	DOF_ATTR_DATA(a)	(((a) >> 16) & 0xff)
+#define	DOF_ATTR_CLASS(a)	(((a) >> 8) & 0xff)
+
+typedef uint32_t dof_secidx_t;
+typedef uint32_t dof_stridx_t;
+typedef uint32_t dof_attr_t;
+
+struct dof_hdr {
+	uint8_t dofh_ident[DOF_ID_SIZE];
+	uint32_t dofh_flags;
+	uint32_t dofh_hdrsize;
+	uint32_t dofh_secsize;
+	uint32_t dofh_secnum;
+	uint64_t dofh_secoff;
+	uint64_t dofh_loadsz;
+	uint64_t dofh_filesz;
+	uint64_t dofh_pad;
+};
+
+struct dof_sec {
+	uint32_t dofs_type;
+	uint32_t dofs_align;
+	uint32_t dofs_flags;
+	uint32_t dofs_entsize;
+	uint64_t dofs_offset;
+	uint64_t dofs_size;
+};
+
+struct dtrace_diftype {
+	uint8_t dtdt_kind;
+	uint8_t dtdt_ckind;
+	uint8_t dtdt_flags;
+	uint8_t dtdt_pad;
+	uint32_t dtdt_size;
+};
+
+struct dtrace_difv {
+	uint32_t dtdv_name;
+	uint32_t dtdv_id;
+	uint8_t dtdv_kind;
+	uint8_t dtdv_scope;
+	uint16_t dtdv_flags;
+	struct dtrace_diftype dtdv_type;
+};
+
+struct dof_ecbdesc {
+	dof_secidx_t dofe_probes;
+	dof_secidx_t dofe_pred;
+	dof_secidx_t dofe_actions;
+	uint32_t dofe_pad;
+	uint64_t dofe_uarg;
+};
+
+struct dof_probedesc {
+	dof_secidx_t dofp_strtab;
+	dof_stridx_t dofp_provider;
+	dof_stridx_t dofp_mod;
+	dof_stridx_t dofp_func;
+	dof_stridx_t dofp_name;
+	uint32_t dofp_id;
+};
+
+struct dof_actdesc {
+	dof_secidx_t dofa_difo;
+	dof_secidx_t dofa_strtab;
+	uint32_t dofa_kind;
+	uint32_t dofa_ntuple;
+	uint64_t dofa_arg;
+	uint64_t dofa_uarg;
+};
+
+struct dof_difohdr {
+	struct dtrace_diftype dofd_rtype;
+	dof_secidx_t dofd_links[1];
+};
+
+struct dof_relohdr {
+	dof_secidx_t dofr_strtab;
+	dof_secidx_t dofr_relsec;
+	dof_secidx_t dofr_tgtsec;
+};
+
+struct dof_relodesc {
+	dof_stridx_t dofr_name;
+	uint32_t dofr_type;
+	uint64_t dofr_offset;
+	uint64_t dofr_data;
+};
+
+struct dof_optdesc {
+	uint32_t dofo_option;
+	dof_secidx_t dofo_strtab;
+	uint64_t dofo_value;
+};
+
+struct dof_provider {
+	dof_secidx_t dofpv_strtab;
+	dof_secidx_t dofpv_probes;
+	dof_secidx_t dofpv_prargs;
+	dof_secidx_t dofpv_proffs;
+	dof_stridx_t dofpv_name;
+	dof_attr_t dofpv_provattr;
+	dof_attr_t dofpv_modattr;
+	dof_attr_t dofpv_funcattr;
+	dof_attr_t dofpv_nameattr;
+	dof_attr_t dofpv_argsattr;
+	dof_secidx_t dofpv_prenoffs;	/* absent in version 1 */
+};
+
+struct dof_probe {
+	uint64_t dofpr_addr;
+	dof_stridx_t dofpr_func;
+	dof_stridx_t dofpr_name;
+	dof_stridx_t dofpr_nargv;
+	dof_stridx_t dofpr_xargv;
+	uint32_t dofpr_argidx;
+	uint32_t dofpr_offidx;
+	uint8_t dofpr_nargc;
+	uint8_t dofpr_xargc;
+	uint16_t dofpr_noffs;
+	uint32_t dofpr_enoffidx;	/* absent in version 1 */
+	uint16_t dofpr_nenoffs;
+	uint16_t dofpr_pad1;
+	uint32_t dofpr_pad2;
+};
+
+struct dof_xlator {
+	dof_secidx_t dofxl_members;
+	dof_secidx_t dofxl_strtab;
+	dof_stridx_t dofxl_argv;
+	uint32_t dofxl_argc;
+	dof_stridx_t dofxl_type;
+	dof_attr_t dofxl_attr;
+};
+
+struct dof_xlmember {
+	dof_secidx_t dofxm_difo;
+	dof_stridx_t dofxm_name;
+	struct dtrace_diftype dofxm_type;
+};
+
+struct dof_xlref {
+	dof_secidx_t dofxr_xlator;
+	uint32_t dofxr_member;
+	uint32_t dofxr_argn;
+};
+
+/*
+ * A bounds-checked view of a DOF object.  Nothing is copied: the accessors
+ * below return pointers into the section data once they have verified that
+ * the object pointed to lies within its section, and that the section lies
+ * within the loadable (or, for non-loadable sections, the whole) DOF image.
+ * A corrupt object therefore yields NULL rather than an out-of-bounds read.
+ * The image itself must be 8-byte aligned, as it is within its ELF section.
+ */
+struct dof_view {
+	const uint8_t	*dv_base;
+	const struct dof_hdr *dv_hdr;
+	uint64_t	dv_loadsz;
+	uint64_t	dv_filesz;
+};
+
+struct dof_secview {
+	const struct dof_sec *ds_sec;
+	const uint8_t	*ds_data;
+	uint64_t	ds_size;
+	uint64_t	ds_nent;
+};
+
+/* Counts gathered by dof_parse(). */
+struct dof_stats {
+	uint64_t	dst_sections;	/* section headers */
+	uint64_t	dst_invalid;	/* bad sections or references */
+	uint64_t	dst_providers;
+	uint64_t	dst_probes;
+	uint64_t	dst_strings;	/* strings referenced by the sections */
+};
+
+const char	*dof_view_init(struct dof_view *, const void *, size_t);
+int		dof_section(const struct dof_view *, uint32_t, uint32_t,
+		    struct dof_secview *);
+const void	*dof_entry(const struct dof_secview *, uint64_t, size_t);
+const void	*dof_struct(const struct dof_secview *, size_t);
+const void	*dof_array(const struct dof_secview *, uint64_t, uint64_t,
+		    size_t);
+const char	*dof_string(const struct dof_secview *, uint64_t);
+uint64_t	dof_count_probes(const struct dof_view *);
+const char	*dof_parse(const void *, size_t, struct dof_stats *);
+
+#endif /* !_DOF_H_ */
@@ -0,0 +1,185 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include <fnmatch.h>
+
+#include <taglib/attachedpictureframe.h>
+#include <taglib/commentsframe.h>
+#include <taglib/generalencapsulatedobjectframe.h>
+#include <taglib/id3v2frame.h>
+#include <taglib/privateframe.h>
+#include <taglib/textidentificationframe.h>
+#include <taglib/uniquefileidentifierframe.h>
+#include <taglib/unsynchronizedlyricsframe.h>
+#include <taglib/urllinkframe.h>
+
+#include "frameset.h"
+
+using namespace id3v2;
+
+static bool
+packid(const std::string &id, uint32_t &key)
+{
+
+    if (id.size() != 4)
+        return (false);
+    key = (uint8_t)id[0] << 24 | (uint8_t)id[1] << 16 |
+        (uint8_t)id[2] << 8 | (uint8_t)id[3];
+    return (true);
+}
+
+bool
+FrameSet::add(const char *spec)
+{
+    std::string s(spec);
+    size_t start, end, colon;
+
+    for (start = 0; start <= s.size(); start = end + 1) {
+        Pattern p;
+        uint32_t key;
+
+        end = s.find(',', start);
+        if (end == std::string::npos)
+            end = s.size();
+        std::string entry(s.substr(start, end - start));
+
+        colon = entry.find(':');
+        p.id = entry.substr(0, colon);
+        p.hasdesc = colon != std::string::npos;
+        if (p.hasdesc)
+            p.desc = entry.substr(colon + 1);
+        if (p.id.empty())
+            return (false);
+
+        if (!p.hasdesc && p.id.find_first_of("*?[") == std::string::npos) {
+            if (!packid(p.id, key))
+                return (false);
+            ids.insert(std::upper_bound(ids.begin(), ids.end(), key), key);
+        } else {
+            patterns.push_back(p);
+        }
+    }
+    return (true);
+}
+
+FrameSet::Match
+FrameSet::lookup(const char *id) const
+{
+    Match res = NO;
+    uint32_t key;
+
+    if (packid(id, key) && std::binary_search(ids.begin(), ids.end(), key))
+        return (YES);
+    for (const auto &p : patterns) {
+        if (fnmatch(p.id.c_str(), id, 0) != 0)
+            continue;
+        if (!p.hasdesc)
+            return (YES);
+        res = NEEDDESC;
+    }
+    return (res);
+}
+
+bool
+FrameSet::match(const char *id, const std::string &desc) const
+{
+
+    switch (lookup(id)) {
+    case YES:
+        return (true);
+    case NO:
+        return (false);
+    case NEEDDESC:
+        break;
+    }
+    for (const auto &p : patterns)
+        if (p.hasdesc && fnmatch(p.id.c_str(), id, 0) == 0 &&
+            fnmatch(p.desc.c_str(), desc.c_str(), 0) == 0)
+            return (true);
+    return (false);
+}
+
+bool
+FrameSet::match(const Frame &f) const
+{
+    std::string desc;
+
+    switch (lookup(f.id)) {
+    case YES:
+        return (true);
+    case NO:
+        return (false);
+    case NEEDDESC:
+        break;
+    }
+    if (!description(f, desc))
+        return (false);
+    return (match(f.id, desc));
+}
+
+static std::string
+taglib_description(const TagLib::ID3v2::Frame *frame)
+{
+    using namespace TagLib::ID3v2;
+
+    if (auto *f = dynamic_cast<const UserTextIdentificationFrame *>(frame))
+        return (f->description().to8Bit(true));
+    if (auto *f = dynamic_cast<const UserUrlLinkFrame *>(frame))
+        return (f->description().to8Bit(true));
+    if (auto *f = dynamic_cast<const CommentsFrame *>(frame))
+        return (f->description().to8Bit(true));
+    if (auto *f = dynamic_cast<const UnsynchronizedLyricsFrame *>(frame))
+        return (f->description().to8Bit(true));
+    if (auto *f = dynamic_cast<const AttachedPictureFrame *>(frame))
+        return (f->description().to8Bit(true));
+    if (auto *f = dynamic_cast<const GeneralEncapsulatedObjectFrame *>(frame))
+        return (f->description().to8Bit(true));
+    if (auto *f = dynamic_cast<const PrivateFrame *>(frame))
+        return (f->owner().to8Bit(true));
+    if (auto *f = dynamic_cast<const UniqueFileIdentifierFrame *>(frame))
+        return (f->owner().to8Bit(true));
+    return (std::string());
+}
+
+bool
+FrameSet::match(const TagLib::ID3v2::Frame &frame) const
+{
+    const TagLib::ByteVector fid(frame.frameID());
+    const std::string id(fid.data(), fid.size());
+
+    switch (lookup(id.c_str())) {
+    case YES:
+        return (true);
+    case NO:
+        return (false);
+    case NEEDDESC:
+        break;
+    }
+    return (match(id.c_str(), taglib_description(&frame)));
+}
@@ -0,0 +1,80 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FRAMESET_H_
+#define _FRAMESET_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "id3v2.h"
+
+namespace TagLib {
+namespace ID3v2 {
+class Frame;
+}
+}
+
+namespace id3v2 {
+
+/*
+ * A set of frames, given as a comma-separated list of frame IDs or fnmatch(3)
+ * patterns.  Each entry may be followed by a colon and a pattern which is
+ * matched against the frame's description, e.g., "PRIV,COMM,TXXX:MusicBrainz*".
+ * Plain frame IDs are looked up in a sorted table; only patterns are tried one
+ * by one.
+ */
+class FrameSet {
+public:
+    enum Match {
+        NO,
+        YES,
+        NEEDDESC,   /* the answer depends on the frame's description */
+    };
+
+    bool add(const char *spec);
+    bool empty() const { return ids.empty() && patterns.empty(); }
+
+    Match lookup(const char *id) const;
+    bool match(const char *id, const std::string &desc) const;
+    bool match(const Frame &f) const;
+    bool match(const TagLib::ID3v2::Frame &frame) const;
+
+private:
+    struct Pattern {
+        std::string id;
+        std::string desc;
+        bool hasdesc;
+    };
+
+    std::vector<uint32_t> ids;
+    std::vector<Pattern> patterns;
+};
+
+}
+
+#endif /* !_FRAMESET_H_ */
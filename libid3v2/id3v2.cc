@@ -0,0 +1,523 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "id3v2.h"
+
+using namespace id3v2;
+
+static uint32_t
+syncsafe(const uint8_t *p)
+{
+
+    return ((p[0] << 21) | (p[1] << 14) | (p[2] << 7) | p[3]);
+}
+
+static bool
+is_syncsafe(const uint8_t *p)
+{
+
+    return (((p[0] | p[1] | p[2] | p[3]) & 0x80) == 0);
+}
+
+static uint32_t
+be32(const uint8_t *p)
+{
+
+    return ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+static bool
+valid_id(const uint8_t *p)
+{
+
+    for (int i = 0; i < 4; i++)
+        if (!((p[i] >= 'A' && p[i] <= 'Z') || (p[i] >= '0' && p[i] <= '9')))
+            return (false);
+    return (true);
+}
+
+/*
+ * ID3v2.3 frames that TagLib discards or merges into other frames when it
+ * upgrades a tag to v2.4.  We can't reproduce that cheaply, so consumers which
+ * need TagLib's view of such a tag must use TagLib.
+ */
+static bool
+v23_discarded(const char *id)
+{
+    static const char *ids[] = {
+        "EQUA", "IPLS", "RVAD", "TDAT", "TIME", "TRDA", "TSIZ",
+    };
+
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++)
+        if (memcmp(id, ids[i], 4) == 0)
+            return (true);
+    return (false);
+}
+
+static void
+put_unit(std::string &out, Charset cs, uint32_t u, uint32_t &hi)
+{
+
+    if (cs == NARROW) {
+        out += (char)u;
+        return;
+    }
+    if (u >= 0xd800 && u <= 0xdbff) {
+        hi = u;
+        return;
+    }
+    if (u >= 0xdc00 && u <= 0xdfff && hi != 0)
+        u = 0x10000 + ((hi - 0xd800) << 10) + (u - 0xdc00);
+    hi = 0;
+    if (u < 0x80) {
+        out += (char)u;
+    } else if (u < 0x800) {
+        out += (char)(0xc0 | (u >> 6));
+        out += (char)(0x80 | (u & 0x3f));
+    } else if (u < 0x10000) {
+        out += (char)(0xe0 | (u >> 12));
+        out += (char)(0x80 | ((u >> 6) & 0x3f));
+        out += (char)(0x80 | (u & 0x3f));
+    } else {
+        out += (char)(0xf0 | (u >> 18));
+        out += (char)(0x80 | ((u >> 12) & 0x3f));
+        out += (char)(0x80 | ((u >> 6) & 0x3f));
+        out += (char)(0x80 | (u & 0x3f));
+    }
+}
+
+/*
+ * Append a string field, decoded according to its ID3v2 text encoding and
+ * truncated at the first NUL, as TagLib's String would hold it.  Returns false
+ * if the field can't be decoded exactly as TagLib would decode it.
+ */
+bool
+id3v2::append_string(std::string &out, const uint8_t *p, size_t n,
+    unsigned enc, Charset cs)
+{
+    uint32_t hi = 0;
+    size_t i;
+
+    switch (enc) {
+    case 0:
+        for (i = 0; i < n && p[i] != 0; i++)
+            put_unit(out, cs, p[i], hi);
+        return (true);
+    case 1:
+    case 2: {
+        bool le = false;
+
+        if (n == 0)
+            return (true);
+        if (n < 2)
+            return (false);
+        if (enc == 1) {
+            if (p[0] == 0xff && p[1] == 0xfe)
+                le = true;
+            else if (!(p[0] == 0xfe && p[1] == 0xff))
+                return (false);
+            p += 2;
+            n -= 2;
+        }
+        for (i = 0; i + 1 < n; i += 2) {
+            uint32_t u = le ? p[i] | p[i + 1] << 8 : p[i] << 8 | p[i + 1];
+
+            if (u == 0)
+                break;
+            put_unit(out, cs, u, hi);
+        }
+        return (true);
+    }
+    case 3:
+        for (i = 0; i < n && p[i] != 0;) {
+            uint32_t cp;
+            size_t len;
+
+            if (p[i] < 0x80) {
+                cp = p[i];
+                len = 1;
+            } else if ((p[i] & 0xe0) == 0xc0) {
+                cp = p[i] & 0x1f;
+                len = 2;
+            } else if ((p[i] & 0xf0) == 0xe0) {
+                cp = p[i] & 0x0f;
+                len = 3;
+            } else if ((p[i] & 0xf8) == 0xf0) {
+                cp = p[i] & 0x07;
+                len = 4;
+            } else {
+                return (false);
+            }
+            if (len > n - i)
+                return (false);
+            for (size_t j = 1; j < len; j++) {
+                if ((p[i + j] & 0xc0) != 0x80)
+                    return (false);
+                cp = (cp << 6) | (p[i + j] & 0x3f);
+            }
+            if ((len == 2 && cp < 0x80) || (len == 3 && cp < 0x800) ||
+                (len == 4 && cp < 0x10000) || cp > 0x10ffff ||
+                (cp >= 0xd800 && cp <= 0xdfff))
+                return (false);
+            if (cp >= 0x10000 && cs == NARROW) {
+                cp -= 0x10000;
+                put_unit(out, cs, 0xd800 | (cp >> 10), hi);
+                put_unit(out, cs, 0xdc00 | (cp & 0x3ff), hi);
+            } else {
+                put_unit(out, cs, cp, hi);
+            }
+            i += len;
+        }
+        return (true);
+    default:
+        return (false);
+    }
+}
+
+/*
+ * Find the first string delimiter at or after "pos", at an offset from "pos"
+ * which is a multiple of the delimiter size.
+ */
+size_t
+id3v2::find_delim(const uint8_t *p, size_t n, size_t pos, unsigned enc)
+{
+    size_t align = enc == 1 || enc == 2 ? 2 : 1;
+
+    for (; pos + align <= n; pos += align)
+        if (p[pos] == 0 && (align == 1 || p[pos + 1] == 0))
+            return (pos);
+    return (SIZE_MAX);
+}
+
+/*
+ * Extract the description (or owner, for PRIV and UFID frames) of a frame as
+ * UTF-8.  Frames without one have an empty description.  Returns false if the
+ * frame is malformed.
+ */
+bool
+id3v2::description(const Frame &f, std::string &out)
+{
+    const uint8_t *p = f.data;
+    size_t n = f.size, pos, delim;
+    unsigned enc;
+
+    out.clear();
+    if (strcmp(f.id, "PRIV") == 0 || strcmp(f.id, "UFID") == 0)
+        return (append_string(out, p, n, 0, UTF8));
+
+    if (strcmp(f.id, "TXXX") == 0 || strcmp(f.id, "WXXX") == 0)
+        pos = 1;
+    else if (strcmp(f.id, "COMM") == 0 || strcmp(f.id, "USLT") == 0)
+        pos = 4;
+    else if (strcmp(f.id, "APIC") == 0 || strcmp(f.id, "GEOB") == 0)
+        pos = 1;
+    else
+        return (true);
+    if (n < pos)
+        return (false);
+    enc = p[0];
+
+    if (strcmp(f.id, "APIC") == 0 || strcmp(f.id, "GEOB") == 0) {
+        /* Skip the MIME type, and the picture type or the file name. */
+        if ((delim = find_delim(p, n, pos, 0)) == SIZE_MAX)
+            return (false);
+        pos = delim + 1;
+        if (strcmp(f.id, "APIC") == 0) {
+            pos++;
+        } else {
+            if ((delim = find_delim(p, n, pos, enc)) == SIZE_MAX)
+                return (false);
+            pos = delim + (enc == 1 || enc == 2 ? 2 : 1);
+        }
+        if (pos > n)
+            return (false);
+    }
+
+    if ((delim = find_delim(p, n, pos, enc)) == SIZE_MAX)
+        delim = n;
+    return (append_string(out, p + pos, delim - pos, enc, UTF8));
+}
+
+Tag::Tag() :
+    fd(-1), map(MAP_FAILED), maplen(0), base(NULL), major(0), flags(0),
+    unsync(false), discards(false), total(0), end(0), scratchused(0)
+{
+}
+
+Tag::~Tag()
+{
+
+    close();
+}
+
+void
+Tag::close()
+{
+
+    if (map != MAP_FAILED) {
+        (void)munmap(map, maplen);
+        map = MAP_FAILED;
+    }
+    if (fd >= 0) {
+        (void)::close(fd);
+        fd = -1;
+    }
+    framelist.clear();
+    scratchused = 0;
+}
+
+/*
+ * Validate a tag header and compute the size of the complete tag, including
+ * the header and footer.
+ */
+Result
+Tag::header(const uint8_t *hdr, size_t &total)
+{
+
+    if (memcmp(hdr, "ID3", 3) != 0)
+        return (NOTAG);
+    if (hdr[3] < 3 || hdr[3] > 4 || hdr[4] == 0xff || !is_syncsafe(&hdr[6]))
+        return (REJECT);
+
+    total = HEADER_SIZE + syncsafe(&hdr[6]);
+    if (hdr[3] == 4 && (hdr[5] & 0x10) != 0)
+        total += HEADER_SIZE;
+    return (OK);
+}
+
+Result
+Tag::open(const char *path, bool writable)
+{
+    uint8_t hdr[HEADER_SIZE];
+    struct stat sb;
+    ssize_t n;
+    Result res;
+
+    close();
+
+    fd = ::open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+        return (FAIL);
+    n = pread(fd, hdr, sizeof(hdr), 0);
+    if (n < 0)
+        return (FAIL);
+    if ((size_t)n < sizeof(hdr))
+        return (NOTAG);
+    if ((res = header(hdr, total)) != OK)
+        return (res);
+
+    if (fstat(fd, &sb) != 0)
+        return (FAIL);
+    if (!S_ISREG(sb.st_mode) || (off_t)total > sb.st_size)
+        return (REJECT);
+
+    map = mmap(NULL, total, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return (FAIL);
+    maplen = total;
+
+    return (parse(static_cast<const uint8_t *>(map), maplen));
+}
+
+/*
+ * Undo unsynchronisation, i.e., drop the zero byte from each 0xff 0x00 pair.
+ * The output goes to the scratch buffer, which is sized to hold the whole tag
+ * the first time it is used so that earlier frames' payloads never move.
+ */
+const uint8_t *
+Tag::decode(const uint8_t *src, size_t len, size_t &outlen)
+{
+    uint8_t *dst, *start;
+    size_t i;
+
+    if (scratch.size() < total)
+        scratch.resize(total);
+    start = dst = &scratch[scratchused];
+
+    for (i = 0; i + 1 < len; i++) {
+        *dst++ = src[i];
+        if (src[i] == 0xff && src[i + 1] == 0x00)
+            i++;
+    }
+    if (i < len)
+        *dst++ = src[i];
+
+    outlen = dst - start;
+    scratchused += outlen;
+    return (start);
+}
+
+Result
+Tag::parse(const uint8_t *buf, size_t len)
+{
+    size_t pos, extsize;
+    Result res;
+
+    framelist.clear();
+    scratchused = 0;
+    base = buf;
+    discards = false;
+
+    if (len < HEADER_SIZE)
+        return (NOTAG);
+    if ((res = header(buf, total)) != OK)
+        return (res);
+    if (total > len)
+        return (REJECT);
+
+    major = buf[3];
+    flags = buf[5];
+    unsync = major == 3 && (flags & 0x80) != 0;
+    pos = HEADER_SIZE;
+    end = HEADER_SIZE + syncsafe(&buf[6]);
+    if (pos >= end)
+        return (OK);
+
+    if (unsync) {
+        size_t outlen;
+
+        /*
+         * The whole v2.3 tag body is unsynchronised, extended header
+         * included.  Decode it up front and walk the decoded copy.
+         */
+        buf = decode(&buf[HEADER_SIZE], end - HEADER_SIZE, outlen);
+        pos = 0;
+        end = outlen;
+    }
+
+    if ((flags & 0x40) != 0) {
+        /* Skip the extended header. */
+        if (pos + 4 > end)
+            return (REJECT);
+        if (major == 3) {
+            extsize = 4 + (size_t)be32(&buf[pos]);
+        } else {
+            if (!is_syncsafe(&buf[pos]))
+                return (REJECT);
+            extsize = syncsafe(&buf[pos]);
+        }
+        if (extsize > end - pos)
+            return (REJECT);
+        pos += extsize;
+    }
+
+    return (parseframes(buf, pos, end));
+}
+
+Result
+Tag::parseframes(const uint8_t *buf, size_t pos, size_t limit)
+{
+    const size_t hdrlen = 10;
+
+    while (pos + hdrlen < limit) {
+        Frame f;
+        size_t size;
+
+        /* A zero byte where a frame ID is expected marks the padding. */
+        if (buf[pos] == 0)
+            break;
+        if (!valid_id(&buf[pos]))
+            return (REJECT);
+
+        if (major == 4) {
+            if (!is_syncsafe(&buf[pos + 4]))
+                return (REJECT);
+            size = syncsafe(&buf[pos + 4]);
+        } else {
+            size = be32(&buf[pos + 4]);
+        }
+        if (size == 0 || size > limit - pos - hdrlen)
+            return (REJECT);
+
+        /*
+         * Some writers store v2.4 frame sizes as plain integers, and TagLib
+         * applies a heuristic to detect this.  Rather than emulate it, make
+         * sure that the next frame starts where we think it does.
+         */
+        if (pos + hdrlen + size + 4 <= limit &&
+            buf[pos + hdrlen + size] != 0 &&
+            !valid_id(&buf[pos + hdrlen + size]))
+            return (REJECT);
+
+        memcpy(f.id, &buf[pos], 4);
+        f.id[4] = '\0';
+        f.flags[0] = buf[pos + 8];
+        f.flags[1] = buf[pos + 9];
+        f.data = &buf[pos + hdrlen];
+        f.size = size;
+        f.offset = pos;
+        f.extent = hdrlen + size;
+
+        if (major == 3) {
+            /* Compression, encryption, grouping. */
+            if ((f.flags[1] & 0xe0) != 0)
+                return (REJECT);
+            if (v23_discarded(f.id))
+                discards = true;
+            if (memcmp(f.id, "TORY", 4) == 0)
+                memcpy(f.id, "TDOR", 4);
+            else if (memcmp(f.id, "TYER", 4) == 0)
+                memcpy(f.id, "TDRC", 4);
+        } else {
+            /* Grouping, compression, encryption. */
+            if ((f.flags[1] & 0x4c) != 0)
+                return (REJECT);
+            if ((f.flags[1] & 0x02) != 0 || (flags & 0x80) != 0)
+                f.data = decode(f.data, f.size, f.size);
+            if ((f.flags[1] & 0x01) != 0) {
+                size_t dlen;
+
+                /* Data length indicator. */
+                if (f.size < 4 || !is_syncsafe(f.data))
+                    return (REJECT);
+                dlen = syncsafe(f.data);
+                f.data += 4;
+                f.size -= 4;
+                if (dlen < f.size)
+                    f.size = dlen;
+            }
+            /* Every frame carries at least one byte of content. */
+            if (f.size == 0)
+                return (REJECT);
+        }
+
+        framelist.push_back(f);
+        pos += hdrlen + size;
+    }
+
+    end = pos;
+    return (OK);
+}
@@ -0,0 +1,136 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _ID3V2_H_
+#define _ID3V2_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * A minimal ID3v2 tag reader.  Only the tag header and the tag extent are
+ * read, and frames are walked in place.  Anything the reader doesn't fully
+ * understand (v2.2 tags, compressed, encrypted or grouped frames, malformed
+ * sizes) causes the tag to be rejected, and callers are expected to fall back
+ * to TagLib.  Frame IDs are reported as TagLib would report them after
+ * upgrading the tag to v2.4; lossy() is set if TagLib would also discard or
+ * merge some of the tag's frames.
+ */
+namespace id3v2 {
+
+const size_t HEADER_SIZE = 10;
+
+enum Result {
+    OK,         /* the tag was parsed */
+    NOTAG,      /* there is no ID3v2 tag at the start of the file */
+    REJECT,     /* the tag must be handled by TagLib */
+    FAIL,       /* an I/O error occurred, errno is set */
+};
+
+/*
+ * A view of a single frame.  "data" and "size" describe the frame payload
+ * after any unsynchronisation has been undone and any data length indicator
+ * has been skipped.  The payload points either into the mapped tag or into
+ * the tag's scratch buffer, and is valid until the tag is closed.  "offset"
+ * and "extent" locate the raw frame, header included, in the file; they are
+ * meaningless if the tag as a whole is unsynchronised.  framesend() is the
+ * offset at which the frames stop and the padding, if any, begins.
+ */
+struct Frame {
+    char id[5];
+    uint8_t flags[2];
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+    size_t extent;
+};
+
+/*
+ * How decoded strings are appended: either as TagLib prints them, with each
+ * UTF-16 code unit narrowed to 8 bits, or as UTF-8.
+ */
+enum Charset {
+    NARROW,
+    UTF8,
+};
+
+bool append_string(std::string &out, const uint8_t *p, size_t n,
+    unsigned enc, Charset cs = NARROW);
+size_t find_delim(const uint8_t *p, size_t n, size_t pos, unsigned enc);
+bool description(const Frame &f, std::string &out);
+
+class Tag {
+public:
+    Tag();
+    ~Tag();
+
+    Result open(const char *path, bool writable = false);
+    Result parse(const uint8_t *buf, size_t len);
+    void close();
+
+    static Result header(const uint8_t *hdr, size_t &total);
+
+    int descriptor() const { return fd; }
+    const uint8_t *raw() const { return base; }
+
+    unsigned version() const { return major; }
+    bool unsynchronised() const { return unsync; }
+    bool extheader() const { return (flags & 0x40) != 0; }
+    bool footer() const { return major == 4 && (flags & 0x10) != 0; }
+    bool lossy() const { return discards; }
+    size_t size() const { return total; }
+    size_t framesend() const { return end; }
+    const std::vector<Frame> &frames() const { return framelist; }
+
+private:
+    Tag(const Tag &);
+    Tag &operator=(const Tag &);
+
+    Result parseframes(const uint8_t *buf, size_t pos, size_t limit);
+    const uint8_t *decode(const uint8_t *src, size_t len, size_t &outlen);
+
+    int fd;
+    void *map;
+    size_t maplen;
+    const uint8_t *base;
+
+    unsigned major;
+    uint8_t flags;
+    bool unsync;
+    bool discards;
+    size_t total;
+    size_t end;
+    std::vector<Frame> framelist;
+
+    std::vector<uint8_t> scratch;
+    size_t scratchused;
+};
+
+}
+
+#endif /* !_ID3V2_H_ */
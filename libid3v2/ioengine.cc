@@ -0,0 +1,431 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstring>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <sys/eventfd.h>
+#include <sys/sysmacros.h>
+
+#include <liburing.h>
+#include <poll.h>
+#endif
+
+#include "id3v2.h"
+#include "ioengine.h"
+
+using namespace id3v2;
+
+/*
+ * Decide whether a tag extends past the prefix that was read, in which case
+ * the rest of it is read with a second request.
+ */
+static bool
+needmore(const std::vector<uint8_t> &buf, size_t got, off_t filesize,
+    size_t &total)
+{
+
+    if (got < IoEngine::PREFIX_SIZE)
+        return (false);
+    if (Tag::header(buf.data(), total) != OK)
+        return (false);
+    return (total > got && (off_t)total <= filesize);
+}
+
+/*
+ * The portable engine: each thread opens and reads one file at a time, so the
+ * number of threads bounds the number of requests in flight.
+ */
+class ThreadEngine : public IoEngine {
+public:
+    ThreadEngine(unsigned nthreads, Callback done);
+    ~ThreadEngine();
+
+    void submit(Request *req);
+
+private:
+    void fetch(Request *req);
+    void run();
+
+    Callback done;
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<Request *> queue;
+    bool stopping;
+    std::vector<std::thread> threads;
+};
+
+ThreadEngine::ThreadEngine(unsigned nthreads, Callback done_) :
+    done(done_), stopping(false)
+{
+    for (unsigned i = 0; i < nthreads; i++)
+        threads.emplace_back(&ThreadEngine::run, this);
+}
+
+/* Requests already submitted are completed before the threads exit. */
+ThreadEngine::~ThreadEngine()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto &thr : threads)
+        thr.join();
+}
+
+void
+ThreadEngine::submit(Request *req)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(req);
+    }
+    cv.notify_one();
+}
+
+void
+ThreadEngine::fetch(Request *req)
+{
+    size_t got, total;
+    ssize_t n;
+    int fd;
+
+    req->error = 0;
+    req->buf.resize(PREFIX_SIZE);
+    fd = open(req->path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &req->sb) != 0 ||
+        (n = pread(fd, req->buf.data(), PREFIX_SIZE, 0)) < 0) {
+        req->error = errno;
+        req->buf.clear();
+        if (fd >= 0)
+            (void)close(fd);
+        return;
+    }
+    got = n;
+    if (needmore(req->buf, got, req->sb.st_size, total)) {
+        req->buf.resize(total);
+        n = pread(fd, &req->buf[got], total - got, got);
+        if (n > 0)
+            got += n;
+    }
+    req->buf.resize(got);
+    (void)close(fd);
+}
+
+void
+ThreadEngine::run()
+{
+    Request *req;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [this] { return (!queue.empty() || stopping); });
+            if (queue.empty())
+                return;
+            req = queue.front();
+            queue.pop_front();
+        }
+        fetch(req);
+        done(req);
+    }
+}
+
+#ifdef HAVE_LIBURING
+/*
+ * The io_uring engine.  A single thread owns the ring: it turns submitted
+ * requests into openat operations, follows each successful open with a read
+ * of the prefix and a statx, and issues a second read if the tag is longer
+ * than the prefix.  Submitters wake the thread through an eventfd, which is
+ * polled through the ring itself so that the thread only ever waits in one
+ * place.
+ */
+class UringEngine : public IoEngine {
+public:
+    UringEngine(unsigned depth, Callback done);
+    ~UringEngine();
+
+    bool init();
+    void submit(Request *req);
+
+private:
+    enum { OPEN, READ, STAT, MORE, WAKE };
+
+    struct Op {
+        Request *req;
+        int fd;
+        int pending;
+        size_t got;
+        struct statx stx;
+    };
+
+    void prep(Op *op, unsigned kind, struct io_uring_sqe *sqe);
+    void arm();
+    void complete(Op *op);
+    void handle(struct io_uring_cqe *cqe);
+    void run();
+
+    Callback done;
+    unsigned depth;
+    struct io_uring ring;
+    bool ringinit;
+    int efd;
+
+    std::mutex lock;
+    std::deque<Request *> queue;
+    bool stopping;
+    unsigned inflight;
+    std::thread thread;
+};
+
+UringEngine::UringEngine(unsigned depth_, Callback done_) :
+    done(done_), depth(depth_), ringinit(false), efd(-1), stopping(false),
+    inflight(0)
+{
+}
+
+UringEngine::~UringEngine()
+{
+    uint64_t one = 1;
+
+    if (thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        (void)write(efd, &one, sizeof(one));
+        thread.join();
+    }
+    if (ringinit)
+        io_uring_queue_exit(&ring);
+    if (efd >= 0)
+        (void)close(efd);
+}
+
+/* Each request has at most two operations in flight, plus the eventfd poll. */
+bool
+UringEngine::init()
+{
+
+    if ((efd = eventfd(0, EFD_CLOEXEC)) < 0)
+        return (false);
+    if (io_uring_queue_init(depth * 2 + 1, &ring, 0) != 0)
+        return (false);
+    ringinit = true;
+    thread = std::thread(&UringEngine::run, this);
+    return (true);
+}
+
+void
+UringEngine::submit(Request *req)
+{
+    uint64_t one = 1;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(req);
+    }
+    (void)write(efd, &one, sizeof(one));
+}
+
+/* Operations are tagged with their kind in the low bits of the user data. */
+void
+UringEngine::prep(Op *op, unsigned kind, struct io_uring_sqe *sqe)
+{
+    Request *req = op != NULL ? op->req : NULL;
+
+    switch (kind) {
+    case OPEN:
+        io_uring_prep_openat(sqe, AT_FDCWD, req->path, O_RDONLY | O_CLOEXEC,
+            0);
+        break;
+    case READ:
+        io_uring_prep_read(sqe, op->fd, req->buf.data(), PREFIX_SIZE, 0);
+        break;
+    case STAT:
+        io_uring_prep_statx(sqe, op->fd, "", AT_EMPTY_PATH,
+            STATX_BASIC_STATS, &op->stx);
+        break;
+    case MORE:
+        io_uring_prep_read(sqe, op->fd, &req->buf[op->got],
+            req->buf.size() - op->got, op->got);
+        break;
+    case WAKE:
+        io_uring_prep_poll_add(sqe, efd, POLLIN);
+        break;
+    }
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)op | kind));
+}
+
+void
+UringEngine::arm()
+{
+
+    prep(NULL, WAKE, io_uring_get_sqe(&ring));
+}
+
+void
+UringEngine::complete(Op *op)
+{
+    Request *req = op->req;
+
+    if (op->fd >= 0)
+        (void)close(op->fd);
+    if (req->error != 0)
+        op->got = 0;
+    req->buf.resize(op->got);
+    delete op;
+    inflight--;
+    done(req);
+}
+
+void
+UringEngine::handle(struct io_uring_cqe *cqe)
+{
+    uintptr_t data = (uintptr_t)io_uring_cqe_get_data(cqe);
+    Op *op = (Op *)(data & ~(uintptr_t)7);
+    Request *req;
+    size_t total;
+    uint64_t n;
+
+    switch (data & 7) {
+    case WAKE:
+        (void)read(efd, &n, sizeof(n));
+        arm();
+        return;
+    case OPEN:
+        req = op->req;
+        if (cqe->res < 0) {
+            req->error = -cqe->res;
+            complete(op);
+            return;
+        }
+        op->fd = cqe->res;
+        op->pending = 2;
+        prep(op, READ, io_uring_get_sqe(&ring));
+        prep(op, STAT, io_uring_get_sqe(&ring));
+        return;
+    case READ:
+    case STAT:
+        req = op->req;
+        if (cqe->res < 0)
+            req->error = -cqe->res;
+        else if ((data & 7) == READ)
+            op->got = cqe->res;
+        if (--op->pending > 0)
+            return;
+        if (req->error != 0) {
+            complete(op);
+            return;
+        }
+
+        memset(&req->sb, 0, sizeof(req->sb));
+        req->sb.st_dev = makedev(op->stx.stx_dev_major,
+            op->stx.stx_dev_minor);
+        req->sb.st_ino = op->stx.stx_ino;
+        req->sb.st_mode = op->stx.stx_mode;
+        req->sb.st_nlink = op->stx.stx_nlink;
+        req->sb.st_uid = op->stx.stx_uid;
+        req->sb.st_gid = op->stx.stx_gid;
+        req->sb.st_size = op->stx.stx_size;
+        req->sb.st_mtim.tv_sec = op->stx.stx_mtime.tv_sec;
+        req->sb.st_mtim.tv_nsec = op->stx.stx_mtime.tv_nsec;
+
+        if (needmore(req->buf, op->got, req->sb.st_size, total)) {
+            req->buf.resize(total);
+            op->pending = 1;
+            prep(op, MORE, io_uring_get_sqe(&ring));
+            return;
+        }
+        complete(op);
+        return;
+    case MORE:
+        /* A short second read just leaves a truncated tag for the parser. */
+        if (cqe->res > 0)
+            op->got += cqe->res;
+        complete(op);
+        return;
+    }
+}
+
+void
+UringEngine::run()
+{
+    struct io_uring_cqe *cqe;
+    Request *req;
+
+    arm();
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            while (!queue.empty() && inflight < depth) {
+                req = queue.front();
+                queue.pop_front();
+
+                Op *op = new Op();
+                op->req = req;
+                op->fd = -1;
+                req->error = 0;
+                req->buf.resize(PREFIX_SIZE);
+                prep(op, OPEN, io_uring_get_sqe(&ring));
+                inflight++;
+            }
+            if (stopping && queue.empty() && inflight == 0)
+                return;
+        }
+
+        (void)io_uring_submit_and_wait(&ring, 1);
+        while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+            handle(cqe);
+            io_uring_cqe_seen(&ring, cqe);
+        }
+    }
+}
+#endif /* HAVE_LIBURING */
+
+std::unique_ptr<IoEngine>
+IoEngine::create(unsigned depth, Callback done)
+{
+
+#ifdef HAVE_LIBURING
+    std::unique_ptr<UringEngine> uring(new UringEngine(depth, done));
+    if (uring->init())
+        return (std::unique_ptr<IoEngine>(uring.release()));
+#endif
+    return (std::unique_ptr<IoEngine>(new ThreadEngine(depth, done)));
+}
@@ -0,0 +1,75 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _IOENGINE_H_
+#define _IOENGINE_H_
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace id3v2 {
+
+/*
+ * Read the leading ID3v2 tags of many files concurrently, so that the latency
+ * of each open and read is overlapped with that of the others.  A request
+ * reads the first PREFIX_SIZE bytes of a file, and then the rest of its tag if
+ * the header says that it is longer, so that the buffer can be handed to
+ * Tag::parse().  Requests complete in no particular order, and the completion
+ * callback may run on any thread.
+ *
+ * On Linux with liburing, opens, reads and stats are all queued to a single
+ * io_uring; elsewhere, or if the kernel doesn't support io_uring, a pool of
+ * threads issues them with ordinary system calls.
+ */
+class IoEngine {
+public:
+    static const size_t PREFIX_SIZE = 64 * 1024;
+
+    struct Request {
+        const char *path;
+        size_t seq;
+        std::vector<uint8_t> buf;
+        struct stat sb;
+        int error;
+    };
+    typedef std::function<void(Request *)> Callback;
+
+    static std::unique_ptr<IoEngine> create(unsigned depth, Callback done);
+    virtual ~IoEngine() {}
+
+    /* The request must remain valid until its callback has been invoked. */
+    virtual void submit(Request *req) = 0;
+};
+
+}
+
+#endif /* !_IOENGINE_H_ */
@@ -0,0 +1,185 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <err.h>
+#include <fts.h>
+
+#include "pathsource.h"
+
+using namespace id3v2;
+
+PathSource::PathSource() :
+    fts(NULL), line(NULL), linecap(0)
+{
+}
+
+PathSource::~PathSource()
+{
+
+    if (fts != NULL)
+        (void)fts_close(fts);
+    free(line);
+}
+
+void
+PathSource::addfile(const char *path)
+{
+    Entry e = { Entry::FILE, path, 0 };
+
+    entries.push_back(e);
+}
+
+void
+PathSource::addtree(const char *dir)
+{
+    Entry e = { Entry::TREE, dir, 0 };
+
+    entries.push_back(e);
+}
+
+/*
+ * Read paths from standard input, separated by "delim", which is usually
+ * either a newline or a NUL.
+ */
+void
+PathSource::addstdin(int delim)
+{
+    Entry e = { Entry::INPUT, "-", delim };
+
+    entries.push_back(e);
+}
+
+/* glibc declares the comparison function without the inner const. */
+static int
+#ifdef __GLIBC__
+compare(const FTSENT **a, const FTSENT **b)
+#else
+compare(const FTSENT * const *a, const FTSENT * const *b)
+#endif
+{
+
+    return (strcmp((*a)->fts_name, (*b)->fts_name));
+}
+
+/*
+ * Return the next regular file in the tree at the head of the queue.  fts(3)
+ * reads each directory in full before returning its first entry, so the
+ * directory is scanned in large batches and its entries are visited in name
+ * order.
+ */
+bool
+PathSource::nexttree(std::string &path)
+{
+    FTSENT *ent;
+
+    if (fts == NULL) {
+        char *argv[] = { const_cast<char *>(entries.front().path.c_str()),
+            NULL };
+
+        fts = fts_open(argv, FTS_PHYSICAL | FTS_NOCHDIR, compare);
+        if (fts == NULL) {
+            warn("fts_open(%s)", argv[0]);
+            return (false);
+        }
+    }
+
+    for (;;) {
+        /* fts_read() returns NULL both at the end and on error. */
+        errno = 0;
+        if ((ent = fts_read(fts)) == NULL)
+            break;
+        switch (ent->fts_info) {
+        case FTS_F:
+            path.assign(ent->fts_path, ent->fts_pathlen);
+            return (true);
+        case FTS_DNR:
+        case FTS_ERR:
+        case FTS_NS:
+            warnx("%s: %s", ent->fts_path, strerror(ent->fts_errno));
+            break;
+        default:
+            break;
+        }
+    }
+    if (errno != 0)
+        warn("fts_read");
+    (void)fts_close(fts);
+    fts = NULL;
+    return (false);
+}
+
+bool
+PathSource::nextinput(std::string &path)
+{
+    ssize_t len;
+
+    len = getdelim(&line, &linecap, entries.front().delim, stdin);
+    if (len < 0) {
+        if (ferror(stdin))
+            warn("reading paths from stdin");
+        return (false);
+    }
+    if (len > 0 && line[len - 1] == entries.front().delim)
+        len--;
+    path.assign(line, len);
+    return (true);
+}
+
+bool
+PathSource::next(std::string &path)
+{
+
+    while (!entries.empty()) {
+        Entry &e(entries.front());
+
+        switch (e.type) {
+        case Entry::FILE:
+            path = e.path;
+            entries.pop_front();
+            return (true);
+        case Entry::TREE:
+            if (nexttree(path))
+                return (true);
+            break;
+        case Entry::INPUT:
+            if (nextinput(path)) {
+                if (path.empty())
+                    continue;
+                return (true);
+            }
+            break;
+        }
+        entries.pop_front();
+    }
+    return (false);
+}
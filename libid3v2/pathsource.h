@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2014 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PATHSOURCE_H_
+#define _PATHSOURCE_H_
+
+
+#include <cstdio>
+#include <deque>
+#include <string>
+
+#include <sys/types.h>
+#include <fts.h>
+
+namespace id3v2 {
+
+/*
+ * A source of paths to process: command-line operands, directory trees walked
+ * with fts(3), and lists of paths read from standard input.  Paths are handed
+ * out one at a time, so callers can start work on the first file long before
+ * enumeration finishes, and memory use doesn't depend on the number of paths.
+ * Entries are consumed in the order they were added.
+ */
+class PathSource {
+public:
+    PathSource();
+    ~PathSource();
+
+    void addfile(const char *path);
+    void addtree(const char *dir);
+    void addstdin(int delim);
+
+    bool next(std::string &path);
+
+private:
+    PathSource(const PathSource &);
+    PathSource &operator=(const PathSource &);
+
+    struct Entry {
+        enum { FILE, TREE, INPUT } type;
+        std::string path;
+        int delim;
+    };
+
+    bool nexttree(std::string &path);
+    bool nextinput(std::string &path);
+
+    std::deque<Entry> entries;
+    FTS *fts;
+    char *line;
+    size_t linecap;
+};
+
+}
+
+#endif /* !_PATHSOURCE_H_ */
@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2013 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIZEFMT_H_
+#define	_SIZEFMT_H_
+
+/*
+ * Format byte counts as "512B", "3KB", "1.50GiB", and so on.  Everything here
+ * is static inline so that a program need only include this header; nothing
+ * allocates, and the result is written to a caller-supplied buffer of at least
+ * SZ_FMTLEN bytes.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum sizefmt_units {
+	SZ_JEDEC,	/* Powers of 1024: KB, MB, ...  What prettysize prints. */
+	SZ_IEC,		/* Powers of 1024: KiB, MiB, ... */
+	SZ_SI,		/* Powers of 1000: kB, MB, ... */
+};
+
+#define	SZ_NPREFIX	9	/* B through YB */
+#define	SZ_MAXFRAC	9	/* Fractional digits */
+
+/*
+ * The product of two 64-bit values is less than 2^128, and 2^128 / 1000^8 has
+ * 15 integer digits.  Below YB, the integer part is always less than 1024.
+ */
+#define	SZ_FMTLEN	(15 + 1 + SZ_MAXFRAC + sizeof("YiB"))
+
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 sz_wide_t;
+#else
+typedef uint64_t sz_wide_t;
+#endif
+
+static const char sz_prefixes[][SZ_NPREFIX][4] = {
+	[SZ_JEDEC] =
+	    { "B", "KB", "MB", "GB", "TB", "PB", "EB", "ZB", "YB" },
+	[SZ_IEC] =
+	    { "B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB", "ZiB", "YiB" },
+	[SZ_SI] =
+	    { "B", "kB", "MB", "GB", "TB", "PB", "EB", "ZB", "YB" },
+};
+
+/*
+ * Compute val * mult without overflow.  Where there is no 128-bit type, the
+ * product saturates at UINT64_MAX instead.
+ */
+static inline sz_wide_t
+sizefmt_mul(uint64_t val, uint64_t mult)
+{
+
+#ifdef __SIZEOF_INT128__
+	return ((sz_wide_t)val * mult);
+#else
+	if (mult != 0 && val > UINT64_MAX / mult)
+		return (UINT64_MAX);
+	return (val * mult);
+#endif
+}
+
+/*
+ * Write the decimal digits of v to buf and return their number.
+ */
+static inline size_t
+sizefmt_digits(char *buf, uint64_t v)
+{
+	uint64_t t;
+	size_t i, len;
+
+	for (len = 1, t = v; t >= 10; t /= 10)
+		len++;
+	i = len;
+	do {
+		buf[--i] = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+	return (len);
+}
+
+/*
+ * Format val * mult into buf, using the largest prefix not greater than the
+ * product, and followed by frac digits after the decimal point.  Digits are
+ * truncated rather than rounded, so that the integer part agrees with the
+ * result of repeated division.  Plain byte counts have no fraction.  Returns
+ * the length of the result, which is not NUL-terminated.
+ */
+static inline size_t
+sizefmt(char *buf, uint64_t val, uint64_t mult, enum sizefmt_units units,
+    int frac)
+{
+	sz_wide_t v, div, rem;
+	uint64_t ip, v64;
+	const char *prefix;
+	size_t len;
+	int p, shift;
+
+	v = sizefmt_mul(val, mult);
+	if (units == SZ_SI) {
+		/* Stay in 64 bits when the product fits. */
+		shift = -1;
+		div = 1;
+		p = 0;
+		if (v <= UINT64_MAX) {
+			for (v64 = (uint64_t)v; v64 >= 1000; v64 /= 1000) {
+				div *= 1000;
+				p++;
+			}
+			ip = v64;
+		} else {
+			for (; p < SZ_NPREFIX - 1 && v / div >= 1000; p++)
+				div *= 1000;
+			ip = (uint64_t)(v / div);
+		}
+		rem = v - (sz_wide_t)ip * div;
+	} else {
+		p = 0;
+		if (v <= UINT64_MAX) {
+			for (v64 = (uint64_t)v; v64 >= 1024; v64 >>= 10)
+				p++;
+		} else {
+			for (; p < SZ_NPREFIX - 1 && (v >> (10 * (p + 1))) != 0;
+			    p++)
+				;
+		}
+		shift = 10 * p;
+		div = (sz_wide_t)1 << shift;
+		ip = (uint64_t)(v >> shift);
+		rem = v & (div - 1);
+	}
+
+	len = sizefmt_digits(buf, ip);
+	if (frac > SZ_MAXFRAC)
+		frac = SZ_MAXFRAC;
+	if (frac > 0 && p > 0) {
+		buf[len++] = '.';
+		for (; frac > 0; frac--) {
+			rem *= 10;
+			if (shift >= 0) {
+				buf[len++] = '0' + (int)(rem >> shift);
+				rem &= div - 1;
+			} else {
+				buf[len++] = '0' + (int)(rem / div);
+				rem %= div;
+			}
+		}
+	}
+	for (prefix = sz_prefixes[units][p]; *prefix != '\0'; prefix++)
+		buf[len++] = *prefix;
+	return (len);
+}
+
+#endif /* !_SIZEFMT_H_ */
@@ -0,0 +1,354 @@
+/*-
+ * Copyright (c) 2013 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "umarec.h"
+
+#define	HDRSIZE		(sizeof(struct umarec_hdr))
+#define	ZONESIZE	(sizeof(struct umarec_zone))
+
+static uint32_t
+le32(uint32_t v)
+{
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (__builtin_bswap32(v));
+#else
+	return (v);
+#endif
+}
+
+/* Convert a header between host and file byte order, in either direction. */
+static void
+swap_hdr(struct umarec_hdr *dst, const struct umarec_hdr *src)
+{
+
+	memcpy(dst->uh_magic, src->uh_magic, sizeof(dst->uh_magic));
+	dst->uh_version = le32(src->uh_version);
+	dst->uh_ncols = le32(src->uh_ncols);
+	dst->uh_nzones = le32(src->uh_nzones);
+	dst->uh_pad = 0;
+	dst->uh_nslots = ur_le64(src->uh_nslots);
+	dst->uh_nrows = ur_le64(src->uh_nrows);
+	dst->uh_interval = ur_le64(src->uh_interval);
+	dst->uh_dictoff = ur_le64(src->uh_dictoff);
+	dst->uh_rowoff = ur_le64(src->uh_rowoff);
+	dst->uh_rowsize = ur_le64(src->uh_rowsize);
+}
+
+/*
+ * Decode the header at the start of a file of the given size, and check that
+ * everything it describes lies within the file.
+ */
+static const char *
+check_hdr(struct umarec_hdr *hdr, const void *buf, uint64_t size)
+{
+	struct umarec_hdr raw;
+	uint64_t dictend;
+
+	if (size < HDRSIZE)
+		return ("file is smaller than the header");
+	memcpy(&raw, buf, HDRSIZE);
+	swap_hdr(hdr, &raw);
+	if (memcmp(hdr->uh_magic, UR_MAGIC, sizeof(hdr->uh_magic)) != 0)
+		return ("not a umastats recording");
+	if (hdr->uh_version != UR_VERSION)
+		return ("unsupported recording version");
+	if (hdr->uh_ncols != UR_NCOLS)
+		return ("unexpected number of counters per zone");
+	if (hdr->uh_dictoff < HDRSIZE || hdr->uh_dictoff % 8 != 0 ||
+	    hdr->uh_dictoff > size ||
+	    (uint64_t)hdr->uh_nzones * ZONESIZE > size - hdr->uh_dictoff)
+		return ("zone dictionary lies outside the file");
+	dictend = hdr->uh_dictoff + (uint64_t)hdr->uh_nzones * ZONESIZE;
+	if (hdr->uh_rowoff < dictend || hdr->uh_rowoff % 8 != 0 ||
+	    hdr->uh_rowoff > size)
+		return ("rows lie outside the file");
+	if (hdr->uh_rowsize !=
+	    8 * (1 + (uint64_t)hdr->uh_ncols * hdr->uh_nzones))
+		return ("row size does not match the dictionary");
+	if (hdr->uh_nslots != 0 &&
+	    hdr->uh_nslots >= (size - hdr->uh_rowoff) / hdr->uh_rowsize)
+		return ("ring is larger than the file");
+	return (NULL);
+}
+
+/*
+ * Open a recording for writing.  An existing recording is appended to, and
+ * keeps its own dictionary and ring size; nslots must be 0 or match it.
+ * Otherwise one is created with the given zones, as a ring of nslots rows,
+ * or unbounded if nslots is 0.  Errors are fatal.
+ */
+void
+umarec_open(struct umarec *ur, const char *path,
+    const struct umarec_zone *zones, uint32_t nzones, uint64_t nslots,
+    uint64_t interval)
+{
+	struct umarec_hdr raw;
+	struct stat sb;
+	const char *errstr;
+	size_t dictsize;
+	ssize_t n;
+	uint32_t i;
+
+	memset(ur, 0, sizeof(*ur));
+	if ((ur->ur_fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+		err(1, "%s", path);
+	if (fstat(ur->ur_fd, &sb) != 0)
+		err(1, "%s", path);
+
+	if (sb.st_size > 0) {
+		if ((n = pread(ur->ur_fd, &raw, sizeof(raw), 0)) < 0)
+			err(1, "%s", path);
+		if (n != sizeof(raw))
+			errx(1, "%s: file is smaller than the header", path);
+		if ((errstr = check_hdr(&ur->ur_hdr, &raw, sb.st_size)) != NULL)
+			errx(1, "%s: %s", path, errstr);
+		if (nslots != 0 && nslots != ur->ur_hdr.uh_nslots)
+			errx(1, "%s: recording has a different ring size",
+			    path);
+		dictsize = ur->ur_hdr.uh_nzones * ZONESIZE;
+		if ((ur->ur_zones = malloc(dictsize)) == NULL)
+			err(1, "malloc");
+		if (pread(ur->ur_fd, ur->ur_zones, dictsize,
+		    ur->ur_hdr.uh_dictoff) != (ssize_t)dictsize)
+			err(1, "%s: reading zone dictionary", path);
+	} else {
+		dictsize = nzones * ZONESIZE;
+		memcpy(ur->ur_hdr.uh_magic, UR_MAGIC,
+		    sizeof(ur->ur_hdr.uh_magic));
+		ur->ur_hdr.uh_version = UR_VERSION;
+		ur->ur_hdr.uh_ncols = UR_NCOLS;
+		ur->ur_hdr.uh_nzones = nzones;
+		ur->ur_hdr.uh_nslots = nslots;
+		ur->ur_hdr.uh_interval = interval;
+		ur->ur_hdr.uh_dictoff = HDRSIZE;
+		ur->ur_hdr.uh_rowoff = HDRSIZE + dictsize;
+		ur->ur_hdr.uh_rowsize = 8 * (1 + (uint64_t)UR_NCOLS * nzones);
+		if (nslots >= (INT64_MAX - ur->ur_hdr.uh_rowoff) /
+		    ur->ur_hdr.uh_rowsize)
+			errx(1, "%s: ring is too large", path);
+		if ((ur->ur_zones = malloc(dictsize)) == NULL)
+			err(1, "malloc");
+		memcpy(ur->ur_zones, zones, dictsize);
+		for (i = 0; i < nzones; i++)
+			ur->ur_zones[i].uz_size =
+			    ur_le64(ur->ur_zones[i].uz_size);
+
+		swap_hdr(&raw, &ur->ur_hdr);
+		if (pwrite(ur->ur_fd, &raw, sizeof(raw), 0) != sizeof(raw) ||
+		    pwrite(ur->ur_fd, ur->ur_zones, dictsize,
+		    HDRSIZE) != (ssize_t)dictsize)
+			err(1, "%s", path);
+		if (nslots != 0 && ftruncate(ur->ur_fd, ur->ur_hdr.uh_rowoff +
+		    (nslots + 1) * ur->ur_hdr.uh_rowsize) != 0)
+			err(1, "%s", path);
+	}
+
+	if ((ur->ur_row = malloc(ur->ur_hdr.uh_rowsize)) == NULL)
+		err(1, "malloc");
+}
+
+/*
+ * Return the dictionary index of the named zone, or -1 if it was created
+ * after the recording was.
+ */
+int
+umarec_zone_index(const struct umarec *ur, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < ur->ur_hdr.uh_nzones; i++)
+		if (strncmp(ur->ur_zones[i].uz_name, name, UR_NAMELEN) == 0)
+			return ((int)i);
+	return (-1);
+}
+
+/*
+ * Start a row for the given time.  Zones that aren't set are recorded as
+ * absent.
+ */
+void
+umarec_clear_row(struct umarec *ur, uint64_t time)
+{
+
+	memset(ur->ur_row, 0xff, ur->ur_hdr.uh_rowsize);
+	ur->ur_row[0] = ur_le64(time);
+}
+
+void
+umarec_set_zone(struct umarec *ur, int zone, const uint64_t *vals)
+{
+	uint64_t *col;
+	int i;
+
+	for (i = 0, col = ur->ur_row + 1; i < UR_NCOLS;
+	    i++, col += ur->ur_hdr.uh_nzones)
+		col[zone] = ur_le64(vals[i]);
+}
+
+/*
+ * Write the row, then the row count, so that a reader never counts a row
+ * that isn't all there.  In a ring, the row goes to the spare slot, which
+ * holds the row that fell out of the ring when the last one was counted.
+ */
+void
+umarec_write_row(struct umarec *ur)
+{
+	uint64_t nrows, slot;
+	off_t off;
+
+	slot = ur->ur_hdr.uh_nrows;
+	if (ur->ur_hdr.uh_nslots != 0)
+		slot %= ur->ur_hdr.uh_nslots + 1;
+	off = ur->ur_hdr.uh_rowoff + slot * ur->ur_hdr.uh_rowsize;
+	if (pwrite(ur->ur_fd, ur->ur_row, ur->ur_hdr.uh_rowsize, off) !=
+	    (ssize_t)ur->ur_hdr.uh_rowsize)
+		err(1, "writing row");
+	nrows = ur_le64(++ur->ur_hdr.uh_nrows);
+	if (pwrite(ur->ur_fd, &nrows, sizeof(nrows),
+	    offsetof(struct umarec_hdr, uh_nrows)) != sizeof(nrows))
+		err(1, "writing header");
+}
+
+void
+umarec_close(struct umarec *ur)
+{
+
+	(void)close(ur->ur_fd);
+	free(ur->ur_zones);
+	free(ur->ur_row);
+}
+
+/*
+ * Map a recording for reading.  Returns an error string, or NULL on success.
+ */
+const char *
+umarec_map(const char *path, struct umarec_file *uf)
+{
+	struct stat sb;
+	const char *errstr;
+	uint64_t avail;
+	uint32_t i;
+	void *base;
+	int fd;
+
+	memset(uf, 0, sizeof(*uf));
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (strerror(errno));
+	if (fstat(fd, &sb) != 0) {
+		errstr = strerror(errno);
+		(void)close(fd);
+		return (errstr);
+	}
+	if (sb.st_size < (off_t)HDRSIZE) {
+		(void)close(fd);
+		return ("file is smaller than the header");
+	}
+	base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	(void)close(fd);
+	if (base == MAP_FAILED)
+		return (strerror(errno));
+	uf->uf_base = base;
+	uf->uf_size = sb.st_size;
+
+	if ((errstr = check_hdr(&uf->uf_hdr, base, sb.st_size)) != NULL) {
+		umarec_unmap(uf);
+		return (errstr);
+	}
+	for (i = 0; i < uf->uf_hdr.uh_nzones; i++) {
+		if (memchr(uf->uf_base + uf->uf_hdr.uh_dictoff +
+		    i * ZONESIZE, '\0', UR_NAMELEN) == NULL) {
+			umarec_unmap(uf);
+			return ("zone name is not terminated");
+		}
+	}
+
+	if (uf->uf_hdr.uh_nslots != 0) {
+		uf->uf_nrows = uf->uf_hdr.uh_nrows < uf->uf_hdr.uh_nslots ?
+		    uf->uf_hdr.uh_nrows : uf->uf_hdr.uh_nslots;
+		uf->uf_first = uf->uf_hdr.uh_nrows - uf->uf_nrows;
+	} else {
+		avail = (uf->uf_size - uf->uf_hdr.uh_rowoff) /
+		    uf->uf_hdr.uh_rowsize;
+		uf->uf_nrows = uf->uf_hdr.uh_nrows < avail ?
+		    uf->uf_hdr.uh_nrows : avail;
+		uf->uf_first = 0;
+	}
+	return (NULL);
+}
+
+void
+umarec_unmap(struct umarec_file *uf)
+{
+
+	if (uf->uf_base != NULL)
+		(void)munmap((void *)(uintptr_t)uf->uf_base, uf->uf_size);
+	memset(uf, 0, sizeof(*uf));
+}
+
+const char *
+umarec_zone_name(const struct umarec_file *uf, uint32_t zone)
+{
+
+	return ((const char *)uf->uf_base + uf->uf_hdr.uh_dictoff +
+	    zone * ZONESIZE);
+}
+
+uint64_t
+umarec_zone_size(const struct umarec_file *uf, uint32_t zone)
+{
+
+	return (ur_load64(uf->uf_base + uf->uf_hdr.uh_dictoff +
+	    zone * ZONESIZE + offsetof(struct umarec_zone, uz_size)));
+}
+
+/*
+ * Return the index of the named zone, or -1.
+ */
+int
+umarec_find_zone(const struct umarec_file *uf, const char *name)
+{
+	uint32_t i;
+
+	for (i = 0; i < uf->uf_hdr.uh_nzones; i++)
+		if (strcmp(umarec_zone_name(uf, i), name) == 0)
+			return ((int)i);
+	return (-1);
+}
@@ -0,0 +1,174 @@
+/*-
+ * Copyright (c) 2013 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _UMAREC_H_
+#define	_UMAREC_H_
+
+/*
+ * A recording of UMA zone counters, as written by umastats -o.  The file is
+ * laid out so that it can be mapped and read in place:
+ *
+ *	header		struct umarec_hdr
+ *	dictionary	one struct umarec_zone per zone, written once
+ *	rows		one per snapshot, each a 64-bit wall clock time in
+ *			nanoseconds followed by UR_NCOLS columns of nzones
+ *			64-bit counters
+ *
+ * A row holds each counter for every zone contiguously, so that a query over
+ * one counter touches as little of the file as possible.  A ring keeps the
+ * last nslots rows.  Its file is preallocated to nslots + 1 slots, and row i
+ * is stored in slot i % (nslots + 1), so that the slot being written is never
+ * one that holds a row a reader counts.  Every field is little-endian, so a
+ * recording can be replayed on any host.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define	UR_MAGIC	"UMAREC\0\0"
+#define	UR_VERSION	2
+#define	UR_NAMELEN	32	/* MEMTYPE_MAXNAME, with the terminating NUL */
+
+/* Every counter of a zone that is missing from a snapshot has this value. */
+#define	UR_ABSENT	UINT64_MAX
+
+enum umarec_col {
+	UR_ALLOCS,
+	UR_FREES,
+	UR_PCPUHITS,
+	UR_PCPUMISSES,
+	UR_PCPUFREE,
+	UR_ZONEHITS,
+	UR_ZONEMISSES,
+	UR_ZONEFREE,
+	UR_NCOLS
+};
+
+struct umarec_hdr {
+	char		uh_magic[8];
+	uint32_t	uh_version;
+	uint32_t	uh_ncols;
+	uint32_t	uh_nzones;
+	uint32_t	uh_pad;
+	uint64_t	uh_nslots;	/* rows in the ring, or 0 to append */
+	uint64_t	uh_nrows;	/* rows written since creation */
+	uint64_t	uh_interval;	/* nanoseconds between rows */
+	uint64_t	uh_dictoff;
+	uint64_t	uh_rowoff;
+	uint64_t	uh_rowsize;
+};
+
+struct umarec_zone {
+	char		uz_name[UR_NAMELEN];
+	uint64_t	uz_size;	/* item size */
+};
+
+/*
+ * A recording that is being written.
+ */
+struct umarec {
+	int		ur_fd;
+	struct umarec_hdr ur_hdr;	/* in host byte order */
+	struct umarec_zone *ur_zones;
+	uint64_t	*ur_row;
+};
+
+/*
+ * A recording mapped for reading.  Rows are numbered from 0, the oldest that
+ * is still in the file, to uf_nrows - 1.
+ */
+struct umarec_file {
+	const uint8_t	*uf_base;
+	size_t		uf_size;
+	struct umarec_hdr uf_hdr;	/* in host byte order */
+	uint64_t	uf_first;	/* the index of row 0 since creation */
+	uint64_t	uf_nrows;
+};
+
+static inline uint64_t
+ur_le64(uint64_t v)
+{
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	return (__builtin_bswap64(v));
+#else
+	return (v);
+#endif
+}
+
+static inline uint64_t
+ur_load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (ur_le64(v));
+}
+
+static inline const uint8_t *
+umarec_rowp(const struct umarec_file *uf, uint64_t row)
+{
+	uint64_t i;
+
+	i = uf->uf_first + row;
+	if (uf->uf_hdr.uh_nslots != 0)
+		i %= uf->uf_hdr.uh_nslots + 1;
+	return (uf->uf_base + uf->uf_hdr.uh_rowoff + i * uf->uf_hdr.uh_rowsize);
+}
+
+/* The wall clock time of a row, in nanoseconds since the Epoch. */
+static inline uint64_t
+umarec_time(const struct umarec_file *uf, uint64_t row)
+{
+
+	return (ur_load64(umarec_rowp(uf, row)));
+}
+
+static inline uint64_t
+umarec_get(const struct umarec_file *uf, uint64_t row, enum umarec_col col,
+    uint32_t zone)
+{
+
+	return (ur_load64(umarec_rowp(uf, row) +
+	    8 * (1 + (uint64_t)col * uf->uf_hdr.uh_nzones + zone)));
+}
+
+void	umarec_open(struct umarec *, const char *, const struct umarec_zone *,
+	    uint32_t, uint64_t, uint64_t);
+int	umarec_zone_index(const struct umarec *, const char *);
+void	umarec_clear_row(struct umarec *, uint64_t);
+void	umarec_set_zone(struct umarec *, int, const uint64_t *);
+void	umarec_write_row(struct umarec *);
+void	umarec_close(struct umarec *);
+
+const char *umarec_map(const char *, struct umarec_file *);
+void	umarec_unmap(struct umarec_file *);
+const char *umarec_zone_name(const struct umarec_file *, uint32_t);
+uint64_t umarec_zone_size(const struct umarec_file *, uint32_t);
+int	umarec_find_zone(const struct umarec_file *, const char *);
+
+#endif /* !_UMAREC_H_ */
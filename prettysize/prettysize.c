@@ -30,13 +30,23 @@
 #include <errno.h>
 #include <libgen.h>
 #include <libutil.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-static const char *prefixes[] = { "B", "KB", "MB", "GB", "TB" };
+#include "sizefmt.h"
+
+#define	IOBUFSIZE	(64 * 1024)
+#define	SAFEDIGITS	(ULONG_MAX > 0xffffffffUL ? 19 : 9)
+
 static const char *progname;
+static enum sizefmt_units units = SZ_JEDEC;
+static int fracdigits;
+
+static char outbuf[IOBUFSIZE];
+static size_t outlen;
 
 void	usage(void);
 
@@ -45,28 +55,186 @@ usage()
 {
 
 	fprintf(stderr,
-	    "Usage: %s [-b divisor] mem-size\n"
-	    "       %s [-p] mem-size\n\n"
+	    "Usage: %s [-d digits] [-u units] [-b divisor] mem-size\n"
+	    "       %s [-d digits] [-u units] [-p] mem-size\n"
+	    "       %s [-d digits] [-u units] [-b divisor | -p] [-f field] < input\n\n"
 	    "Arguments:\n"
 	    "  -b divisor\tTreat mem-size as a multiple of <divisor>, which must be an\n"
 	    "            \tinteger. For example, use -b 1024 for a quantity given in KB.\n"
-	    "  -p\t\tTreat mem-size as a page count (i.e. multiply by 4096).\n",
-	    basename(progname), basename(progname));
+	    "  -d digits\tPrint up to 9 digits after the decimal point.\n"
+	    "  -f field\tOnly rewrite the given field (counting from 1) of each line.\n"
+	    "  -p\t\tTreat mem-size as a page count (i.e. multiply by 4096).\n"
+	    "  -u units\tOne of \"jedec\" (KB, the default), \"iec\" (KiB), or \"si\"\n"
+	    "          \t(kB, powers of 1000).\n\n"
+	    "Without mem-size, standard input is copied to standard output, and each\n"
+	    "blank-separated field that is a decimal number is rewritten in place.\n",
+	    basename(progname), basename(progname), basename(progname));
 	exit(1);
 }
 
+/*
+ * Parse a field of decimal digits that is too long to be sure to fit in an
+ * unsigned long.  Like strtoul(3), values that are too large saturate at
+ * ULONG_MAX.
+ */
+static unsigned long
+parse_long(const char *s, const char *end)
+{
+	unsigned long val;
+	unsigned d;
+
+	for (val = 0; s < end; s++) {
+		d = *s - '0';
+		if (val > (ULONG_MAX - d) / 10)
+			return (ULONG_MAX);
+		val = val * 10 + d;
+	}
+	return (val);
+}
+
+static void
+writeall(const char *p, size_t len)
+{
+	ssize_t n;
+
+	for (; len > 0; p += n, len -= n) {
+		if ((n = write(STDOUT_FILENO, p, len)) < 0) {
+			if (errno != EINTR)
+				err(1, "write");
+			n = 0;
+		}
+	}
+}
+
+static void
+flush(void)
+{
+
+	writeall(outbuf, outlen);
+	outlen = 0;
+}
+
+static void
+emit(const char *p, size_t len)
+{
+
+	if (len > sizeof(outbuf) - outlen) {
+		flush();
+		if (len > sizeof(outbuf)) {
+			writeall(p, len);
+			return;
+		}
+	}
+	memcpy(outbuf + outlen, p, len);
+	outlen += len;
+}
+
+static void
+emit_size(unsigned long in, unsigned long divisor)
+{
+
+	if (sizeof(outbuf) - outlen < SZ_FMTLEN)
+		flush();
+	outlen += sizefmt(outbuf + outlen, in, divisor, units, fracdigits);
+}
+
+/*
+ * Rewrite the numeric fields of the line [p, eol), or just the given field if
+ * field is non-zero, and copy everything else up to "end" unchanged.
+ */
+static void
+filter_line(const char *p, const char *eol, const char *end,
+    unsigned long divisor, int field)
+{
+	const char *copied, *s;
+	unsigned long in;
+	unsigned d;
+	int col;
+
+	copied = p;
+	for (col = 1; p < eol; col++) {
+		while (p < eol && (*p == ' ' || *p == '\t'))
+			p++;
+		if (p == eol)
+			break;
+
+		/* Accumulate leading digits as the field is scanned. */
+		s = p;
+		for (in = 0; p < eol && (d = (unsigned char)*p - '0') <= 9; p++)
+			in = in * 10 + d;
+		if (p != s && (p == eol || *p == ' ' || *p == '\t') &&
+		    (field == 0 || col == field)) {
+			if (p - s > SAFEDIGITS)
+				in = parse_long(s, p);
+			emit(copied, s - copied);
+			emit_size(in, divisor);
+			copied = p;
+		}
+		while (p < eol && *p != ' ' && *p != '\t')
+			p++;
+		if (col == field)
+			break;
+	}
+	emit(copied, end - copied);
+}
+
+/*
+ * Filter standard input a buffer at a time.  Lines that don't end within the
+ * buffer are moved to its start before the next read, and the buffer grows if
+ * a single line fills it.
+ */
+static void
+filter(unsigned long divisor, int field)
+{
+	char *buf, *p, *end, *eol;
+	size_t size, len;
+	ssize_t n;
+
+	size = IOBUFSIZE;
+	if ((buf = malloc(size)) == NULL)
+		err(1, "malloc");
+	len = 0;
+	for (;;) {
+		if (len == size) {
+			size *= 2;
+			if ((buf = realloc(buf, size)) == NULL)
+				err(1, "realloc");
+		}
+		if ((n = read(STDIN_FILENO, buf + len, size - len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "read");
+		}
+		if (n == 0)
+			break;
+		len += n;
+
+		end = buf + len;
+		for (p = buf; (eol = memchr(p, '\n', end - p)) != NULL;
+		    p = eol + 1)
+			filter_line(p, eol, eol + 1, divisor, field);
+		len = end - p;
+		memmove(buf, p, len);
+	}
+	if (len > 0)
+		filter_line(buf, buf + len, buf + len, divisor, field);
+	flush();
+	free(buf);
+}
+
 int
 main(int argc, char **argv)
 {
-	unsigned long in, divisor;
+	unsigned long in, divisor, field, frac;
 	char *endptr;
-	char buf[32];
-	int i, numprfx, opt;
+	char buf[SZ_FMTLEN];
+	int opt;
 
 	progname = argv[0];
 	divisor = 1;
+	field = 0;
 
-	while ((opt = getopt(argc, argv, "b:p")) != -1)
+	while ((opt = getopt(argc, argv, "b:d:f:pu:")) != -1)
 		switch (opt) {
 		case 'b':
 			divisor = strtoul(optarg, &endptr, 10);
@@ -74,9 +242,32 @@ main(int argc, char **argv)
 			    divisor == 0)
 				usage();
 			break;
+		case 'd':
+			frac = strtoul(optarg, &endptr, 10);
+			if (optarg[0] == '\0' || *endptr != '\0' ||
+			    frac > SZ_MAXFRAC)
+				usage();
+			fracdigits = (int)frac;
+			break;
+		case 'f':
+			field = strtoul(optarg, &endptr, 10);
+			if (optarg[0] == '\0' || *endptr != '\0' ||
+			    field == 0 || field > INT_MAX)
+				usage();
+			break;
 		case 'p':
 			divisor = (1 << 12);
 			break;
+		case 'u':
+			if (strcmp(optarg, "jedec") == 0)
+				units = SZ_JEDEC;
+			else if (strcmp(optarg, "iec") == 0)
+				units = SZ_IEC;
+			else if (strcmp(optarg, "si") == 0)
+				units = SZ_SI;
+			else
+				usage();
+			break;
 		default:
 			usage();
 			break;
@@ -84,23 +275,18 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc != 1)
+	if (argc == 0) {
+		filter(divisor, (int)field);
+		return (0);
+	}
+	if (argc != 1 || field != 0)
 		usage();
 
 	in = strtoul(argv[0], &endptr, 10);
 	if (argv[0][0] == '\0' || *endptr != '\0')
 		usage();
-	in *= divisor;
-
-	numprfx = sizeof(prefixes) / sizeof(*prefixes);
-	for (i = 0; i < numprfx; i++) {
-		if (in < 1024 || i == numprfx - 1) {
-			snprintf(buf, sizeof(buf), "%lu%s", in, prefixes[i]);
-			break;
-		}
-		in /= 1024;
-	}
 
+	buf[sizefmt(buf, in, divisor, units, fracdigits)] = '\0';
 	printf("%s\n", buf);
 
 	return (0);
@@ -0,0 +1,213 @@
+/*-
+ * Copyright (c) 2013 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Compare the formatter in libsizefmt with the snprintf(3)-based code that it
+ * replaced.  Each formatter is run over the same set of values, whose
+ * magnitudes are spread evenly from bytes to exabytes, for a fixed time, and
+ * one tab-separated line is printed per formatter:
+ *
+ *	Mvalues/s	ns/value	name
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sizefmt.h"
+
+#define	nitems(x)	(sizeof(x) / sizeof((x)[0]))
+
+#define	NVALUES		4096
+
+static const char *snprefixes[] = { "B", "KB", "MB", "GB", "TB", "PB", "EB" };
+static const char *iecprefixes[] =
+    { "B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB" };
+
+static size_t
+sz_jedec(char *buf, uint64_t v)
+{
+
+	return (sizefmt(buf, v, 1, SZ_JEDEC, 0));
+}
+
+static size_t
+sz_iec2(char *buf, uint64_t v)
+{
+
+	return (sizefmt(buf, v, 1, SZ_IEC, 2));
+}
+
+static size_t
+sz_si1(char *buf, uint64_t v)
+{
+
+	return (sizefmt(buf, v, 1, SZ_SI, 1));
+}
+
+/* The loop that prettysize used before libsizefmt. */
+static size_t
+sn_jedec(char *buf, uint64_t v)
+{
+	int p;
+
+	for (p = 0; v >= 1024 && p < (int)nitems(snprefixes) - 1; p++)
+		v /= 1024;
+	return (snprintf(buf, SZ_FMTLEN, "%ju%s", (uintmax_t)v,
+	    snprefixes[p]));
+}
+
+static size_t
+sn_iec2(char *buf, uint64_t v)
+{
+	double d;
+	int p;
+
+	for (d = v, p = 0; d >= 1024 && p < (int)nitems(iecprefixes) - 1; p++)
+		d /= 1024;
+	return (snprintf(buf, SZ_FMTLEN, "%.2f%s", d, iecprefixes[p]));
+}
+
+static size_t
+sn_si1(char *buf, uint64_t v)
+{
+	double d;
+	int p;
+
+	for (d = v, p = 0; d >= 1000 && p < (int)nitems(snprefixes) - 1; p++)
+		d /= 1000;
+	return (snprintf(buf, SZ_FMTLEN, "%.1f%s", d,
+	    p == 1 ? "kB" : snprefixes[p]));
+}
+
+static const struct {
+	const char *name;
+	size_t (*fn)(char *, uint64_t);
+} impls[] = {
+	{ "sizefmt-jedec", sz_jedec },
+	{ "snprintf-jedec", sn_jedec },
+	{ "sizefmt-iec-2", sz_iec2 },
+	{ "snprintf-iec-2", sn_iec2 },
+	{ "sizefmt-si-1", sz_si1 },
+	{ "snprintf-si-1", sn_si1 },
+};
+
+static uint64_t values[NVALUES];
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-t secs]\n", getprogname());
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * Fill the value set using xorshift64, with a bit length chosen uniformly so
+ * that each prefix is equally represented.
+ */
+static void
+make_values(void)
+{
+	uint64_t x;
+	unsigned bits, i;
+
+	x = 0x9e3779b97f4a7c15;
+	for (i = 0; i < NVALUES; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		bits = x % 64 + 1;
+		values[i] = x >> (64 - bits);
+	}
+}
+
+static void
+bench(const char *name, size_t (*fn)(char *, uint64_t), double secs)
+{
+	char buf[SZ_FMTLEN];
+	double start, elapsed;
+	uint64_t n;
+	size_t sum;
+	unsigned i;
+
+	n = sum = 0;
+	start = now();
+	do {
+		for (i = 0; i < NVALUES; i++)
+			sum += fn(buf, values[i]);
+		n += NVALUES;
+	} while ((elapsed = now() - start) < secs);
+
+	/* Use the lengths so that the calls can't be discarded. */
+	if (sum == 0)
+		errx(1, "%s: no output", name);
+	printf("%.1f\t%.1f\t%s\n", n / elapsed / 1e6, elapsed * 1e9 / n, name);
+}
+
+int
+main(int argc, char **argv)
+{
+	char *endptr;
+	double secs;
+	unsigned i;
+	int ch;
+
+	secs = 1;
+	while ((ch = getopt(argc, argv, "t:")) != -1) {
+		switch (ch) {
+		case 't':
+			secs = strtod(optarg, &endptr);
+			if (optarg[0] == '\0' || *endptr != '\0' || secs <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (argc != optind)
+		usage();
+
+	make_values();
+	for (i = 0; i < nitems(impls); i++)
+		bench(impls[i].name, impls[i].fn, secs);
+	return (0);
+}
@@ -24,34 +24,392 @@
  * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+/*
+ * With a hostname operand, print it with the local domain removed, as
+ * trimdomain(3) does.  Without one, copy standard input to standard output,
+ * removing a domain suffix from every hostname in it.  The suffixes come from
+ * -s and -f, or default to the local domain.
+ *
+ * The suffixes are stored reversed in a trie whose alphabet is the set of
+ * characters that can appear in a hostname, case-folded.  The input is
+ * scanned once: each run of hostname characters is matched from its end
+ * against the trie, and the longest suffix that starts at a label boundary,
+ * with a label before it, is dropped.  Everything else is written straight
+ * from the input buffer with writev(2).
+ */
+
 #include <sys/param.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
 #include <libgen.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 
+#ifdef __FreeBSD__
 #include <libutil.h>
+#else
+#define	__dead2		__attribute__((__noreturn__))
+#endif
+
+#ifndef IOV_MAX
+#define	IOV_MAX		1024
+#endif
+
+#define	IOBUFSIZE	(256 * 1024)
+
+/* Letters, digits, '-', '.' and '_'.  Class 0 is everything else. */
+#define	NCLASS		40
+
+struct tnode {
+	uint32_t	tn_next[NCLASS];	/* 0 if there is no child */
+	bool		tn_suffix;		/* a suffix ends here */
+};
+
+static struct tnode *trie;
+static size_t trielen, triesize;
+static size_t nsuffix;
+static uint8_t classmap[UCHAR_MAX + 1];
 
-static void	usage(const char *);
+static struct iovec iov[IOV_MAX];
+static int niov;
+
+static void	usage(char *);
 
 static void __dead2
-usage(const char *progname)
+usage(char *progname)
 {
 
-	fprintf(stderr, "usage: %s hostname\n", basename(progname));
+	fprintf(stderr,
+	    "usage: %s [-f file] [-s suffix] hostname\n"
+	    "       %s [-f file] [-s suffix] < input\n",
+	    basename(progname), basename(progname));
 	exit(1);
 }
 
+#ifndef __FreeBSD__
+/*
+ * A stand-in for libutil's trimdomain(3): if fullhost is a single label
+ * followed by the local domain, and possibly an X display, drop the domain.
+ */
+static void
+trimdomain(char *fullhost, int hostsize)
+{
+	static char domain[MAXHOSTNAMELEN];
+	static size_t dlen;
+	static bool first = true;
+	char *s, *d;
+
+	if (first) {
+		first = false;
+		if (gethostname(domain, sizeof(domain) - 1) == 0 &&
+		    (s = strchr(domain, '.')) != NULL)
+			memmove(domain, s + 1, strlen(s + 1) + 1);
+		else
+			domain[0] = '\0';
+		dlen = strlen(domain);
+	}
+	if (domain[0] == '\0')
+		return;
+	if ((s = memchr(fullhost, '.', strnlen(fullhost, hostsize))) == NULL ||
+	    strncasecmp(s + 1, domain, dlen) != 0)
+		return;
+	if (s[dlen + 1] == '\0') {
+		*s = '\0';
+	} else if (s[dlen + 1] == ':') {
+		/* Keep an X display, e.g., host.domain:0.0 -> host:0.0. */
+		for (d = s + dlen + 2; isdigit((unsigned char)*d); d++)
+			;
+		if (*d == '.')
+			while (isdigit((unsigned char)*++d))
+				;
+		if (*d == '\0' && d > s + dlen + 2)
+			memmove(s, s + dlen + 1, strlen(s + dlen + 1) + 1);
+	}
+}
+#endif
+
+static void
+init_classes(void)
+{
+	const char *chars = "abcdefghijklmnopqrstuvwxyz0123456789-._";
+	int i;
+
+	for (i = 0; chars[i] != '\0'; i++) {
+		classmap[(unsigned char)chars[i]] = i + 1;
+		classmap[toupper((unsigned char)chars[i])] = i + 1;
+	}
+}
+
+static uint32_t
+trie_node(void)
+{
+
+	if (trielen == triesize) {
+		triesize = triesize == 0 ? 64 : triesize * 2;
+		if ((trie = reallocarray(trie, triesize, sizeof(*trie))) ==
+		    NULL)
+			err(1, "reallocarray");
+	}
+	memset(&trie[trielen], 0, sizeof(trie[trielen]));
+	return (trielen++);
+}
+
+static void
+add_suffix(const char *suffix)
+{
+	const char *p;
+	uint32_t n, next;
+	size_t len;
+	int c;
+
+	/* A leading dot, as in ".example.com", is implied. */
+	while (*suffix == '.')
+		suffix++;
+	len = strlen(suffix);
+	while (len > 0 && suffix[len - 1] == '.')
+		len--;
+	if (len == 0)
+		errx(1, "empty suffix");
+
+	if (trielen == 0)
+		(void)trie_node();
+	for (n = 0, p = suffix + len; p > suffix; n = next) {
+		if ((c = classmap[(unsigned char)*--p]) == 0)
+			errx(1, "invalid character in suffix '%s'", suffix);
+		if ((next = trie[n].tn_next[c]) == 0) {
+			next = trie_node();
+			trie[n].tn_next[c] = next;
+		}
+	}
+	trie[n].tn_suffix = true;
+	nsuffix++;
+}
+
+/*
+ * Read suffixes from a file, one per line.  Blank lines and text following a
+ * '#' are ignored.
+ */
+static void
+read_suffixes(const char *path)
+{
+	FILE *fp;
+	char *line, *p, *s;
+	size_t linecap;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		err(1, "%s", path);
+	line = NULL;
+	linecap = 0;
+	while (getline(&line, &linecap, fp) > 0) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		p = line;
+		while ((s = strsep(&p, " \t\r\n")) != NULL)
+			if (*s != '\0')
+				add_suffix(s);
+	}
+	if (ferror(fp))
+		err(1, "%s", path);
+	free(line);
+	(void)fclose(fp);
+}
+
+/*
+ * Return the length, including the leading dot, of the longest suffix of the
+ * hostname [s, e) that is in the trie and follows a non-empty label, or 0 if
+ * there is none.
+ */
+static size_t
+match(const char *s, const char *e)
+{
+	const char *p;
+	size_t len;
+	uint32_t n;
+
+	len = 0;
+	for (n = 0, p = e; p > s + 1; ) {
+		if ((n = trie[n].tn_next[classmap[(unsigned char)*--p]]) == 0)
+			break;
+		if (trie[n].tn_suffix && p[-1] == '.' && p - 1 > s &&
+		    p[-2] != '.')
+			len = e - p + 1;
+	}
+	return (len);
+}
+
+static void
+flush(void)
+{
+	struct iovec *v;
+	ssize_t n;
+	int cnt;
+
+	for (v = iov, cnt = niov; cnt > 0; ) {
+		if ((n = writev(STDOUT_FILENO, v, cnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "writev");
+		}
+		for (; cnt > 0 && (size_t)n >= v->iov_len; v++, cnt--)
+			n -= v->iov_len;
+		if (cnt > 0) {
+			v->iov_base = (char *)v->iov_base + n;
+			v->iov_len -= n;
+		}
+	}
+	niov = 0;
+}
+
+/*
+ * Queue [p, p + len) for output.  It must stay in place until the next
+ * flush().
+ */
+static void
+emit(const char *p, size_t len)
+{
+
+	if (len == 0)
+		return;
+	if (niov == IOV_MAX)
+		flush();
+	iov[niov].iov_base = (void *)(uintptr_t)p;
+	iov[niov].iov_len = len;
+	niov++;
+}
+
+/*
+ * Trim the hostnames in [p, end), which must not end within one, and queue
+ * the result for output.
+ */
+static void
+trim_buf(const char *p, const char *end)
+{
+	const char *copied, *s, *e;
+	size_t len;
+
+	for (copied = p; p < end; ) {
+		while (p < end && classmap[(unsigned char)*p] == 0)
+			p++;
+		for (s = p; p < end && classmap[(unsigned char)*p] != 0; p++)
+			;
+		/* A trailing dot may end a sentence rather than the name. */
+		for (e = p; e > s && e[-1] == '.'; e--)
+			;
+		if (e - s > 2 && (len = match(s, e)) != 0) {
+			emit(copied, e - len - copied);
+			copied = e;
+		}
+	}
+	emit(copied, end - copied);
+}
+
+/*
+ * Trim standard input a buffer at a time.  Only whole lines are processed
+ * until the end of the input, so that a hostname is never split between two
+ * reads; the buffer grows if a single line fills it.
+ */
+static void
+trim_stream(void)
+{
+	char *buf, *end, *eol;
+	size_t size, len;
+	ssize_t n;
+
+	size = IOBUFSIZE;
+	if ((buf = malloc(size)) == NULL)
+		err(1, "malloc");
+	len = 0;
+	for (;;) {
+		if (len == size) {
+			size *= 2;
+			if ((buf = realloc(buf, size)) == NULL)
+				err(1, "realloc");
+		}
+		if ((n = read(STDIN_FILENO, buf + len, size - len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "read");
+		}
+		if (n == 0)
+			break;
+		len += n;
+
+		end = buf + len;
+		for (eol = end; eol > buf && eol[-1] != '\n'; eol--)
+			;
+		if (eol == buf)
+			continue;
+		trim_buf(buf, eol);
+		flush();
+		len = end - eol;
+		memmove(buf, eol, len);
+	}
+	trim_buf(buf, buf + len);
+	flush();
+	free(buf);
+}
+
 int
 main(int argc, char **argv)
 {
+	char host[MAXHOSTNAMELEN], *progname, *s;
+	size_t len;
+	int ch;
+
+	progname = argv[0];
+	init_classes();
+	while ((ch = getopt(argc, argv, "f:s:")) != -1) {
+		switch (ch) {
+		case 'f':
+			read_suffixes(optarg);
+			break;
+		case 's':
+			add_suffix(optarg);
+			break;
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc > 1)
+		usage(progname);
+
+	if (argc == 1 && nsuffix == 0) {
+		trimdomain(argv[0], MAXHOSTNAMELEN);
+		printf("%s\n", argv[0]);
+		return (0);
+	}
 
-	if (argc != 2)
-		usage(argv[0]);
+	if (nsuffix == 0) {
+		if (gethostname(host, sizeof(host)) != 0)
+			err(1, "gethostname");
+		host[sizeof(host) - 1] = '\0';
+		if ((s = strchr(host, '.')) == NULL || s[1] == '\0')
+			errx(1, "no suffixes given, and the local host has no "
+			    "domain");
+		add_suffix(s + 1);
+	}
 
-	trimdomain(argv[1], MAXHOSTNAMELEN);
-	printf("%s\n", argv[1]);
+	if (argc == 1) {
+		s = argv[0];
+		len = strlen(s);
+		trim_buf(s, s + len);
+		emit("\n", 1);
+		flush();
+	} else {
+		trim_stream();
+	}
 
 	return (0);
 }
@@ -0,0 +1,430 @@
+/*-
+ * Copyright (c) 2013 Mark Johnston <markj@FreeBSD.org>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer,
+ * without modification, immediately at the beginning of the file.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Query a recording made with umastats -o, without a live kernel.  With no
+ * options, summarize it; otherwise print the rates over each interval (-r),
+ * the zones with the highest average rate of one counter (-t), or the series
+ * of one zone (-z).  With -w, write a small synthetic recording instead, for
+ * checking the queries on any host; see the Makefile.
+ */
+
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <libgen.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "umarec.h"
+
+#define	TIMELEN		32
+
+static const char *colnames[UR_NCOLS] = {
+	[UR_ALLOCS] = "allocs",
+	[UR_FREES] = "frees",
+	[UR_PCPUHITS] = "pcpuhits",
+	[UR_PCPUMISSES] = "pcpumisses",
+	[UR_PCPUFREE] = "pcpufree",
+	[UR_ZONEHITS] = "zonehits",
+	[UR_ZONEMISSES] = "zonemisses",
+	[UR_ZONEFREE] = "zonefree",
+};
+
+struct topzone {
+	uint32_t	tz_zone;
+	double		tz_avg;
+	double		tz_peak;
+	uint64_t	tz_peaktime;
+};
+
+static struct umarec_file uf;
+static const char *progname;
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: %s [-r] [-s counter] [-t count] [-z zone] file\n"
+	    "       %s -w file\n",
+	    progname, progname);
+	exit(1);
+}
+
+static const char *
+fmt_time(uint64_t ns, char *buf)
+{
+	struct tm tm;
+	time_t t;
+	size_t len;
+
+	t = ns / 1000000000;
+	(void)gmtime_r(&t, &tm);
+	len = strftime(buf, TIMELEN, "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buf + len, TIMELEN - len, ".%03uZ",
+	    (unsigned)(ns % 1000000000 / 1000000));
+	return (buf);
+}
+
+/*
+ * The change in a counter between two rows.  As in umastats, a counter that
+ * went backwards belongs to a re-created zone and started over.
+ */
+static uint64_t
+delta(uint64_t cur, uint64_t prev)
+{
+
+	return (cur >= prev ? cur - prev : cur);
+}
+
+/*
+ * Return the length in seconds of the interval that ends at the given row, or
+ * 0 if there is no usable interval.
+ */
+static double
+interval(uint64_t row)
+{
+	uint64_t t0, t1;
+
+	if (row == 0)
+		return (0);
+	t0 = umarec_time(&uf, row - 1);
+	t1 = umarec_time(&uf, row);
+	return (t1 > t0 ? (t1 - t0) / 1e9 : 0);
+}
+
+static bool
+present(uint64_t row, uint32_t zone)
+{
+
+	return (umarec_get(&uf, row, UR_ALLOCS, zone) != UR_ABSENT);
+}
+
+static double
+rate(uint64_t row, enum umarec_col col, uint32_t zone, double secs)
+{
+
+	return (delta(umarec_get(&uf, row, col, zone),
+	    umarec_get(&uf, row - 1, col, zone)) / secs);
+}
+
+static void
+print_ratio(double hits, double misses)
+{
+
+	if (hits + misses > 0)
+		printf(" %6.1f", 100 * hits / (hits + misses));
+	else
+		printf(" %6s", "-");
+}
+
+static void
+print_rates(uint64_t row, uint32_t zone, double secs)
+{
+	double hits, misses;
+
+	printf(" %10.0f %10.0f", rate(row, UR_ALLOCS, zone, secs),
+	    rate(row, UR_FREES, zone, secs));
+	hits = rate(row, UR_PCPUHITS, zone, secs);
+	misses = rate(row, UR_PCPUMISSES, zone, secs);
+	printf(" %10.0f %10.0f", hits, misses);
+	print_ratio(hits, misses);
+	hits = rate(row, UR_ZONEHITS, zone, secs);
+	misses = rate(row, UR_ZONEMISSES, zone, secs);
+	printf(" %10.0f %10.0f", hits, misses);
+	print_ratio(hits, misses);
+}
+
+static void
+summary(const char *path)
+{
+	char first[TIMELEN], last[TIMELEN];
+
+	printf("%s: %ju rows of %u zones, every %.3fs", path,
+	    (uintmax_t)uf.uf_nrows, uf.uf_hdr.uh_nzones,
+	    uf.uf_hdr.uh_interval / 1e9);
+	if (uf.uf_hdr.uh_nslots != 0)
+		printf(", in a ring of %ju (%ju written)",
+		    (uintmax_t)uf.uf_hdr.uh_nslots,
+		    (uintmax_t)uf.uf_hdr.uh_nrows);
+	printf("\n");
+	if (uf.uf_nrows > 0)
+		printf("from %s to %s\n", fmt_time(umarec_time(&uf, 0), first),
+		    fmt_time(umarec_time(&uf, uf.uf_nrows - 1), last));
+}
+
+/*
+ * Print the rates of every zone that was active in each interval, in the
+ * format of umastats -r, with the time at the end of the interval.
+ */
+static void
+replay_rates(void)
+{
+	char tbuf[TIMELEN];
+	uint64_t row;
+	uint32_t z;
+	double secs;
+	int col;
+	bool active;
+
+	for (row = 1; row < uf.uf_nrows; row++) {
+		if ((secs = interval(row)) == 0)
+			continue;
+		printf("%-24s %10s %10s %10s %10s %6s %10s %10s %6s\n",
+		    fmt_time(umarec_time(&uf, row), tbuf), "allocs/s",
+		    "frees/s", "pcpu-hit/s", "pcpu-mis/s", "pcpu%",
+		    "zone-hit/s", "zone-mis/s", "zone%");
+		for (z = 0; z < uf.uf_hdr.uh_nzones; z++) {
+			if (!present(row, z) || !present(row - 1, z))
+				continue;
+			for (active = false, col = 0; col < UR_NCOLS && !active;
+			    col++)
+				active = umarec_get(&uf, row, col, z) !=
+				    umarec_get(&uf, row - 1, col, z);
+			if (!active)
+				continue;
+			printf("%-24.24s", umarec_zone_name(&uf, z));
+			print_rates(row, z, secs);
+			printf("\n");
+		}
+		printf("\n");
+	}
+}
+
+/*
+ * Print one line per interval for a zone: its rates, then the number of
+ * items in use and cached at the end of the interval.
+ */
+static void
+replay_zone(const char *name)
+{
+	char tbuf[TIMELEN];
+	uint64_t row;
+	double secs;
+	int zone;
+
+	if ((zone = umarec_find_zone(&uf, name)) < 0)
+		errx(1, "no zone named '%s' in the recording", name);
+	printf("%-24s %10s %10s %10s %10s %6s %10s %10s %6s %10s %10s %10s\n",
+	    "time", "allocs/s", "frees/s", "pcpu-hit/s", "pcpu-mis/s", "pcpu%",
+	    "zone-hit/s", "zone-mis/s", "zone%", "used", "pcpu-free",
+	    "zone-free");
+	for (row = 1; row < uf.uf_nrows; row++) {
+		if ((secs = interval(row)) == 0 || !present(row, zone) ||
+		    !present(row - 1, zone))
+			continue;
+		printf("%-24s", fmt_time(umarec_time(&uf, row), tbuf));
+		print_rates(row, zone, secs);
+		printf(" %10ju %10ju %10ju\n",
+		    (uintmax_t)(umarec_get(&uf, row, UR_ALLOCS, zone) -
+		    umarec_get(&uf, row, UR_FREES, zone)),
+		    (uintmax_t)umarec_get(&uf, row, UR_PCPUFREE, zone),
+		    (uintmax_t)umarec_get(&uf, row, UR_ZONEFREE, zone));
+	}
+}
+
+static int
+topcmp(const void *a, const void *b)
+{
+	const struct topzone *ta, *tb;
+
+	ta = a;
+	tb = b;
+	if (ta->tz_avg != tb->tz_avg)
+		return (ta->tz_avg < tb->tz_avg ? 1 : -1);
+	return (ta->tz_zone < tb->tz_zone ? -1 : ta->tz_zone > tb->tz_zone);
+}
+
+/*
+ * Print the zones with the highest average rate of a counter over the whole
+ * recording, with the highest rate in a single interval and its time.  The
+ * counters of every zone are adjacent within a row, so this reads each row
+ * once, front to back.
+ */
+static void
+replay_top(enum umarec_col col, unsigned long count)
+{
+	struct topzone *top;
+	char tbuf[TIMELEN];
+	double *secs, dt, r;
+	uint64_t *sum, cur, prev, d, row;
+	uint32_t nzones, z;
+
+	nzones = uf.uf_hdr.uh_nzones;
+	top = calloc(nzones, sizeof(*top));
+	sum = calloc(nzones, sizeof(*sum));
+	secs = calloc(nzones, sizeof(*secs));
+	if (nzones > 0 && (top == NULL || sum == NULL || secs == NULL))
+		err(1, "calloc");
+
+	for (row = 1; row < uf.uf_nrows; row++) {
+		if ((dt = interval(row)) == 0)
+			continue;
+		for (z = 0; z < nzones; z++) {
+			cur = umarec_get(&uf, row, col, z);
+			prev = umarec_get(&uf, row - 1, col, z);
+			if (cur == UR_ABSENT || prev == UR_ABSENT)
+				continue;
+			d = delta(cur, prev);
+			sum[z] += d;
+			secs[z] += dt;
+			if ((r = d / dt) > top[z].tz_peak) {
+				top[z].tz_peak = r;
+				top[z].tz_peaktime = umarec_time(&uf, row);
+			}
+		}
+	}
+	for (z = 0; z < nzones; z++) {
+		top[z].tz_zone = z;
+		top[z].tz_avg = secs[z] > 0 ? sum[z] / secs[z] : 0;
+	}
+	qsort(top, nzones, sizeof(*top), topcmp);
+
+	printf("%-24s %12s %12s  %s\n", "zone", "avg/s", "peak/s",
+	    "peak time");
+	for (z = 0; z < nzones && z < count && top[z].tz_avg > 0; z++)
+		printf("%-24.24s %12.1f %12.1f  %s\n",
+		    umarec_zone_name(&uf, top[z].tz_zone), top[z].tz_avg,
+		    top[z].tz_peak, fmt_time(top[z].tz_peaktime, tbuf));
+	free(top);
+	free(sum);
+	free(secs);
+}
+
+/*
+ * Write a recording of three zones, one row a second from the start of 2026,
+ * to a ring of four rows that has wrapped.  "pbuf" is destroyed before row 4
+ * and is absent from it, and its counters start over in row 5.  The interval
+ * that ends at row 5 is longer than the others.
+ */
+static void
+write_fixture(const char *path)
+{
+	static const struct umarec_zone zones[] = {
+		{ "mbuf", 256 },
+		{ "pbuf", 1024 },
+		{ "tmpfs node", 232 },
+	};
+	struct umarec rec;
+	uint64_t base, i, n, vals[UR_NCOLS];
+	uint32_t z;
+
+	if (unlink(path) != 0 && errno != ENOENT)
+		err(1, "%s", path);
+	umarec_open(&rec, path, zones, nitems(zones), 4, 1000000000);
+	for (i = 0; i < 7; i++) {
+		base = (uint64_t)1767225600 + i + (i >= 5 ? 1 : 0);
+		umarec_clear_row(&rec, base * 1000000000 + (i >= 5 ?
+		    500000000 : 0));
+		for (z = 0; z < nitems(zones); z++) {
+			if (z == 1 && i == 4)
+				continue;
+			n = z == 1 && i >= 5 ? i - 4 : i + 1;
+			vals[UR_ALLOCS] = (z + 1) * 1000 * n + 10 * n * n;
+			vals[UR_FREES] = (z + 1) * 900 * n;
+			vals[UR_PCPUHITS] = (z + 1) * 950 * n + 10 * n * n;
+			vals[UR_PCPUMISSES] = (z + 1) * 50 * n;
+			vals[UR_PCPUFREE] = 100 * (z + 1) + n;
+			vals[UR_ZONEHITS] = (z + 1) * 45 * n;
+			vals[UR_ZONEMISSES] = (z + 1) * 5 * n + n * n;
+			vals[UR_ZONEFREE] = 10 * (z + 1) + 2 * n;
+			umarec_set_zone(&rec, z, vals);
+		}
+		umarec_write_row(&rec);
+	}
+	umarec_close(&rec);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *errstr, *zone;
+	char *endptr;
+	unsigned long count;
+	int ch, col;
+	bool rflag, wflag;
+
+	progname = basename(argv[0]);
+	rflag = wflag = false;
+	zone = NULL;
+	count = 0;
+	col = UR_ALLOCS;
+	while ((ch = getopt(argc, argv, "rs:t:wz:")) != -1) {
+		switch (ch) {
+		case 'r':
+			rflag = true;
+			break;
+		case 's':
+			for (col = 0; col < UR_NCOLS; col++)
+				if (strcmp(optarg, colnames[col]) == 0)
+					break;
+			if (col == UR_NCOLS)
+				errx(1, "unknown counter '%s'", optarg);
+			break;
+		case 't':
+			count = strtoul(optarg, &endptr, 10);
+			if (optarg[0] == '\0' || *endptr != '\0' || count == 0)
+				usage();
+			break;
+		case 'w':
+			wflag = true;
+			break;
+		case 'z':
+			zone = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc != 1 || rflag + (count != 0) + (zone != NULL) + wflag > 1)
+		usage();
+	if (wflag) {
+		write_fixture(argv[0]);
+		return (0);
+	}
+
+	if ((errstr = umarec_map(argv[0], &uf)) != NULL)
+		errx(1, "%s: %s", argv[0], errstr);
+	if (rflag)
+		replay_rates();
+	else if (count != 0)
+		replay_top(col, count);
+	else if (zone != NULL)
+		replay_zone(zone);
+	else
+		summary(argv[0]);
+	umarec_unmap(&uf);
+	return (0);
+}
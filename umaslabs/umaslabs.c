@@ -42,6 +42,8 @@
 
 #include <kvm.h>
 
+#include "sizefmt.h"
+
 static struct nlist namelist[] = {
 #define	X_UMA_KEGS	0
 	{ .n_name = "_uma_kegs" },
@@ -124,7 +126,7 @@ usage(void)
 int
 main(int argc, char **argv)
 {
-	char errbuf[_POSIX2_LINE_MAX], name[128], *match;
+	char errbuf[_POSIX2_LINE_MAX], name[128], sizebuf[SZ_FMTLEN], *match;
 	LIST_HEAD(, uma_keg) uma_kegs;
 	struct uma_keg *keg, *kegkp;
 	struct uma_zone zone, *zonep;
@@ -207,7 +209,9 @@ main(int argc, char **argv)
 			if (ret != 0)
 				errx(1, "kread: %s", kvm_geterr(kvm));
 
-			printf("size is %ld\n", size);
+			sizebuf[sizefmt(sizebuf, size, PAGE_SIZE, SZ_JEDEC,
+			    1)] = '\0';
+			printf("size is %ld pages (%s)\n", size, sizebuf);
 			for (long j = 0; j < size; j++) {
 				if (VPRC_WIRE_COUNT(arr[j].ref_count) == 1 &&
 				    arr[j].plinks.uma.zone == zonep)
@@ -1,68 +1,1288 @@
-#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+#include <sys/sysctl.h>
+#include <sys/uio.h>
 
+#include <curses.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <memstat.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "sizefmt.h"
+#include "umarec.h"
+
+/*
+ * A zone's counters, as of one snapshot.
+ */
+struct zstats {
+	uint64_t	zs_allocs;
+	uint64_t	zs_frees;
+	uint64_t	zs_pcpuhits;
+	uint64_t	zs_pcpumisses;
+	uint64_t	zs_pcpufree;
+	uint64_t	zs_zonehits;
+	uint64_t	zs_zonemisses;
+	uint64_t	zs_zonefree;
+};
+
+/*
+ * The previous snapshot of a zone, for rate mode, hashed by name.
+ */
+struct zone {
+	LIST_ENTRY(zone) z_link;
+	char		z_name[MEMTYPE_MAXNAME + 1];
+	struct zstats	z_prev;
+	uint64_t	*z_pcpu;	/* per-CPU counters, with -z */
+	int		z_recidx;	/* dictionary index, with -o */
+
+	/* With -t, the zone's rates over the last interval. */
+	uint64_t	z_gen;		/* the last snapshot with the zone */
+	double		z_allocs;
+	double		z_frees;
+	double		z_pmisses;
+	double		z_phits;
+	double		z_zmisses;
+	uint64_t	z_cached;	/* bytes in per-CPU caches */
+	uint64_t	z_used;		/* bytes allocated */
+	double		z_key;
+};
+
+/* The orders that the -t view can be sorted in. */
+enum topkey {
+	TOP_ALLOCS,
+	TOP_MISSES,
+	TOP_CACHED,
+};
+
+static const char *topkeys[] = {
+	[TOP_ALLOCS] = "allocs",
+	[TOP_MISSES] = "misses",
+	[TOP_CACHED] = "cached",
+};
+
+#define	ZHASHSIZE	256	/* a power of 2 */
+
+static LIST_HEAD(, zone) zhash[ZHASHSIZE];
+
+/* Every zone, in the order last shown by -t. */
+static struct zone **zorder;
+static size_t nzorder, zordersize;
+
+/*
+ * The per-CPU counters of the zone being read, as three flat arrays of ncpus
+ * entries: the hits, then the misses, then the free item counts.
+ */
+static uint64_t *pcpu;
+#define	PCPU_HITS(a)	(a)
+#define	PCPU_MISSES(a)	((a) + ncpus)
+#define	PCPU_FREE(a)	((a) + 2 * ncpus)
+
+static int ncpus;		/* mp_maxid + 1 */
+static int ndomains;
+static int *cpudomain;
+
+#define	HEATWIDTH	64	/* CPUs per heat map row */
+
+static const char **bdzones;	/* zones to break down, with -z */
+static int nbdzones;
+
+static struct umarec rec;	/* the recording, with -o */
+
+static int hflag = 0;
+static int rflag = 0;
+static int tflag = 0;
 static int wflag = 0;
 
+static volatile sig_atomic_t quit;
+
+/*
+ * A rendered exposition, shared by the scrapers that are sending it and
+ * freed by the last of them once a newer one has replaced it.
+ */
+struct exposition {
+	int		ex_refs;
+	size_t		ex_len;
+	char		*ex_buf;
+};
+
+/* A scraper's connection, from reading its request to sending the reply. */
+struct scraper {
+	int		sc_fd;
+	size_t		sc_reqlen;
+	char		sc_req[1024];
+	struct exposition *sc_ex;	/* the reply body, once read */
+	char		sc_hdr[160];
+	size_t		sc_hdrlen;
+	size_t		sc_off;		/* bytes of header and body sent */
+	double		sc_start;
+};
+
+#define	MAXSCRAPERS	64
+#define	SCRAPE_TIMEOUT	10	/* seconds */
+
+/*
+ * The counter and gauge families of the exposition, and where each zone's
+ * value is found.  Counters are suffixed with "_total" in their samples.
+ */
+static const struct metric {
+	const char	*m_name;
+	const char	*m_type;
+	const char	*m_help;
+	size_t		m_off;		/* in struct zstats, or -1 */
+} metrics[] = {
+	{ "uma_zone_allocs", "counter", "Items allocated from the zone.",
+	    offsetof(struct zstats, zs_allocs) },
+	{ "uma_zone_frees", "counter", "Items freed to the zone.",
+	    offsetof(struct zstats, zs_frees) },
+	{ "uma_zone_pcpu_hits", "counter",
+	    "Allocations satisfied by a per-CPU cache.",
+	    offsetof(struct zstats, zs_pcpuhits) },
+	{ "uma_zone_pcpu_misses", "counter",
+	    "Allocations that missed the per-CPU caches.",
+	    offsetof(struct zstats, zs_pcpumisses) },
+	{ "uma_zone_hits", "counter",
+	    "Per-CPU cache misses satisfied by the zone's cache.",
+	    offsetof(struct zstats, zs_zonehits) },
+	{ "uma_zone_misses", "counter",
+	    "Per-CPU cache misses that also missed the zone's cache.",
+	    offsetof(struct zstats, zs_zonemisses) },
+	{ "uma_zone_pcpu_free_items", "gauge",
+	    "Free items in the per-CPU caches.",
+	    offsetof(struct zstats, zs_pcpufree) },
+	{ "uma_zone_free_items", "gauge", "Free items in the zone's cache.",
+	    offsetof(struct zstats, zs_zonefree) },
+	{ "uma_zone_item_size_bytes", "gauge", "The size of an item.",
+	    (size_t)-1 },
+};
+
+/*
+ * Format a count of items of the given size into buf, which must hold
+ * SZ_FMTLEN bytes.  With -h, the count is converted to bytes and formatted
+ * for people to read.
+ */
+static const char *
+fmt_items(char *buf, uint64_t count, uint64_t size)
+{
+
+	if (hflag)
+		buf[sizefmt(buf, count, size, SZ_JEDEC, 1)] = '\0';
+	else
+		snprintf(buf, SZ_FMTLEN, "%ju", (uintmax_t)count);
+	return (buf);
+}
+
+/*
+ * Sum a per-CPU array.  It is a plain loop over contiguous counters so that
+ * the compiler can vectorize it.
+ */
+static uint64_t
+sum_pcpu(const uint64_t *a)
+{
+	uint64_t sum;
+	int i;
+
+	sum = 0;
+	for (i = 0; i < ncpus; i++)
+		sum += a[i];
+	return (sum);
+}
+
+/*
+ * Read a zone's counters.  Its per-CPU counters are left in pcpu.
+ */
 static void
-log_stats(void)
+read_stats(struct memory_type *mtp, struct zstats *zs)
 {
-	struct memory_type_list *mtlp;
-	struct memory_type *mtp;
-	char name[MEMTYPE_MAXNAME + 1];
-	uint64_t pcpuhits, pcpumisses, pcpufree;
+	uint64_t *hits, *misses, *cfree;
 	int i;
 
-	mtlp = memstat_mtl_alloc();
-	if (mtlp == NULL)
-		err(1, "memstat_mtl_alloc");
-	if (memstat_sysctl_uma(mtlp, 0) < 0)
-		err(1, "memstat_sysctl_uma");
+	hits = PCPU_HITS(pcpu);
+	misses = PCPU_MISSES(pcpu);
+	cfree = PCPU_FREE(pcpu);
+	for (i = 0; i < ncpus; i++) {
+		hits[i] = memstat_get_percpu_hits(mtp, i);
+		misses[i] = memstat_get_percpu_misses(mtp, i);
+		cfree[i] = memstat_get_percpu_free(mtp, i);
+	}
+
+	zs->zs_allocs = memstat_get_numallocs(mtp);
+	zs->zs_frees = memstat_get_numfrees(mtp);
+	zs->zs_pcpuhits = sum_pcpu(hits);
+	zs->zs_pcpumisses = sum_pcpu(misses);
+	zs->zs_pcpufree = sum_pcpu(cfree);
+	zs->zs_zonehits = memstat_get_zonehits(mtp);
+	zs->zs_zonemisses = memstat_get_zonemisses(mtp);
+	zs->zs_zonefree = memstat_get_zonefree(mtp);
+}
+
+/*
+ * Counters only grow, unless a zone was destroyed and another created with
+ * the same name, in which case the count starts over.
+ */
+static uint64_t
+delta(uint64_t cur, uint64_t prev)
+{
+
+	return (cur >= prev ? cur - prev : cur);
+}
+
+static bool
+breakdown_zone(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nbdzones; i++)
+		if (strcmp(bdzones[i], name) == 0)
+			return (true);
+	return (false);
+}
+
+/*
+ * Print the per-CPU cache state of a zone, from the counters in pcpu: one
+ * line per memory domain with its totals and a heat map of the miss ratio of
+ * each of its CPUs.  If prev holds the counters from the last interval, the
+ * hits and misses are those of the interval.
+ */
+static void
+print_breakdown(const uint64_t *prev)
+{
+	static const char heat[] = ".:-=+*#%@";
+	char row[HEATWIDTH + 1];
+	const uint64_t *hits, *misses, *cfree;
+	uint64_t h, m, dhits, dmisses, dfree;
+	int c, d, indent, lvl, n;
+
+	hits = PCPU_HITS(pcpu);
+	misses = PCPU_MISSES(pcpu);
+	cfree = PCPU_FREE(pcpu);
+	for (d = 0; d < ndomains; d++) {
+		dhits = dmisses = dfree = 0;
+		for (c = 0; c < ncpus; c++) {
+			if (cpudomain[c] != d)
+				continue;
+			dhits += prev == NULL ? hits[c] :
+			    delta(hits[c], PCPU_HITS(prev)[c]);
+			dmisses += prev == NULL ? misses[c] :
+			    delta(misses[c], PCPU_MISSES(prev)[c]);
+			dfree += cfree[c];
+		}
+		indent = printf("  domain %-2d %5.1f%% miss %10ju free ", d,
+		    dhits + dmisses > 0 ?
+		    100.0 * dmisses / (dhits + dmisses) : 0.0,
+		    (uintmax_t)dfree);
+
+		/* One character per CPU, HEATWIDTH to a row. */
+		n = 0;
+		for (c = 0; c < ncpus; c++) {
+			if (cpudomain[c] != d)
+				continue;
+			h = prev == NULL ? hits[c] :
+			    delta(hits[c], PCPU_HITS(prev)[c]);
+			m = prev == NULL ? misses[c] :
+			    delta(misses[c], PCPU_MISSES(prev)[c]);
+			if (n == HEATWIDTH) {
+				row[n] = '\0';
+				printf("|%s|\n%*s", row, indent, "");
+				n = 0;
+			}
+			if (h + m == 0) {
+				row[n++] = ' ';
+			} else {
+				lvl = (int)((sizeof(heat) - 1) * (double)m /
+				    (h + m));
+				lvl = MIN(lvl, (int)sizeof(heat) - 2);
+				row[n++] = heat[lvl];
+			}
+		}
+		row[n] = '\0';
+		printf("|%s|\n", row);
+	}
+}
+
+static void
+log_stats(struct memory_type_list *mtlp)
+{
+	struct memory_type *mtp;
+	struct zstats zs;
+	char used[SZ_FMTLEN], cfree[SZ_FMTLEN], zfree[SZ_FMTLEN];
+	uint64_t size;
 
 	for (mtp = memstat_mtl_first(mtlp); mtp != NULL;
 	    mtp = memstat_mtl_next(mtp)) {
-		strlcpy(name, memstat_get_name(mtp), MEMTYPE_MAXNAME);
-		pcpuhits = pcpumisses = pcpufree = 0;
-		for (i = 0; i < 24; i++) {
-			pcpuhits += memstat_get_percpu_hits(mtp, i);
-			pcpumisses += memstat_get_percpu_misses(mtp, i);
-			pcpufree += memstat_get_percpu_free(mtp, i);
+		read_stats(mtp, &zs);
+		size = memstat_get_size(mtp);
+		printf("%.*s: %s %s %s %ju/%ju %ju/%ju\n", MEMTYPE_MAXNAME - 1,
+		    memstat_get_name(mtp),
+		    fmt_items(used, zs.zs_allocs - zs.zs_frees, size),
+		    fmt_items(cfree, zs.zs_pcpufree, size),
+		    fmt_items(zfree, zs.zs_zonefree, size),
+		    (uintmax_t)zs.zs_pcpuhits, (uintmax_t)zs.zs_pcpumisses,
+		    (uintmax_t)zs.zs_zonehits, (uintmax_t)zs.zs_zonemisses);
+		if (nbdzones > 0 && breakdown_zone(memstat_get_name(mtp)))
+			print_breakdown(NULL);
+	}
+	fflush(stdout);
+}
+
+/* FNV-1a. */
+static uint32_t
+zone_hash(const char *name)
+{
+	uint32_t h;
+
+	for (h = 2166136261u; *name != '\0'; name++)
+		h = (h ^ (unsigned char)*name) * 16777619;
+	return (h);
+}
+
+/*
+ * Find the previous snapshot of the named zone, or add an empty one.
+ */
+static struct zone *
+zone_lookup(const char *name, bool *newp)
+{
+	struct zone *z;
+	uint32_t h;
+
+	h = zone_hash(name) & (ZHASHSIZE - 1);
+	LIST_FOREACH(z, &zhash[h], z_link) {
+		if (strcmp(z->z_name, name) == 0) {
+			*newp = false;
+			return (z);
 		}
-		printf("%s: %ju %ju %ju %ju/%ju %ju/%ju\n", name,
-		    memstat_get_numallocs(mtp) - memstat_get_numfrees(mtp),
-		    pcpufree,
-		    memstat_get_zonefree(mtp),
-		    pcpuhits, pcpumisses,
-		    memstat_get_zonehits(mtp), memstat_get_zonemisses(mtp));
+	}
+	if ((z = calloc(1, sizeof(*z))) == NULL)
+		err(1, "calloc");
+	strlcpy(z->z_name, name, sizeof(z->z_name));
+	if (nbdzones > 0 && breakdown_zone(name) &&
+	    (z->z_pcpu = calloc(3 * ncpus, sizeof(*z->z_pcpu))) == NULL)
+		err(1, "calloc");
+	LIST_INSERT_HEAD(&zhash[h], z, z_link);
+	if (nzorder == zordersize) {
+		zordersize = zordersize == 0 ? 256 : zordersize * 2;
+		if ((zorder = reallocarray(zorder, zordersize,
+		    sizeof(*zorder))) == NULL)
+			err(1, "reallocarray");
+	}
+	zorder[nzorder++] = z;
+	*newp = true;
+	return (z);
+}
+
+static double
+rate(uint64_t cur, uint64_t prev, double secs)
+{
+
+	return (delta(cur, prev) / secs);
+}
+
+static void
+print_ratio(double hits, double misses)
+{
+
+	if (hits + misses > 0)
+		printf(" %6.1f", 100 * hits / (hits + misses));
+	else
+		printf(" %6s", "-");
+}
 
+/*
+ * Print the per-second rates of the zones that were active during the last
+ * interval, which lasted "secs" seconds, and save the counters for the next
+ * one.  Zones seen for the first time only have their counters saved, and
+ * nothing is printed if no zone was active.
+ */
+static void
+log_rates(struct memory_type_list *mtlp, double secs)
+{
+	struct memory_type *mtp;
+	struct zone *z;
+	struct zstats zs, *prev;
+	char abuf[SZ_FMTLEN], fbuf[SZ_FMTLEN];
+	double allocs, frees, phits, pmisses, zhits, zmisses;
+	uint64_t size;
+	bool header, new;
+
+	header = false;
+	for (mtp = memstat_mtl_first(mtlp); mtp != NULL;
+	    mtp = memstat_mtl_next(mtp)) {
+		read_stats(mtp, &zs);
+		z = zone_lookup(memstat_get_name(mtp), &new);
+		prev = &z->z_prev;
+		if (!new && memcmp(&zs, prev, sizeof(zs)) != 0) {
+			allocs = rate(zs.zs_allocs, prev->zs_allocs, secs);
+			frees = rate(zs.zs_frees, prev->zs_frees, secs);
+			phits = rate(zs.zs_pcpuhits, prev->zs_pcpuhits, secs);
+			pmisses = rate(zs.zs_pcpumisses, prev->zs_pcpumisses,
+			    secs);
+			zhits = rate(zs.zs_zonehits, prev->zs_zonehits, secs);
+			zmisses = rate(zs.zs_zonemisses, prev->zs_zonemisses,
+			    secs);
+			size = memstat_get_size(mtp);
+
+			if (!header) {
+				printf("%-24s %10s %10s %10s %10s %6s %10s "
+				    "%10s %6s\n", "zone", "allocs/s", "frees/s",
+				    "pcpu-hit/s", "pcpu-mis/s", "pcpu%",
+				    "zone-hit/s", "zone-mis/s", "zone%");
+				header = true;
+			}
+			printf("%-24.24s %10s %10s %10.0f %10.0f",
+			    memstat_get_name(mtp),
+			    fmt_items(abuf, (uint64_t)allocs, size),
+			    fmt_items(fbuf, (uint64_t)frees, size),
+			    phits, pmisses);
+			print_ratio(phits, pmisses);
+			printf(" %10.0f %10.0f", zhits, zmisses);
+			print_ratio(zhits, zmisses);
+			printf("\n");
+			if (z->z_pcpu != NULL)
+				print_breakdown(z->z_pcpu);
+		}
+		*prev = zs;
+		if (z->z_pcpu != NULL)
+			memcpy(z->z_pcpu, pcpu, 3 * ncpus * sizeof(*pcpu));
+	}
+	if (header) {
+		printf("\n");
+		fflush(stdout);
 	}
+}
+
+/*
+ * Take a snapshot of the zones into mtlp, and return the list, or NULL if the
+ * snapshot couldn't be taken.  memstat_sysctl_uma() updates the entries
+ * already in a list and adds new ones, but never removes those of zones that
+ * have since been destroyed.  Such an entry keeps its last counters, so when
+ * the list holds more zones than the kernel has, it is replaced with a new
+ * one.
+ */
+static struct memory_type_list *
+snapshot(struct memory_type_list *mtlp)
+{
+	struct memory_type *mtp;
+	size_t len;
+	int n, nzones;
+
+	if (memstat_sysctl_uma(mtlp, 0) < 0)
+		return (NULL);
+	len = sizeof(nzones);
+	if (sysctlbyname("vm.zone_count", &nzones, &len, NULL, 0) != 0)
+		return (NULL);
+	for (n = 0, mtp = memstat_mtl_first(mtlp); mtp != NULL;
+	    mtp = memstat_mtl_next(mtp))
+		n++;
+	if (n <= nzones)
+		return (mtlp);
+
 	memstat_mtl_free(mtlp);
-	fflush(stdout);
+	if ((mtlp = memstat_mtl_alloc()) == NULL)
+		return (NULL);
+	if (memstat_sysctl_uma(mtlp, 0) < 0) {
+		memstat_mtl_free(mtlp);
+		return (NULL);
+	}
+	return (mtlp);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/*
+ * The sort key of a zone for the -t view.  Zones that have gone away sort
+ * last.
+ */
+static double
+top_key(const struct zone *z, enum topkey key, uint64_t gen)
+{
+
+	if (z->z_gen != gen)
+		return (-1);
+	switch (key) {
+	case TOP_ALLOCS:
+		return (z->z_allocs);
+	case TOP_MISSES:
+		return (z->z_pmisses);
+	case TOP_CACHED:
+		return ((double)z->z_cached);
+	}
+	return (0);
+}
+
+/*
+ * Put the k zones with the largest keys at the front of zorder, in order,
+ * and leave the rest unsorted.  The previous order is the starting point, and
+ * since it rarely changes much between intervals, the insertion sort of the
+ * first k zones is close to linear, as is the pass over the rest, most of
+ * which fall below the k-th key and are skipped with one comparison.
+ */
+static void
+top_sort(size_t k)
+{
+	struct zone *z;
+	size_t i, j;
+
+	k = MIN(k, nzorder);
+	if (k == 0)
+		return;
+	for (i = 1; i < k; i++) {
+		z = zorder[i];
+		for (j = i; j > 0 && zorder[j - 1]->z_key < z->z_key; j--)
+			zorder[j] = zorder[j - 1];
+		zorder[j] = z;
+	}
+	for (i = k; i < nzorder; i++) {
+		z = zorder[i];
+		if (z->z_key <= zorder[k - 1]->z_key)
+			continue;
+		zorder[i] = zorder[k - 1];
+		for (j = k - 1; j > 0 && zorder[j - 1]->z_key < z->z_key; j--)
+			zorder[j] = zorder[j - 1];
+		zorder[j] = z;
+	}
+}
+
+/*
+ * Take a snapshot for the -t view: compute each zone's rates over the last
+ * interval, which lasted "secs" seconds, and save the counters for the next.
+ */
+static void
+top_update(struct memory_type_list *mtlp, double secs, uint64_t gen)
+{
+	struct memory_type *mtp;
+	struct zone *z;
+	struct zstats zs, *prev;
+	uint64_t size;
+	bool new;
+
+	for (mtp = memstat_mtl_first(mtlp); mtp != NULL;
+	    mtp = memstat_mtl_next(mtp)) {
+		read_stats(mtp, &zs);
+		z = zone_lookup(memstat_get_name(mtp), &new);
+		prev = &z->z_prev;
+		if (new) {
+			z->z_allocs = z->z_frees = 0;
+			z->z_phits = z->z_pmisses = z->z_zmisses = 0;
+		} else {
+			z->z_allocs = rate(zs.zs_allocs, prev->zs_allocs, secs);
+			z->z_frees = rate(zs.zs_frees, prev->zs_frees, secs);
+			z->z_phits = rate(zs.zs_pcpuhits, prev->zs_pcpuhits,
+			    secs);
+			z->z_pmisses = rate(zs.zs_pcpumisses,
+			    prev->zs_pcpumisses, secs);
+			z->z_zmisses = rate(zs.zs_zonemisses,
+			    prev->zs_zonemisses, secs);
+		}
+		size = memstat_get_size(mtp);
+		z->z_cached = zs.zs_pcpufree * size;
+		z->z_used = (zs.zs_allocs - zs.zs_frees) * size;
+		z->z_gen = gen;
+		*prev = zs;
+	}
+}
+
+/*
+ * Draw the -t view.  The whole screen is redrawn into curses' buffer, and
+ * refresh() sends the terminal only the cells that changed.
+ */
+static void
+top_draw(enum topkey key, double interval, uint64_t gen)
+{
+	char line[256], cached[SZ_FMTLEN], used[SZ_FMTLEN];
+	const struct zone *z;
+	size_t i, nlive;
+	int y;
+
+	nlive = 0;
+	for (i = 0; i < nzorder; i++)
+		if (zorder[i]->z_gen == gen)
+			nlive++;
+
+	erase();
+	snprintf(line, sizeof(line), "%zu zones, every %gs, by %s"
+	    "    a: allocs  m: misses  c: cached  q: quit",
+	    nlive, interval, topkeys[key]);
+	mvaddnstr(0, 0, line, COLS);
+	snprintf(line, sizeof(line), "%-24s %10s %10s %10s %6s %10s %9s %9s",
+	    "zone", "allocs/s", "frees/s", "pcpu-mis/s", "pcpu%", "zone-mis/s",
+	    "cached", "used");
+	attron(A_REVERSE);
+	mvaddnstr(1, 0, line, COLS);
+	attroff(A_REVERSE);
+
+	for (i = 0, y = 2; i < nzorder && y < LINES; i++, y++) {
+		z = zorder[i];
+		if (z->z_gen != gen)
+			break;
+		cached[sizefmt(cached, z->z_cached, 1, SZ_JEDEC, 1)] = '\0';
+		used[sizefmt(used, z->z_used, 1, SZ_JEDEC, 1)] = '\0';
+		snprintf(line, sizeof(line),
+		    "%-24.24s %10.0f %10.0f %10.0f %6.1f %10.0f %9s %9s",
+		    z->z_name, z->z_allocs, z->z_frees, z->z_pmisses,
+		    z->z_phits + z->z_pmisses > 0 ?
+		    100 * z->z_phits / (z->z_phits + z->z_pmisses) : 0.0,
+		    z->z_zmisses, cached, used);
+		mvaddnstr(y, 0, line, COLS);
+	}
+	refresh();
+}
+
+static void
+top_quit(int sig __unused)
+{
+
+	quit = 1;
+}
+
+/*
+ * Advance an absolute deadline by nsec nanoseconds.
+ */
+static void
+next_deadline(struct timespec *ts, long nsec)
+{
+
+	ts->tv_sec += nsec / 1000000000;
+	ts->tv_nsec += nsec % 1000000000;
+	if (ts->tv_nsec >= 1000000000) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000;
+	}
+}
+
+/*
+ * Run the full-screen view, sorted by the given key, until the user quits,
+ * and return the zone list, which may have been replaced.  Keystrokes are
+ * read while waiting for the next deadline, and a change of key re-sorts and
+ * redraws at once.
+ */
+static struct memory_type_list *
+run_top(struct memory_type_list *mtlp, enum topkey key, double interval,
+    double snap)
+{
+	struct sigaction sa;
+	struct timespec next, cur;
+	double prevsnap;
+	uint64_t gen;
+	long ms, nsec;
+	size_t i;
+	int ch;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = top_quit;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGINT, &sa, NULL) != 0 ||
+	    sigaction(SIGTERM, &sa, NULL) != 0)
+		err(1, "sigaction");
+
+	if (initscr() == NULL)
+		errx(1, "initscr failed");
+	cbreak();
+	noecho();
+	curs_set(0);
+
+	nsec = (long)(interval * 1e9);
+	(void)clock_gettime(CLOCK_MONOTONIC, &next);
+	for (gen = 1, prevsnap = snap; !quit; gen++) {
+		top_update(mtlp, snap - prevsnap, gen);
+		for (i = 0; i < nzorder; i++)
+			zorder[i]->z_key = top_key(zorder[i], key, gen);
+		top_sort(MAX(LINES - 2, 0));
+		top_draw(key, interval, gen);
+
+		next_deadline(&next, nsec);
+		while (!quit) {
+			(void)clock_gettime(CLOCK_MONOTONIC, &cur);
+			ms = (next.tv_sec - cur.tv_sec) * 1000 +
+			    (next.tv_nsec - cur.tv_nsec + 999999) / 1000000;
+			if (ms <= 0)
+				break;
+			timeout((int)MIN(ms, INT_MAX));
+			switch ((ch = getch())) {
+			case 'a':
+			case 'm':
+			case 'c':
+				key = ch == 'a' ? TOP_ALLOCS :
+				    ch == 'm' ? TOP_MISSES : TOP_CACHED;
+				/* FALLTHROUGH */
+			case KEY_RESIZE:
+				for (i = 0; i < nzorder; i++)
+					zorder[i]->z_key =
+					    top_key(zorder[i], key, gen);
+				top_sort(MAX(LINES - 2, 0));
+				top_draw(key, interval, gen);
+				break;
+			case 'q':
+				quit = 1;
+				break;
+			}
+		}
+
+		prevsnap = snap;
+		snap = now();
+		if ((mtlp = snapshot(mtlp)) == NULL) {
+			endwin();
+			err(1, "memstat_sysctl_uma");
+		}
+	}
+	endwin();
+	return (mtlp);
+}
+
+/*
+ * Size the per-CPU arrays for every CPU up to mp_maxid, and with -z, find
+ * the memory domain of each CPU.
+ */
+static void
+init_cpus(void)
+{
+	char name[32];
+	size_t len;
+	int c, maxid;
+
+	len = sizeof(maxid);
+	if (sysctlbyname("kern.smp.maxid", &maxid, &len, NULL, 0) != 0)
+		err(1, "sysctl(kern.smp.maxid)");
+	ncpus = maxid + 1;
+	if (ncpus > MEMSTAT_MAXCPU) {
+		warnx("only the first %d of %d CPUs are reported",
+		    MEMSTAT_MAXCPU, ncpus);
+		ncpus = MEMSTAT_MAXCPU;
+	}
+	if ((pcpu = calloc(3 * ncpus, sizeof(*pcpu))) == NULL ||
+	    (cpudomain = calloc(ncpus, sizeof(*cpudomain))) == NULL)
+		err(1, "calloc");
+
+	ndomains = 1;
+	if (nbdzones == 0)
+		return;
+	len = sizeof(ndomains);
+	if (sysctlbyname("vm.ndomains", &ndomains, &len, NULL, 0) != 0 ||
+	    ndomains < 1)
+		ndomains = 1;
+	for (c = 0; c < ncpus; c++) {
+		snprintf(name, sizeof(name), "dev.cpu.%d.%%domain", c);
+		len = sizeof(cpudomain[c]);
+		if (sysctlbyname(name, &cpudomain[c], &len, NULL, 0) != 0 ||
+		    cpudomain[c] < 0 || cpudomain[c] >= ndomains)
+			cpudomain[c] = 0;
+	}
+}
+
+static uint64_t
+wallclock(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Open the recording, creating it with a dictionary of the zones in the
+ * first snapshot if it doesn't exist yet.
+ */
+static void
+start_recording(struct memory_type_list *mtlp, const char *path,
+    uint64_t nslots, double interval)
+{
+	struct memory_type *mtp;
+	struct umarec_zone *zones;
+	uint32_t n, nzones;
+
+	nzones = 0;
+	for (mtp = memstat_mtl_first(mtlp); mtp != NULL;
+	    mtp = memstat_mtl_next(mtp))
+		nzones++;
+	if ((zones = calloc(nzones, sizeof(*zones))) == NULL)
+		err(1, "calloc");
+	for (n = 0, mtp = memstat_mtl_first(mtlp); mtp != NULL;
+	    n++, mtp = memstat_mtl_next(mtp)) {
+		strlcpy(zones[n].uz_name, memstat_get_name(mtp),
+		    sizeof(zones[n].uz_name));
+		zones[n].uz_size = memstat_get_size(mtp);
+	}
+	umarec_open(&rec, path, zones, nzones, nslots,
+	    (uint64_t)(interval * 1e9));
+	free(zones);
+}
+
+/*
+ * Append a snapshot to the recording.  Zones created since the recording
+ * began aren't in its dictionary, and are left out.
+ */
+static void
+record_stats(struct memory_type_list *mtlp, uint64_t time)
+{
+	struct memory_type *mtp;
+	struct zone *z;
+	struct zstats zs;
+	uint64_t vals[UR_NCOLS];
+	bool new;
+
+	umarec_clear_row(&rec, time);
+	for (mtp = memstat_mtl_first(mtlp); mtp != NULL;
+	    mtp = memstat_mtl_next(mtp)) {
+		z = zone_lookup(memstat_get_name(mtp), &new);
+		if (new)
+			z->z_recidx = umarec_zone_index(&rec, z->z_name);
+		if (z->z_recidx < 0)
+			continue;
+		read_stats(mtp, &zs);
+		vals[UR_ALLOCS] = zs.zs_allocs;
+		vals[UR_FREES] = zs.zs_frees;
+		vals[UR_PCPUHITS] = zs.zs_pcpuhits;
+		vals[UR_PCPUMISSES] = zs.zs_pcpumisses;
+		vals[UR_PCPUFREE] = zs.zs_pcpufree;
+		vals[UR_ZONEHITS] = zs.zs_zonehits;
+		vals[UR_ZONEMISSES] = zs.zs_zonemisses;
+		vals[UR_ZONEFREE] = zs.zs_zonefree;
+		umarec_set_zone(&rec, z->z_recidx, vals);
+	}
+	umarec_write_row(&rec);
+}
+
+/*
+ * Write a label value, escaped as OpenMetrics requires.
+ */
+static void
+put_label(FILE *fp, const char *s)
+{
+
+	for (; *s != '\0'; s++) {
+		switch (*s) {
+		case '\\':
+			fputs("\\\\", fp);
+			break;
+		case '"':
+			fputs("\\\"", fp);
+			break;
+		case '\n':
+			fputs("\\n", fp);
+			break;
+		default:
+			putc(*s, fp);
+			break;
+		}
+	}
+}
+
+/*
+ * Render the latest snapshot in the OpenMetrics text format.
+ */
+static struct exposition *
+render(struct memory_type_list *mtlp)
+{
+	static struct zstats *zs;
+	static size_t zssize;
+	struct exposition *ex;
+	struct memory_type *mtp;
+	const struct metric *m;
+	FILE *fp;
+	size_t i, n;
+	uint64_t v;
+
+	/* Read each zone once; the families are then written from zs. */
+	for (n = 0, mtp = memstat_mtl_first(mtlp); mtp != NULL;
+	    n++, mtp = memstat_mtl_next(mtp)) {
+		if (n == zssize) {
+			zssize = zssize == 0 ? 256 : zssize * 2;
+			if ((zs = reallocarray(zs, zssize, sizeof(*zs))) ==
+			    NULL)
+				err(1, "reallocarray");
+		}
+		read_stats(mtp, &zs[n]);
+	}
+
+	if ((ex = calloc(1, sizeof(*ex))) == NULL)
+		err(1, "calloc");
+	if ((fp = open_memstream(&ex->ex_buf, &ex->ex_len)) == NULL)
+		err(1, "open_memstream");
+	for (m = metrics; m < metrics + nitems(metrics); m++) {
+		fprintf(fp, "# TYPE %s %s\n# HELP %s %s\n", m->m_name,
+		    m->m_type, m->m_name, m->m_help);
+		for (i = 0, mtp = memstat_mtl_first(mtlp); i < n;
+		    i++, mtp = memstat_mtl_next(mtp)) {
+			if (m->m_off == (size_t)-1)
+				v = memstat_get_size(mtp);
+			else
+				memcpy(&v, (char *)&zs[i] + m->m_off,
+				    sizeof(v));
+			fprintf(fp, "%s%s{zone=\"", m->m_name,
+			    m->m_type[0] == 'c' ? "_total" : "");
+			put_label(fp, memstat_get_name(mtp));
+			fprintf(fp, "\"} %ju\n", (uintmax_t)v);
+		}
+	}
+	fputs("# EOF\n", fp);
+	if (fclose(fp) != 0)
+		err(1, "open_memstream");
+	ex->ex_refs = 1;
+	return (ex);
+}
+
+static void
+release(struct exposition *ex)
+{
+
+	if (ex != NULL && --ex->ex_refs == 0) {
+		free(ex->ex_buf);
+		free(ex);
+	}
+}
+
+/*
+ * Bind a listening socket to "addr:port", where addr may be a bracketed IPv6
+ * address, or empty for every address.
+ */
+static int
+listen_on(const char *spec)
+{
+	struct addrinfo hints, *res, *ai;
+	char *addr, *buf, *port;
+	int error, fd, on;
+
+	if ((addr = buf = strdup(spec)) == NULL)
+		err(1, "strdup");
+	if ((port = strrchr(addr, ':')) == NULL)
+		errx(1, "%s: expected addr:port", spec);
+	*port++ = '\0';
+	if (addr[0] == '[' && addr[strlen(addr) - 1] == ']') {
+		addr[strlen(addr) - 1] = '\0';
+		addr++;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	error = getaddrinfo(addr[0] != '\0' ? addr : NULL, port, &hints, &res);
+	if (error != 0)
+		errx(1, "%s: %s", spec, gai_strerror(error));
+	fd = -1;
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		on = 1;
+		(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on,
+		    sizeof(on));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen(fd, 128) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		err(1, "%s", spec);
+	freeaddrinfo(res);
+	free(buf);
+	if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+		err(1, "fcntl");
+	return (fd);
+}
+
+static void
+drop_scraper(struct scraper *sc)
+{
+
+	close(sc->sc_fd);
+	release(sc->sc_ex);
+	sc->sc_fd = -1;
+	sc->sc_ex = NULL;
+}
+
+/*
+ * Read a scraper's request, and return true once it is complete.
+ */
+static bool
+read_request(struct scraper *sc)
+{
+	ssize_t n;
+
+	n = read(sc->sc_fd, sc->sc_req + sc->sc_reqlen,
+	    sizeof(sc->sc_req) - 1 - sc->sc_reqlen);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return (false);
+	if (n <= 0) {
+		drop_scraper(sc);
+		return (false);
+	}
+	sc->sc_reqlen += n;
+	sc->sc_req[sc->sc_reqlen] = '\0';
+	if (strstr(sc->sc_req, "\r\n\r\n") == NULL &&
+	    strstr(sc->sc_req, "\n\n") == NULL) {
+		if (sc->sc_reqlen == sizeof(sc->sc_req) - 1)
+			drop_scraper(sc);
+		return (false);
+	}
+	return (true);
+}
+
+static bool
+wants_metrics(const struct scraper *sc)
+{
+
+	return (strncmp(sc->sc_req, "GET /metrics ", 13) == 0 ||
+	    strncmp(sc->sc_req, "GET /metrics?", 13) == 0);
+}
+
+/*
+ * Prepare the reply to a complete request: the given exposition if the
+ * request is for /metrics, or a 404.
+ */
+static void
+start_reply(struct scraper *sc, struct exposition *ex)
+{
+
+	if (ex != NULL) {
+		sc->sc_ex = ex;
+		ex->ex_refs++;
+		sc->sc_hdrlen = snprintf(sc->sc_hdr, sizeof(sc->sc_hdr),
+		    "HTTP/1.0 200 OK\r\n"
+		    "Content-Type: application/openmetrics-text; "
+		    "version=1.0.0; charset=utf-8\r\n"
+		    "Content-Length: %zu\r\n\r\n", ex->ex_len);
+	} else {
+		sc->sc_hdrlen = strlcpy(sc->sc_hdr,
+		    "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n",
+		    sizeof(sc->sc_hdr));
+	}
+	sc->sc_off = 0;
+}
+
+/*
+ * Send as much of a reply as the socket takes, straight from the shared
+ * exposition, and close the connection once it has all been sent.
+ */
+static void
+write_reply(struct scraper *sc)
+{
+	struct iovec iov[2];
+	size_t bodylen;
+	ssize_t n;
+	int cnt;
+
+	bodylen = sc->sc_ex != NULL ? sc->sc_ex->ex_len : 0;
+	cnt = 0;
+	if (sc->sc_off < sc->sc_hdrlen) {
+		iov[cnt].iov_base = sc->sc_hdr + sc->sc_off;
+		iov[cnt++].iov_len = sc->sc_hdrlen - sc->sc_off;
+		if (bodylen > 0) {
+			iov[cnt].iov_base = sc->sc_ex->ex_buf;
+			iov[cnt++].iov_len = bodylen;
+		}
+	} else {
+		iov[cnt].iov_base = sc->sc_ex->ex_buf +
+		    (sc->sc_off - sc->sc_hdrlen);
+		iov[cnt++].iov_len = sc->sc_hdrlen + bodylen - sc->sc_off;
+	}
+	n = writev(sc->sc_fd, iov, cnt);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n < 0) {
+		drop_scraper(sc);
+		return;
+	}
+	sc->sc_off += n;
+	if (sc->sc_off == sc->sc_hdrlen + bodylen)
+		drop_scraper(sc);
+}
+
+/*
+ * Serve the zone counters to scrapers until killed.  A snapshot is taken when
+ * a request arrives and the latest one is older than the interval, so
+ * scrapers that arrive together share one snapshot, which is rendered once
+ * and sent to each of them from the same buffer.
+ */
+static void
+serve(struct memory_type_list *mtlp, const char *spec, double interval,
+    double snap)
+{
+	struct pollfd pfd[MAXSCRAPERS + 1];
+	struct scraper scrapers[MAXSCRAPERS], *sc;
+	struct exposition *ex;
+	double deadline, t;
+	int fd, i, lfd, nfd;
+
+	if (signal(SIGPIPE, SIG_IGN) == SIG_ERR)
+		err(1, "signal");
+	lfd = listen_on(spec);
+	for (i = 0; i < MAXSCRAPERS; i++)
+		scrapers[i].sc_fd = -1;
+	ex = render(mtlp);
+
+	for (;;) {
+		/* Stop accepting while every slot is busy. */
+		nfd = 0;
+		pfd[nfd].fd = -1;
+		pfd[nfd++].events = POLLIN;
+		deadline = -1;
+		for (i = 0; i < MAXSCRAPERS; i++) {
+			sc = &scrapers[i];
+			pfd[nfd].fd = sc->sc_fd;
+			pfd[nfd++].events = sc->sc_hdrlen == 0 ? POLLIN :
+			    POLLOUT;
+			if (sc->sc_fd < 0)
+				pfd[0].fd = lfd;
+			else if (deadline < 0 ||
+			    sc->sc_start + SCRAPE_TIMEOUT < deadline)
+				deadline = sc->sc_start + SCRAPE_TIMEOUT;
+		}
+		if (poll(pfd, nfd, deadline < 0 ? INFTIM :
+		    MAX(0, (int)((deadline - now()) * 1000) + 1)) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+
+		t = now();
+		for (i = 0; i < MAXSCRAPERS; i++) {
+			sc = &scrapers[i];
+			if (sc->sc_fd < 0)
+				continue;
+			if ((pfd[i + 1].revents & (POLLERR | POLLNVAL)) != 0 ||
+			    t - sc->sc_start >= SCRAPE_TIMEOUT) {
+				drop_scraper(sc);
+				continue;
+			}
+			if ((pfd[i + 1].revents & (POLLIN | POLLHUP)) != 0 &&
+			    sc->sc_hdrlen == 0) {
+				if (!read_request(sc))
+					continue;
+				if (wants_metrics(sc) && t - snap >= interval) {
+					if ((mtlp = snapshot(mtlp)) == NULL)
+						err(1, "memstat_sysctl_uma");
+					snap = t;
+					release(ex);
+					ex = render(mtlp);
+				}
+				start_reply(sc, wants_metrics(sc) ? ex : NULL);
+				write_reply(sc);
+			} else if ((pfd[i + 1].revents & POLLOUT) != 0) {
+				write_reply(sc);
+			}
+		}
+
+		if ((pfd[0].revents & POLLIN) == 0)
+			continue;
+		for (i = 0; i < MAXSCRAPERS; i++) {
+			if (scrapers[i].sc_fd >= 0)
+				continue;
+			if ((fd = accept(lfd, NULL, NULL)) < 0) {
+				if (errno != EAGAIN && errno != EINTR &&
+				    errno != ECONNABORTED)
+					warn("accept");
+				break;
+			}
+			if (fcntl(fd, F_SETFL, O_NONBLOCK) != 0)
+				err(1, "fcntl");
+			sc = &scrapers[i];
+			sc->sc_fd = fd;
+			sc->sc_reqlen = sc->sc_hdrlen = sc->sc_off = 0;
+			sc->sc_start = t;
+		}
+	}
 }
 
 static void
 usage(void)
 {
 
-	errx(1, "usage: %s [-w]", getprogname());
+	fprintf(stderr,
+	    "usage: %s [-hrw] [-i interval] [-z zone]\n"
+	    "       %s -o file [-i interval] [-n rows]\n"
+	    "       %s -t allocs|misses|cached [-i interval]\n"
+	    "       %s -l [addr]:port [-i interval]\n",
+	    getprogname(), getprogname(), getprogname(), getprogname());
+	exit(1);
 }
 
 int
 main(int argc, char **argv)
 {
-	int ch;
+	struct memory_type_list *mtlp;
+	struct timespec next;
+	double interval, prevsnap, snap;
+	const char *listenspec, *recpath;
+	char *endptr;
+	uint64_t nslots, rectime;
+	enum topkey key;
+	size_t i;
+	long nsec;
+	int ch, error;
 
-	while ((ch = getopt(argc, argv, "w")) != -1) {
+	interval = 1;
+	listenspec = recpath = NULL;
+	nslots = 0;
+	key = TOP_ALLOCS;
+	while ((ch = getopt(argc, argv, "hi:l:n:o:rt:wz:")) != -1) {
 		switch (ch) {
+		case 'h':
+			hflag = 1;
+			break;
+		case 'i':
+			interval = strtod(optarg, &endptr);
+			if (optarg[0] == '\0' || *endptr != '\0' ||
+			    !(interval >= 0.1 && interval <= 86400))
+				errx(1, "interval must be between 0.1 and "
+				    "86400 seconds");
+			wflag = 1;
+			break;
+		case 'l':
+			listenspec = optarg;
+			break;
+		case 'n':
+			errno = 0;
+			nslots = strtoull(optarg, &endptr, 10);
+			if (optarg[0] == '\0' || *endptr != '\0' ||
+			    errno != 0 || nslots == 0)
+				usage();
+			break;
+		case 'o':
+			recpath = optarg;
+			wflag = 1;
+			break;
+		case 'r':
+			rflag = wflag = 1;
+			break;
+		case 't':
+			for (i = 0; i < nitems(topkeys); i++)
+				if (strcmp(optarg, topkeys[i]) == 0)
+					break;
+			if (i == nitems(topkeys))
+				usage();
+			key = i;
+			tflag = wflag = 1;
+			break;
 		case 'w':
 			wflag = 1;
 			break;
+		case 'z':
+			bdzones = reallocarray(bdzones, nbdzones + 1,
+			    sizeof(*bdzones));
+			if (bdzones == NULL)
+				err(1, "reallocarray");
+			bdzones[nbdzones++] = optarg;
+			break;
 		case '?':
 		default:
 			usage();
@@ -70,14 +1290,68 @@ main(int argc, char **argv)
 		}
 	}
 
-	if (wflag) {
-		while (true) {
-			log_stats();
-			sleep(1);
-		}
-	} else {
-		log_stats();
+	if (argc != optind || (nslots != 0 && recpath == NULL) ||
+	    (recpath != NULL && (hflag || rflag || nbdzones > 0)) ||
+	    (tflag && (recpath != NULL || hflag || rflag || nbdzones > 0)) ||
+	    (listenspec != NULL && (recpath != NULL || hflag || rflag ||
+	    tflag || nbdzones > 0)))
+		usage();
+
+	init_cpus();
+	if (nbdzones > 0)
+		printf("Per-CPU cache miss ratio: ' ' idle, '.' under 11%%, "
+		    "and so on through ':-=+*#%%' to '@' at 89%% or more.\n");
+
+	/*
+	 * memstat_sysctl_uma() updates the entries already in the list, so a
+	 * single list serves every interval, until a zone is destroyed.
+	 */
+	mtlp = memstat_mtl_alloc();
+	if (mtlp == NULL)
+		err(1, "memstat_mtl_alloc");
+	snap = now();
+	rectime = wallclock();
+	if ((mtlp = snapshot(mtlp)) == NULL)
+		err(1, "memstat_sysctl_uma");
+	if (recpath != NULL)
+		start_recording(mtlp, recpath, nslots, interval);
+
+	if (listenspec != NULL) {
+		serve(mtlp, listenspec, interval, snap);
+		/* NOTREACHED */
+	}
+	if (!wflag) {
+		log_stats(mtlp);
+		memstat_mtl_free(mtlp);
+		return (0);
+	}
+	if (tflag) {
+		mtlp = run_top(mtlp, key, interval, snap);
+		memstat_mtl_free(mtlp);
+		return (0);
 	}
 
-	return (0);
+	/* Sleep until absolute deadlines, so that intervals don't drift. */
+	nsec = (long)(interval * 1e9);
+	(void)clock_gettime(CLOCK_MONOTONIC, &next);
+	for (prevsnap = snap;;) {
+		if (recpath != NULL)
+			record_stats(mtlp, rectime);
+		else if (rflag)
+			log_rates(mtlp, snap - prevsnap);
+		else
+			log_stats(mtlp);
+
+		next_deadline(&next, nsec);
+		while ((error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+		    &next, NULL)) != 0)
+			if (error != EINTR)
+				errc(1, error, "clock_nanosleep");
+
+		prevsnap = snap;
+		snap = now();
+		rectime = wallclock();
+		if ((mtlp = snapshot(mtlp)) == NULL)
+			err(1, "memstat_sysctl_uma");
+	}
 }